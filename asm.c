@@ -8,146 +8,452 @@
 #include <stdint.h>     // For fixed-width integer types (uint32_t, uint64_t, etc.)
 #include <ctype.h>      // For character classification (isspace, isdigit, etc.)
 #include <stdbool.h>    // For boolean type (_Bool in C)
+#include <stdarg.h>     // For variable argument lists (assembler_error)
+#include "simpasm.h"    // Library interface (see simpasm_assemble)
 
-// Define constants for maximum line length, maximum number of instruction lines, and instruction width.
-#define MAX_LINE_LEN 256
-#define MAX_INSTRUCTION_LINES 4100
+#ifdef SIMPASM_LIBRARY
+#include <setjmp.h>     // For setjmp/longjmp (assembler_error returns to simpasm_assemble)
+#endif
+
+// Creating the object cache directory and naming its temporary files
+#if defined(_WIN32)
+#include <direct.h>     // For _mkdir
+#include <process.h>    // For _getpid
+#define make_directory(path) _mkdir(path)
+#define process_id() _getpid()
+#else
+#include <sys/stat.h>   // For mkdir
+#include <unistd.h>     // For getpid
+#define make_directory(path) mkdir(path, 0777)
+#define process_id() getpid()
+#endif
+
+// Marks functions that never return
+#if defined(_MSC_VER)
+#define NO_RETURN __declspec(noreturn)
+#else
+#define NO_RETURN __attribute__((noreturn))
+#endif
+
+// Define constants for the source read size, path length and instruction width.
+#define SOURCE_CHUNK_LEN 65536
+#define LINE_PATH_LEN 4096
 #define INSTRUCTION_WIDTH 48
 
+// Number of fields an instruction line needs (opcode rd rs rt rm); imm1 and imm2 may be left out.
+#define INSTRUCTION_REQUIRED_FIELDS 5
+
+// Character classes of the lexer (see init_char_classes). Token characters come first.
+#define CHAR_TOKEN 0
+#define CHAR_COLON 1              // ':' (ends a label name)
+#define CHAR_SEPARATOR 2          // Whitespace, ',' and '\0'
+#define CHAR_COMMENT 3            // '#'
+#define CHAR_END_OF_LINE 4        // '\n'
+
+// Kinds of source statements (one per non-empty line).
+#define STATEMENT_LABEL 0         // "name:" - its only token is the label name
+#define STATEMENT_WORD 1          // ".word address value"
+#define STATEMENT_INSTRUCTION 2   // "opcode rd, rs, rt, rm, imm1, imm2"
+#define STATEMENT_GLOBAL 3        // ".global name" - exports a label from an object file
+
+// First line of an object file (see write_object); also part of the object cache key.
+#define OBJECT_FORMAT "SIMPOBJ 1"
+
 // Structure to hold label information: the label string and its corresponding address.
 typedef struct {
-	char label[MAX_LINE_LEN]; // Label name
+	char* label;              // Label name
 	int address;              // Address (PC value) where the label is located
+	bool global;              // Exported by '.global' (object files only)
 }Label;
 
-// Declare a global array of labels and its current size.
-Label label_list[MAX_INSTRUCTION_LINES];
+// Declare a global array of labels (in source order) and its current size and capacity.
+Label* label_list = NULL;
 int label_list_size = 0;
+int label_list_capacity = 0;
+
+// Open-addressing hash table over label_list: each slot holds a label_list index + 1 (0 = empty).
+// Its size is a power of two, kept at least twice the number of labels.
+int* label_table = NULL;
+int label_table_size = 0;
 
 // Declare an array to hold data memory. Each index corresponds to a memory address.
-uint32_t data_list[MAX_INSTRUCTION_LINES] = { 0 };
+uint32_t* data_list = NULL;
+int data_list_size = 0;
+
+// Structure to hold one statement: a run of tokens in token_list.
+typedef struct {
+	int kind;                 // STATEMENT_LABEL, STATEMENT_WORD, STATEMENT_INSTRUCTION or STATEMENT_GLOBAL
+	int first_token;          // Index of the statement's first token in token_list
+	int token_count;          // Number of tokens in the statement
+}Statement;
+
+// Structure to hold an immediate that names a label not defined yet, patched once all labels are known.
+typedef struct {
+	int instruction;          // Index of the instruction in instruction_list
+	int shift;                // Position of the immediate field (12 for imm1, 0 for imm2)
+	const char* label;        // Label name
+}LabelReference;
+
+// Class of each character, filled by init_char_classes.
+unsigned char char_class[256];
+
+// Token stream of the source file. Tokens point into the source text, NUL-terminated in place.
+char** token_list = NULL;
+int token_list_size = 0;
+int token_list_capacity = 0;
+Statement* statement_list = NULL;
+int statement_list_size = 0;
+int statement_list_capacity = 0;
+
+// Object mode (asm -c): every label reference becomes a relocation for the linker (simpld), and
+// '.global' exports labels. global_list holds the names given to '.global'.
+bool object_mode = false;
+char** global_list = NULL;
+int global_list_size = 0;
+int global_list_capacity = 0;
+
+// Encoded instructions (in program order) and the label references still to be patched into them.
+uint64_t* instruction_list = NULL;
+int instruction_list_size = 0;
+int instruction_list_capacity = 0;
+LabelReference* reference_list = NULL;
+int reference_list_size = 0;
+int reference_list_capacity = 0;
+
+#ifdef SIMPASM_LIBRARY
+// Where assembler_error returns to (set by simpasm_assemble), the message it writes and the source copy.
+jmp_buf assembler_error_jump;
+char* assembler_error_message = NULL;
+char* library_source = NULL;
+#endif
+
+// Opcode and register names, indexed by their codes.
+static const char* opcode_names[] = {
+	"add", "sub", "mac", "and", "or", "xor", "sll", "sra", "srl", "beq", "bne",
+	"blt", "bgt", "ble", "bge", "jal", "lw", "sw", "reti", "in", "out", "halt"
+};
+static const char* register_names[] = {
+	"$zero", "$imm1", "$imm2", "$v0", "$a0", "$a1", "$a2", "$t0",
+	"$t1", "$t2", "$s0", "$s1", "$s2", "$gp", "$sp", "$ra"
+};
 
 /*
- * get_line:
- * -----------
- *  Takes a string line (assembly code), removes leading/trailing spaces, handles comments (removes part after '#'),
- *  replaces commas with spaces, and reduces multiple spaces to a single space.
- *  Returns a pointer to the modified string.
+ * assembler_error:
+ * -----------------
+ *  Reports an assembly error ("Error: <message>") and exits. Built as a library (SIMPASM_LIBRARY),
+ *  it stores the message in the program being assembled and returns from simpasm_assemble instead.
  */
-char* get_line(char* str) {
-	// Remove leading spaces
-	while (isspace((unsigned char)*str)) str++;
-	if (*str == 0) return str; // If the string is empty after trimming
+NO_RETURN void assembler_error(const char* format, ...)
+{
+	va_list arguments;
+	va_start(arguments, format);
+#ifdef SIMPASM_LIBRARY
+	vsnprintf(assembler_error_message, SIMPASM_ERROR_LEN, format, arguments);
+	va_end(arguments);
+	longjmp(assembler_error_jump, 1);
+#else
+	fprintf(stderr, "Error: ");
+	vfprintf(stderr, format, arguments);
+	fprintf(stderr, "\n");
+	va_end(arguments);
+	exit(EXIT_FAILURE);
+#endif
+}
 
-	// Remove comments (everything after '#')
-	char* hash_pos = strchr(str, '#');
-	if (hash_pos) {
-		*hash_pos = '\0'; // Null-terminate the string at the '#' character
+/*
+ * grow_array:
+ * ------------
+ *  Reallocates 'array' to hold 'count' elements of 'element_size' bytes.
+ *  If memory runs out, it reports an error (see assembler_error).
+ */
+void* grow_array(void* array, size_t count, size_t element_size)
+{
+	void* grown = realloc(array, count * element_size);
+	if (grown == NULL) {
+		assembler_error("Out of memory");
 	}
+	return grown;
+}
 
-	// Remove trailing spaces
-	int end_idx = strlen(str); // End of string index
-	while (end_idx > 1 && isspace(str[end_idx - 1]))
-		end_idx--;
-	str[end_idx] = '\0'; // Null terminate the string
+/*
+ * read_source:
+ * -------------
+ *  Reads the whole assembly file into one NUL-terminated buffer and stores its length in 'length'.
+ *  Works on any stream, so the source may also come from a pipe.
+ */
+char* read_source(FILE* file, size_t* length)
+{
+	size_t capacity = SOURCE_CHUNK_LEN;
+	size_t size = 0;
+	char* text = grow_array(NULL, capacity, 1);
+	size_t got;
 
-	// Removing ',' characters by replacing them with spaces
-	for (int i = 0; str[i] != '\0'; i++)
-	{
-		if (str[i] == ',')
-			str[i] = ' ';
-	}
-
-	// Reduce multiple spaces in between parameters to a single space
-	int read_index = 0;
-	int write_index = 0;
-	bool space_flag = false; // Flag to track if we're in a sequence of spaces
-	while (str[read_index] != '\0') {
-		if (isspace(str[read_index])) {
-			if (!space_flag) {
-				str[write_index] = ' '; // Write a single space
-				space_flag = true;      // Set the flag indicating we're in a space sequence
-				write_index++;
+	while ((got = fread(text + size, 1, capacity - size - 1, file)) > 0) {
+		size += got;
+		if (size == capacity - 1) {
+			capacity *= 2;
+			text = grow_array(text, capacity, 1);
+		}
+	}
+	text[size] = '\0';
+	*length = size;
+	return text;
+}
+
+/*
+ * join_tokens:
+ * -------------
+ *  Joins 'count' consecutive tokens of a line with single spaces, in place, and returns the result
+ *  (the line as it reads with comments, commas and extra spaces removed).
+ */
+char* join_tokens(char** tokens, int count)
+{
+	char* write = tokens[0] + strlen(tokens[0]);
+	for (int i = 1; i < count; i++) {
+		size_t token_length = strlen(tokens[i]);
+		*write++ = ' ';
+		memmove(write, tokens[i], token_length); // Never moves forward: tokens only get closer
+		write += token_length;
+	}
+	*write = '\0';
+	return tokens[0];
+}
+
+/*
+ * init_char_classes:
+ * -------------------
+ *  Fills char_class, which tokenize_source uses instead of testing each character separately.
+ */
+void init_char_classes(void)
+{
+	for (int c = 0; c < 256; c++) {
+		if (c == '\n')
+			char_class[c] = CHAR_END_OF_LINE;
+		else if (c == '#')
+			char_class[c] = CHAR_COMMENT;
+		else if (isspace(c) || c == ',' || c == '\0')
+			char_class[c] = CHAR_SEPARATOR;
+		else
+			char_class[c] = c == ':' ? CHAR_COLON : CHAR_TOKEN;
+	}
+}
+
+/*
+ * tokenize_source:
+ * -----------------
+ *  Splits the source text into tokens and statements in a single pass over its characters.
+ *  Tokens are separated by whitespace and commas, and a '#' comments out the rest of its line.
+ *  A line with a ':' is a label, named by the text before the first ':' (anything after it is ignored);
+ *  a line starting with ".word" or ".global" is a directive, and any other non-empty line is an instruction.
+ *  'text' must have room for one character after its end.
+ */
+void tokenize_source(char* text, size_t length)
+{
+	char* end = text + length;
+	char* position = text;
+
+	init_char_classes();
+	*end = '\n'; // Sentinel: every line, the last one included, ends with a newline
+
+	while (position < end) {
+		int first_token = token_list_size;
+		int colon_token = -1;     // Token holding the line's first ':'
+		char* colon = NULL;
+
+		// Split one line into tokens, terminating each one in place
+		for (;;) {
+			while (char_class[(unsigned char)*position] == CHAR_SEPARATOR)
+				*position++ = '\0';
+			if (char_class[(unsigned char)*position] == CHAR_COMMENT) {
+				*position = '\0';
+				position = memchr(position, '\n', (size_t)(end - position) + 1);
+			}
+			if (*position == '\n')
+				break;
+
+			if (token_list_size == token_list_capacity) {
+				token_list_capacity = token_list_capacity ? token_list_capacity * 2 : 4096;
+				token_list = grow_array(token_list, (size_t)token_list_capacity, sizeof(char*));
+			}
+			token_list[token_list_size++] = position;
+			for (; char_class[(unsigned char)*position] <= CHAR_COLON; position++) {
+				if (*position == ':' && colon == NULL) {
+					colon = position;
+					colon_token = token_list_size - 1;
+				}
 			}
 		}
-		else {
-			str[write_index] = str[read_index]; // Write the non-space character
-			write_index++;                      // Advance write index
-			space_flag = false;                 // Reset the space flag
+		*position++ = '\0'; // Terminate the line's last token at its newline
+
+		// Skip empty lines and lines that are only a comment
+		if (token_list_size == first_token)
+			continue;
+
+		Statement statement = { STATEMENT_INSTRUCTION, first_token, token_list_size - first_token };
+		if (colon != NULL) {
+			// Keep only the label name (the tokens up to the colon)
+			*colon = '\0';
+			join_tokens(token_list + first_token, colon_token - first_token + 1);
+			token_list_size = first_token + 1;
+			statement.kind = STATEMENT_LABEL;
+			statement.token_count = 1;
+		}
+		else if (strncmp(token_list[first_token], ".word", 5) == 0)
+			statement.kind = STATEMENT_WORD;
+		else if (strcmp(token_list[first_token], ".global") == 0)
+			statement.kind = STATEMENT_GLOBAL;
+
+		if (statement_list_size == statement_list_capacity) {
+			statement_list_capacity = statement_list_capacity ? statement_list_capacity * 2 : 1024;
+			statement_list = grow_array(statement_list, (size_t)statement_list_capacity, sizeof(Statement));
 		}
-		read_index++; // Move to the next character
+		statement_list[statement_list_size++] = statement;
 	}
-	str[write_index] = '\0'; // Null-terminate the final string
-	return str;
+}
+
+/*
+ * hash_label:
+ * ------------
+ *  FNV-1a hash of a label name, used to index label_table.
+ */
+uint32_t hash_label(const char* label)
+{
+	uint32_t hash = 2166136261u;
+	while (*label) {
+		hash ^= (unsigned char)*label++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * find_label_slot:
+ * -----------------
+ *  Returns the label_table slot holding 'label', or the empty slot where it would be inserted.
+ */
+int find_label_slot(const char* label)
+{
+	int mask = label_table_size - 1;
+	int slot = (int)(hash_label(label) & (uint32_t)mask);
+	while (label_table[slot] != 0 && strcmp(label_list[label_table[slot] - 1].label, label) != 0)
+		slot = (slot + 1) & mask; // Linear probing
+	return slot;
+}
+
+/*
+ * grow_label_table:
+ * ------------------
+ *  Doubles label_table (starting at 64 slots) and re-inserts every label.
+ */
+void grow_label_table(void)
+{
+	free(label_table);
+	label_table_size = label_table_size ? label_table_size * 2 : 64;
+	label_table = calloc((size_t)label_table_size, sizeof(int));
+	if (label_table == NULL) {
+		assembler_error("Out of memory");
+	}
+	for (int i = 0; i < label_list_size; i++)
+		label_table[find_label_slot(label_list[i].label)] = i + 1;
 }
 
 /*
  * addLabel:
  * ----------
- *  Adds a label and its address to the global label_list.
+ *  Adds a label and its address to the global label_list and label_table.
+ *  If the label is already defined, it reports an error.
  *  label: name of the label.
  *  address: the PC address corresponding to this label.
  */
 void addLabel(char* label, int address)
 {
+	if (2 * (label_list_size + 1) > label_table_size)
+		grow_label_table();
+	int slot = find_label_slot(label);
+	if (label_table[slot] != 0) {
+		assembler_error("Label '%s' defined more than once", label);
+	}
+
+	if (label_list_size == label_list_capacity) {
+		label_list_capacity = label_list_capacity ? label_list_capacity * 2 : 64;
+		label_list = grow_array(label_list, (size_t)label_list_capacity, sizeof(Label));
+	}
+	label_list[label_list_size].label = grow_array(NULL, strlen(label) + 1, 1);
 	strcpy(label_list[label_list_size].label, label);
 	label_list[label_list_size].address = address;
+	label_list[label_list_size].global = false;
 	label_list_size++;
+	label_table[slot] = label_list_size;
 }
 
 /*
  * get_opcode:
  * -------------
  *  Takes an opcode string and returns the corresponding numeric code (instruction_code).
- *  If the opcode is invalid, it prints an error message and exits.
+ *  The length and a few characters single out the only possible opcode, which one
+ *  strcmp then confirms. If the opcode is invalid, it reports an error.
  */
 int get_opcode(char* opcode)
 {
-	int instruction_code;
-	if (strcmp(opcode, "add") == 0) instruction_code = 0;
-	else if (strcmp(opcode, "sub") == 0) instruction_code = 1;
-	else if (strcmp(opcode, "mac") == 0) instruction_code = 2;
-	else if (strcmp(opcode, "and") == 0) instruction_code = 3;
-	else if (strcmp(opcode, "or") == 0) instruction_code = 4;
-	else if (strcmp(opcode, "xor") == 0) instruction_code = 5;
-	else if (strcmp(opcode, "sll") == 0) instruction_code = 6;
-	else if (strcmp(opcode, "sra") == 0) instruction_code = 7;
-	else if (strcmp(opcode, "srl") == 0) instruction_code = 8;
-	else if (strcmp(opcode, "beq") == 0) instruction_code = 9;
-	else if (strcmp(opcode, "bne") == 0) instruction_code = 10;
-	else if (strcmp(opcode, "blt") == 0) instruction_code = 11;
-	else if (strcmp(opcode, "bgt") == 0) instruction_code = 12;
-	else if (strcmp(opcode, "ble") == 0) instruction_code = 13;
-	else if (strcmp(opcode, "bge") == 0) instruction_code = 14;
-	else if (strcmp(opcode, "jal") == 0) instruction_code = 15;
-	else if (strcmp(opcode, "lw") == 0) instruction_code = 16;
-	else if (strcmp(opcode, "sw") == 0) instruction_code = 17;
-	else if (strcmp(opcode, "reti") == 0) instruction_code = 18;
-	else if (strcmp(opcode, "in") == 0) instruction_code = 19;
-	else if (strcmp(opcode, "out") == 0) instruction_code = 20;
-	else if (strcmp(opcode, "halt") == 0) instruction_code = 21;
-	else {
-		fprintf(stderr, "Error: Invalid opcode '%s'\n", opcode);
-		exit(EXIT_FAILURE);
+	int instruction_code = -1;
+	switch (strlen(opcode)) {
+	case 2: // or, lw, sw, in
+		instruction_code = opcode[0] == 'o' ? 4 : opcode[0] == 'l' ? 16 : opcode[0] == 's' ? 17 : 19;
+		break;
+	case 3:
+		switch (opcode[0]) {
+		case 'a': instruction_code = opcode[1] == 'd' ? 0 : 3; break;                        // add, and
+		case 's': instruction_code = opcode[1] == 'u' ? 1 : opcode[1] == 'l' ? 6
+			: opcode[2] == 'a' ? 7 : 8; break;                                             // sub, sll, sra, srl
+		case 'm': instruction_code = 2; break;                                               // mac
+		case 'x': instruction_code = 5; break;                                               // xor
+		case 'b':                                                                            // beq .. bge
+			switch (opcode[1]) {
+			case 'e': instruction_code = 9; break;
+			case 'n': instruction_code = 10; break;
+			case 'l': instruction_code = opcode[2] == 't' ? 11 : 13; break;
+			case 'g': instruction_code = opcode[2] == 't' ? 12 : 14; break;
+			}
+			break;
+		case 'j': instruction_code = 15; break;                                              // jal
+		case 'o': instruction_code = 20; break;                                              // out
+		}
+		break;
+	case 4: // reti, halt
+		instruction_code = opcode[0] == 'r' ? 18 : 21;
+		break;
+	}
+
+	if (instruction_code < 0 || strcmp(opcode, opcode_names[instruction_code]) != 0) {
+		assembler_error("Invalid opcode '%s'", opcode);
 	}
 	return instruction_code;
 }
 
+/*
+ * find_label:
+ * ------------
+ *  Looks up a label in label_table and returns its index in label_list, or -1 if it is not defined (yet).
+ */
+int find_label(const char* label_target)
+{
+	if (label_table_size == 0)
+		return -1;
+	return label_table[find_label_slot(label_target)] - 1;
+}
+
 /*
  * get_label_address:
  * -------------------
- *  Looks up a label in the global label_list and returns the address if found.
- *  If the label is not defined, it prints an error and exits.
+ *  Looks up a label in label_table and returns the address if found.
+ *  If the label is not defined, it reports an error.
  */
 int get_label_address(const char* label_target)
 {
-	for (int i = 0; i < label_list_size; i++)
-	{
-		if (strcmp(label_list[i].label, label_target) == 0)
-			return label_list[i].address;
-	}
-	fprintf(stderr, "Error: Undefined label '%s'\n", label_target);
-	exit(EXIT_FAILURE);
+	int index = find_label(label_target);
+	if (index >= 0)
+		return label_list[index].address;
+	assembler_error("Undefined label '%s'", label_target);
 }
 
 /*
@@ -170,6 +476,16 @@ bool isNumber(const char* str)
 	return true; // All characters are digits (or an optional leading '-')
 }
 
+/*
+ * is_label_reference:
+ * --------------------
+ *  Returns true if an immediate operand is a label, i.e. neither a decimal nor a hexadecimal ("0x") number.
+ */
+bool is_label_reference(const char* str)
+{
+	return !isNumber(str) && !(str[0] == '0' && (str[1] == 'X' || str[1] == 'x'));
+}
+
 /*
  * get_immidiate_value:
  * ----------------------
@@ -180,7 +496,7 @@ bool isNumber(const char* str)
  *  Returns the integer value.
  */
 int get_immidiate_value(const char *str) {
-	if (!isNumber(str) && !(str[0] == '0' && (str[1] == 'X' || str[1] == 'x'))) {
+	if (is_label_reference(str)) {
 		// If it's not strictly numeric or hex, treat it as a label
 		return get_label_address(str);
 	}
@@ -198,52 +514,38 @@ int get_immidiate_value(const char *str) {
  * get_reg_code:
  * --------------
  *  Converts a register string (e.g. "$zero", "$a0", "$ra") to its corresponding register code (0-15).
- *  If the register is invalid, it prints an error message and exits.
+ *  As in get_opcode, the length and the letters after '$' single out the only possible register,
+ *  which one strcmp then confirms. If the register is invalid, it reports an error.
  */
 int get_reg_code(const char* reg_str)
 {
 	int register_code = -1;
+	int number = reg_str[0] != '\0' && reg_str[1] != '\0' ? reg_str[2] - '0' : -1; // Digit of $a0..$s2
+	bool numbered = number >= 0 && number <= 2;
 
-	// Check for special registers
-	if (strcmp(reg_str, "$zero") == 0) register_code = 0;
-	else if (strcmp(reg_str, "$imm1") == 0) register_code = 1;
-	else if (strcmp(reg_str, "$imm2") == 0) register_code = 2;
-	else if (strcmp(reg_str, "$v0") == 0) register_code = 3;
-
-	// Check for general registers
-	else if (reg_str[0] == '$')
-	{
-		if (reg_str[1] == 'a')
-		{
-			// $a0, $a1, $a2
-			if (strcmp(&reg_str[2], "0") == 0 || strcmp(&reg_str[2], "1") == 0 || strcmp(&reg_str[2], "2") == 0)
-				register_code = 4 + atoi(&reg_str[2]);
-		}
-		else if (reg_str[1] == 't')
-		{
-			// $t0, $t1, $t2
-			if (strcmp(&reg_str[2], "0") == 0 || strcmp(&reg_str[2], "1") == 0 || strcmp(&reg_str[2], "2") == 0)
-				register_code = 7 + atoi(&reg_str[2]);
-		}
-		else if (reg_str[1] == 's')
-		{
-			// $s0, $s1, $s2
-			if (strcmp(&reg_str[2], "0") == 0 || strcmp(&reg_str[2], "1") == 0 || strcmp(&reg_str[2], "2") == 0)
-				register_code = 10 + atoi(&reg_str[2]);
+	if (reg_str[0] == '$') {
+		switch (strlen(reg_str)) {
+		case 3: // $v0, $a0-$a2, $t0-$t2, $s0-$s2, $gp, $sp, $ra
+			switch (reg_str[1]) {
+			case 'v': register_code = 3; break;
+			case 'a': register_code = numbered ? 4 + number : -1; break;
+			case 't': register_code = numbered ? 7 + number : -1; break;
+			case 's': register_code = reg_str[2] == 'p' ? 14 : numbered ? 10 + number : -1; break;
+			case 'g': register_code = 13; break;
+			case 'r': register_code = 15; break;
+			}
+			break;
+		case 5: // $zero, $imm1, $imm2
+			register_code = reg_str[1] == 'z' ? 0 : reg_str[4] == '1' ? 1 : 2;
+			break;
 		}
 	}
 
-	// Check for more special registers
-	if (strcmp(reg_str, "$gp") == 0) register_code = 13;
-	else if (strcmp(reg_str, "$sp") == 0) register_code = 14;
-	else if (strcmp(reg_str, "$ra") == 0) register_code = 15;
-
-	// If invalid register, print error and exit
-	if (register_code != -1)
+	// If invalid register, report an error
+	if (register_code != -1 && strcmp(reg_str, register_names[register_code]) == 0)
 		return register_code;
 	else {
-		fprintf(stderr, "Error: Invalid register '%s'\n", reg_str);
-		exit(EXIT_FAILURE);
+		assembler_error("Invalid register '%s'", reg_str);
 	}
 }
 
@@ -279,6 +581,214 @@ uint64_t encodeInstruction(int opcode, int rd, int rs, int rt, int rm, int imm1,
 	return instruction_bits_rep;
 }
 
+/*
+ * assemble_word:
+ * ---------------
+ *  Stores the value of a '.word address value' statement in data_list, growing it to cover the address.
+ *  Returns the address. On an invalid or repeated address, it reports an error.
+ */
+int assemble_word(char** tokens, int token_count)
+{
+	int wordAddress;
+	uint32_t wordData;
+
+	// Parse the address and the data value from the line
+	char* line = join_tokens(tokens, token_count);
+	if (strlen(line) < 6 || sscanf(line + 6, "%i %i", &wordAddress, &wordData) != 2) {
+		assembler_error("Invalid .word directive '%s'", line);
+	}
+
+	// Grow data_list to cover the address
+	if (wordAddress < 0) {
+		assembler_error("Invalid memory address %d", wordAddress);
+	}
+	if (wordAddress >= data_list_size) {
+		int new_size = data_list_size ? data_list_size : 4096;
+		while (new_size <= wordAddress)
+			new_size *= 2;
+		data_list = grow_array(data_list, (size_t)new_size, sizeof(uint32_t));
+		memset(data_list + data_list_size, 0, (size_t)(new_size - data_list_size) * sizeof(uint32_t));
+		data_list_size = new_size;
+	}
+
+	// Check if memory address is already used
+	if (data_list[wordAddress] != 0) {
+		assembler_error("Memory address %d already defined", wordAddress);
+	}
+
+	// Store data in data_list at the specified address
+	data_list[wordAddress] = wordData;
+	return wordAddress;
+}
+
+/*
+ * get_immediate_operand:
+ * -----------------------
+ *  Returns the value of an immediate of the instruction being assembled (the next one in instruction_list).
+ *  A label that is not defined yet (or any label, in object mode) reads as 0 and is recorded in
+ *  reference_list, to be patched into the field at bit 'shift' by resolve_label_references or the linker.
+ */
+int get_immediate_operand(const char* str, int shift)
+{
+	if (!is_label_reference(str))
+		return get_immidiate_value(str);
+
+	// In an object file every label is left to the linker
+	int index = object_mode ? -1 : find_label(str);
+	if (index < 0) {
+		if (reference_list_size == reference_list_capacity) {
+			reference_list_capacity = reference_list_capacity ? reference_list_capacity * 2 : 1024;
+			reference_list = grow_array(reference_list, (size_t)reference_list_capacity, sizeof(LabelReference));
+		}
+		reference_list[reference_list_size].instruction = instruction_list_size;
+		reference_list[reference_list_size].shift = shift;
+		reference_list[reference_list_size].label = str;
+		reference_list_size++;
+		return 0;
+	}
+	return label_list[index].address;
+}
+
+/*
+ * assemble_instruction:
+ * ----------------------
+ *  Encodes an instruction statement (opcode rd rs rt rm imm1 imm2) and appends it to instruction_list.
+ *  Left-out immediates read as 0 and tokens after the seventh are ignored. If a register is missing,
+ *  it reports an error.
+ */
+void assemble_instruction(char** tokens, int token_count)
+{
+	if (token_count < INSTRUCTION_REQUIRED_FIELDS) {
+		assembler_error("Invalid instruction format '%s'", join_tokens(tokens, token_count));
+	}
+
+	// Convert imm1 and imm2 strings to integer values (they may be labels, decimal, or hex)
+	int imm1_int = token_count > 5 ? get_immediate_operand(tokens[5], 12) : 0;
+	int imm2_int = token_count > 6 ? get_immediate_operand(tokens[6], 0) : 0;
+
+	// Encode the instruction into a 48-bit format
+	uint64_t instruction = encodeInstruction(
+		get_opcode(tokens[0]),
+		get_reg_code(tokens[1]),
+		get_reg_code(tokens[2]),
+		get_reg_code(tokens[3]),
+		get_reg_code(tokens[4]),
+		imm1_int,
+		imm2_int
+	);
+
+	if (instruction_list_size == instruction_list_capacity) {
+		instruction_list_capacity = instruction_list_capacity ? instruction_list_capacity * 2 : 4096;
+		instruction_list = grow_array(instruction_list, (size_t)instruction_list_capacity, sizeof(uint64_t));
+	}
+	instruction_list[instruction_list_size++] = instruction;
+}
+
+/*
+ * resolve_label_references:
+ * --------------------------
+ *  Patches the address of every label used before its definition into its immediate field.
+ *  If a label is never defined, it reports an error.
+ */
+void resolve_label_references(void)
+{
+	for (int i = 0; i < reference_list_size; i++) {
+		LabelReference* reference = &reference_list[i];
+		uint64_t address = (uint64_t)(get_label_address(reference->label) & 0xFFF);
+		instruction_list[reference->instruction] |= address << reference->shift;
+	}
+}
+
+/*
+ * write_hex_line:
+ * ----------------
+ *  Writes 'value' as 'digits' uppercase hex digits and a newline, as fprintf's "%0<digits>X\n" does for
+ *  a value that fits (encoded instructions have 12 digits, data words 8).
+ */
+void write_hex_line(FILE* file, uint64_t value, int digits)
+{
+	char line[17];
+	for (int i = digits - 1; i >= 0; i--) {
+		line[i] = "0123456789ABCDEF"[value & 0xF];
+		value >>= 4;
+	}
+	line[digits] = '\n';
+	fwrite(line, 1, (size_t)digits + 1, file);
+}
+
+/*
+ * add_global:
+ * ------------
+ *  Handles a '.global name' statement. Outside object mode the directive has no effect (all labels
+ *  of a single source are visible anyway), so a module still assembles as part of one big source.
+ */
+void add_global(char** tokens, int token_count)
+{
+	if (token_count != 2)
+		assembler_error("Invalid .global directive '%s'", join_tokens(tokens, token_count));
+	if (!object_mode)
+		return;
+	if (global_list_size == global_list_capacity) {
+		global_list_capacity = global_list_capacity ? global_list_capacity * 2 : 64;
+		global_list = grow_array(global_list, (size_t)global_list_capacity, sizeof(char*));
+	}
+	global_list[global_list_size++] = tokens[1];
+}
+
+/*
+ * mark_global_labels:
+ * --------------------
+ *  Flags every label named by '.global'. A '.global' label must be defined in the same source.
+ */
+void mark_global_labels(void)
+{
+	for (int i = 0; i < global_list_size; i++) {
+		int index = find_label(global_list[i]);
+		if (index < 0)
+			assembler_error("Global label '%s' is not defined", global_list[i]);
+		label_list[index].global = true;
+	}
+}
+
+/*
+ * assemble_source:
+ * -----------------
+ *  Assembles source text into instruction_list, data_list and label_list. The text is split into
+ *  a token stream (tokenize_source), which is then assembled in a single pass: labels are defined,
+ *  '.word' directives fill data memory and instructions are encoded, with labels used before their
+ *  definition patched in at the end (resolve_label_references; in object mode the linker patches every
+ *  label instead). 'text' is modified and must have room for one character past 'length'.
+ *  Returns the highest data address set by '.word' (0 if none).
+ */
+int assemble_source(char* text, size_t length)
+{
+	tokenize_source(text, length);
+
+	int max_memory_address = 0; // Track highest data memory address used by '.word'
+	for (int i = 0; i < statement_list_size; i++) {
+		char** tokens = token_list + statement_list[i].first_token;
+		int token_count = statement_list[i].token_count;
+
+		if (statement_list[i].kind == STATEMENT_LABEL)
+			// The label addresses the next instruction
+			addLabel(tokens[0], instruction_list_size);
+		else if (statement_list[i].kind == STATEMENT_WORD) {
+			int wordAddress = assemble_word(tokens, token_count);
+			if (wordAddress > max_memory_address)
+				max_memory_address = wordAddress;
+		}
+		else if (statement_list[i].kind == STATEMENT_GLOBAL)
+			add_global(tokens, token_count);
+		else
+			assemble_instruction(tokens, token_count);
+	}
+	if (object_mode)
+		mark_global_labels();
+	else
+		resolve_label_references();
+	return max_memory_address;
+}
+
 /*
  * assemble:
  * ----------
@@ -286,9 +796,7 @@ uint64_t encodeInstruction(int opcode, int rd, int rs, int rt, int rm, int imm1,
  *    1) instructionFile: contains the machine code for instructions.
  *    2) dataFile: contains the data memory initialization.
  *
- *  It performs two passes:
- *    - First Pass: read each line, extract labels, and store them with their addresses.
- *    - Second Pass: encode instructions and handle '.word' directives to fill data memory.
+ *  The whole source is read once and assembled by assemble_source.
  *
  *  inputFile: the input assembly file name
  *  instructionFile: name of the file to write encoded instructions
@@ -297,7 +805,7 @@ uint64_t encodeInstruction(int opcode, int rd, int rs, int rt, int rm, int imm1,
 void assemble(const char* inputFile, const char* instructionFile, const char* dataFile)
 {
 	// Open input assembly file for reading
-	FILE* PtrInstruction_In = fopen(inputFile, "r");
+	FILE* PtrInstruction_In = fopen(inputFile, "rb");
 	if (PtrInstruction_In == NULL)
 	{
 		perror("Error opening instruction file");
@@ -323,144 +831,303 @@ void assemble(const char* inputFile, const char* instructionFile, const char* da
 		exit(EXIT_FAILURE);
 	}
 
-	// Buffer to read lines from inputFile
-	char line[MAX_INSTRUCTION_LINES];
-	int pc = 0;  // Program Counter to track instruction addresses
+	// Read and assemble the whole source
+	size_t source_length;
+	char* source_text = read_source(PtrInstruction_In, &source_length);
+	int max_memory_address = assemble_source(source_text, source_length);
 
-	// --------------------------
-	// First Pass: Label parsing
-	// --------------------------
-	while (fgets(line, sizeof(line), PtrInstruction_In)) {
-		// Process line to standard form (remove comments, spaces, etc.)
-		char *standard_instruction_line = get_line(line);
+	// Write each encoded instruction as a 12-hex-digit string to the instruction file
+	for (int i = 0; i < instruction_list_size; i++)
+		write_hex_line(PtrInstruction_Out, instruction_list[i], INSTRUCTION_WIDTH / 4);
 
-		// Skip empty lines or lines that are now comments
-		if (standard_instruction_line[0] == '#' || strlen(standard_instruction_line) == 0) 
-			continue;
+	// Output the data memory contents to dataFile
+	for (int i = 0; i <= max_memory_address; i++)
+	{
+		write_hex_line(PtrDataOut, i < data_list_size ? data_list[i] : 0, 8);
+	}
 
-		// Check if this line has a label (indicated by ':')
-		char* label_end_position = strchr(standard_instruction_line, ':');
-		if (label_end_position != NULL)
-		{
-			// Terminate string at the colon to isolate label name
-			*label_end_position = '\0';
-			// Add the label to the global list along with current pc
-			addLabel(standard_instruction_line, pc);
-		}
-		else if (strncmp(standard_instruction_line, ".word", 5) != 0)
-			// If it's not a '.word' directive, increment pc (instruction line)
-			pc++;
+	// Close all opened files
+	fclose(PtrInstruction_In);
+	fclose(PtrInstruction_Out);
+	fclose(PtrDataOut);
+}
+
+/*
+ * write_symbol_map:
+ * ------------------
+ *  Writes every label with its address ("<label> <3-digit hex address>" per line,
+ *  in source order) so the simulator can refer to code by label (sim --symbols).
+ */
+void write_symbol_map(const char* symbolFile)
+{
+	FILE* PtrSymbols_Out = fopen(symbolFile, "w");
+	if (PtrSymbols_Out == NULL) {
+		fprintf(stderr, "Error: Cannot open symbol file '%s'\n", symbolFile);
+		exit(EXIT_FAILURE);
 	}
 
-	// Reset to beginning of file for second pass
-	rewind(PtrInstruction_In);
-	pc = 0; // Reset program counter
-	int max_memory_address = 0; // Track highest data memory address used by '.word'
+	for (int i = 0; i < label_list_size; i++)
+		fprintf(PtrSymbols_Out, "%s %03X\n", label_list[i].label, label_list[i].address);
 
-	// -----------------------------
-	// Second Pass: Encode Instructions
-	// -----------------------------
-	while (fgets(line, sizeof(line), PtrInstruction_In)) {
-		// Standardize the line again
-		char* standard_instruction_line = get_line(line);
+	fclose(PtrSymbols_Out);
+}
 
-		// Skip empty or comment lines
-		if (standard_instruction_line[0] == '#' || strlen(standard_instruction_line) == 0) 
-			continue;
+/*
+ * write_object:
+ * --------------
+ *  Writes the module assembled in object mode as a relocatable object file for the linker (simpld).
+ *  The format is text; names come last on their lines, since a label name may contain spaces:
+ *
+ *    SIMPOBJ 1
+ *    code <count>                    followed by one 12-hex-digit instruction per line
+ *    data <size> <count>             size: dmemin.txt lines the module needs (last '.word' address + 1,
+ *                                    or 0 without '.word'); then one "<address> <8 hex digits>" line
+ *                                    per nonzero data word
+ *    labels <count>                  then "<offset> global|local <name>" per label, in source order
+ *                                    (offset: address within the module's code)
+ *    relocations <count>             then "<instruction> imm1|imm2 <name>" per immediate that names
+ *                                    a label (the field holds 0 until the linker patches it)
+ */
+void write_object(FILE* file, int max_memory_address)
+{
+	fprintf(file, "%s\ncode %d\n", OBJECT_FORMAT, instruction_list_size);
+	for (int i = 0; i < instruction_list_size; i++)
+		write_hex_line(file, instruction_list[i], INSTRUCTION_WIDTH / 4);
 
-		// Skip lines that only contain a label definition (already handled in pass 1)
-		char* label_end_ptr = strchr(standard_instruction_line, ':');
-		if (label_end_ptr != NULL) 
-			continue;
-		if (strlen(standard_instruction_line) == 0) 
-			continue;
+	int data_words = 0;
+	for (int i = 0; i < data_list_size; i++)
+		if (data_list[i] != 0)
+			data_words++;
+	fprintf(file, "data %d %d\n", data_list_size ? max_memory_address + 1 : 0, data_words);
+	for (int i = 0; i < data_list_size; i++)
+		if (data_list[i] != 0)
+			fprintf(file, "%d %08X\n", i, data_list[i]);
 
-		// Check if line is a data directive '.word'
-		if (strncmp(standard_instruction_line, ".word", 5) == 0) {
-			int wordAddress;
-			uint32_t wordData;
+	fprintf(file, "labels %d\n", label_list_size);
+	for (int i = 0; i < label_list_size; i++)
+		fprintf(file, "%d %s %s\n", label_list[i].address, label_list[i].global ? "global" : "local", label_list[i].label);
 
-			// Parse the address and the data value from the line
-			if (sscanf(standard_instruction_line + 6, "%i %i", &wordAddress, &wordData) != 2) {
-				fprintf(stderr, "Error: Invalid .word directive '%s'\n", standard_instruction_line);
-				exit(EXIT_FAILURE);
-			}
+	fprintf(file, "relocations %d\n", reference_list_size);
+	for (int i = 0; i < reference_list_size; i++)
+		fprintf(file, "%d %s %s\n", reference_list[i].instruction, reference_list[i].shift ? "imm1" : "imm2", reference_list[i].label);
+}
 
-			// Check if memory address is already used
-			if (data_list[wordAddress] != 0) {
-				fprintf(stderr, "Error: Memory address %d already defined\n", wordAddress);
-				exit(EXIT_FAILURE);
-			}
+/*
+ * hash_source:
+ * -------------
+ *  64-bit FNV-1a hash of the object format and a source text: the object cache key of that source.
+ */
+uint64_t hash_source(const char* text, size_t length)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (const char* format = OBJECT_FORMAT; *format; format++) {
+		hash ^= (unsigned char)*format;
+		hash *= 1099511628211ull;
+	}
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
 
-			// Store data in data_list at the specified address
-			data_list[wordAddress] = wordData;
+/*
+ * copy_file:
+ * -----------
+ *  Copies a file. Returns false if either file cannot be opened or written.
+ */
+bool copy_file(const char* from, const char* to)
+{
+	FILE* source = fopen(from, "rb");
+	if (source == NULL)
+		return false;
+	FILE* target = fopen(to, "wb");
+	if (target == NULL) {
+		fclose(source);
+		return false;
+	}
 
-			// Update the maximum used memory address
-			if (wordAddress > max_memory_address)
-				max_memory_address = wordAddress;
-		}
-		else {
-			// It's an instruction line. We'll parse and encode it.
-			char opcode[20], rd[20], rs[20], rt[20], rm[20], imm1[20], imm2[20];
-
-			// Read up to 7 tokens (opcode rd rs rt rm imm1 imm2)
-			if (sscanf(standard_instruction_line, "%s %s %s %s %s %s %s", 
-				opcode, rd, rs, rt, rm, imm1, imm2) < 0)
-			{
-				fprintf(stderr, "Error: Invalid instruciton format'%s'\n", standard_instruction_line);
-				exit(EXIT_FAILURE);
-			}
+	char buffer[SOURCE_CHUNK_LEN];
+	size_t got;
+	bool copied = true;
+	while ((got = fread(buffer, 1, sizeof(buffer), source)) > 0)
+		if (fwrite(buffer, 1, got, target) != got)
+			copied = false;
+	fclose(source);
+	if (fclose(target) != 0)
+		copied = false;
+	return copied;
+}
 
-			// Convert imm1 and imm2 strings to integer values (they may be labels, decimal, or hex)
-			int imm1_int = get_immidiate_value(imm1), imm2_int = get_immidiate_value(imm2);
-
-			// Encode the instruction into a 48-bit format
-			uint64_t instruction = encodeInstruction(
-				get_opcode(opcode),
-				get_reg_code(rd),
-				get_reg_code(rs),
-				get_reg_code(rt),
-				get_reg_code(rm),
-				imm1_int,
-				imm2_int
-			);
-
-			// Write the encoded instruction as a 12-hex-digit string to the instruction file
-			fprintf(PtrInstruction_Out, "%012llX\n", instruction);
-
-			// Increment program counter for the next instruction
-			pc++;
-		}
+/*
+ * assemble_object:
+ * -----------------
+ *  Assembles one module into an object file (asm -c). With a cache directory, the object is also
+ *  kept there under the hash of its source, and a source seen before is not assembled again: its
+ *  object is copied from the cache. The cache only ever speeds up a build; if it cannot be read or
+ *  written, the module is simply assembled.
+ */
+void assemble_object(const char* inputFile, const char* objectFile, const char* cacheDirectory)
+{
+	// Read the whole source
+	FILE* PtrInstruction_In = fopen(inputFile, "rb");
+	if (PtrInstruction_In == NULL)
+	{
+		perror("Error opening instruction file");
+		exit(EXIT_FAILURE);
 	}
+	size_t source_length;
+	char* source_text = read_source(PtrInstruction_In, &source_length);
+	fclose(PtrInstruction_In);
 
-	// After processing all lines, output the data memory contents to dataFile
-	for (int i = 0; i <= max_memory_address; i++)
+	// An unchanged source comes from the cache
+	char cache_file[LINE_PATH_LEN];
+	if (cacheDirectory) {
+		snprintf(cache_file, sizeof(cache_file), "%s/%016llX-%llu.obj", cacheDirectory,
+			(unsigned long long)hash_source(source_text, source_length), (unsigned long long)source_length);
+		if (copy_file(cache_file, objectFile))
+			return;
+	}
+
+	object_mode = true;
+	int max_memory_address = assemble_source(source_text, source_length);
+
+	FILE* PtrObject_Out = fopen(objectFile, "w");
+	if (PtrObject_Out == NULL)
 	{
-		fprintf(PtrDataOut, "%08X\n", data_list[i]);
+		perror("Error opening object file");
+		exit(EXIT_FAILURE);
 	}
+	write_object(PtrObject_Out, max_memory_address);
+	fclose(PtrObject_Out);
 
-	// Close all opened files
-	fclose(PtrInstruction_In);
-	fclose(PtrInstruction_Out);
-	fclose(PtrDataOut);
+	// Add it to the cache through a temporary file, so that concurrent builds never read half an object
+	if (cacheDirectory) {
+		char temporary_file[LINE_PATH_LEN + 32];
+		snprintf(temporary_file, sizeof(temporary_file), "%s.%d.tmp", cache_file, (int)process_id());
+		make_directory(cacheDirectory);
+		if (!copy_file(objectFile, temporary_file) || rename(temporary_file, cache_file) != 0)
+			remove(temporary_file);
+	}
+}
+
+#ifdef SIMPASM_LIBRARY
+/*
+ * reset_assembler:
+ * -----------------
+ *  Frees every table of the last assembly, so that the next one starts empty.
+ */
+void reset_assembler(void)
+{
+	for (int i = 0; i < label_list_size; i++)
+		free(label_list[i].label);
+	free(label_list);
+	free(label_table);
+	free(data_list);
+	free(token_list);
+	free(statement_list);
+	free(instruction_list);
+	free(reference_list);
+	free(global_list);
+	free(library_source);
+	label_list = NULL;
+	label_table = NULL;
+	data_list = NULL;
+	token_list = NULL;
+	statement_list = NULL;
+	instruction_list = NULL;
+	reference_list = NULL;
+	global_list = NULL;
+	library_source = NULL;
+	label_list_size = label_list_capacity = label_table_size = data_list_size = 0;
+	token_list_size = token_list_capacity = statement_list_size = statement_list_capacity = 0;
+	instruction_list_size = instruction_list_capacity = reference_list_size = reference_list_capacity = 0;
+	global_list_size = global_list_capacity = 0;
 }
 
+/*
+ * simpasm_assemble / simpasm_free (simpasm.h):
+ * ---------------------------------------------
+ *  Assemble a source held in memory into word images, as assemble does into files. Errors
+ *  reported by assembler_error come back here through assembler_error_jump.
+ */
+int simpasm_assemble(const char* source, size_t length, simpasm_program* program)
+{
+	memset(program, 0, sizeof(*program));
+	assembler_error_message = program->error;
+	if (setjmp(assembler_error_jump)) {
+		reset_assembler();
+		return -1;
+	}
+
+	// The lexer terminates tokens in place, so it works on a copy
+	library_source = grow_array(NULL, length + 1, 1);
+	memcpy(library_source, source, length);
+	int max_memory_address = assemble_source(library_source, length);
+
+	// The images now belong to the program
+	program->instructions = instruction_list;
+	program->instruction_count = (size_t)instruction_list_size;
+	program->data = data_list;
+	program->data_count = data_list_size ? (size_t)max_memory_address + 1 : 0;
+	instruction_list = NULL;
+	data_list = NULL;
+	reset_assembler();
+	return 0;
+}
+
+void simpasm_free(simpasm_program* program)
+{
+	free(program->instructions);
+	free(program->data);
+	program->instructions = NULL;
+	program->data = NULL;
+	program->instruction_count = program->data_count = 0;
+}
+#endif
+
+#ifndef SIMPASM_LIBRARY
 /*
  * main:
  * ------
- *  Expects three arguments:
+ *  Expects three or four arguments:
  *    - input file: assembly source code
  *    - instruction memory file: output file for encoded instructions
  *    - data memory file: output file for initialized data
+ *    - symbol file (optional): output file for the label map
  *
  *  The main function simply calls 'assemble' with these parameters.
+ *
+ *  With -c, it instead assembles one module of a larger program into an object file, which the
+ *  linker (simpld) combines with other modules into the memory files:
+ *    asm -c [--cache=DIR] <input file> <object file>
+ *  --cache=DIR reuses the object of an unchanged source from DIR (see assemble_object).
  */
 int main(int argc, char* argv[])
 {
-	if (argc != 4) {
-		fprintf(stderr, "Usage: %s <input file> <instruction memory file> <data memory file>\n", argv[0]);
+	if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+		const char* cacheDirectory = NULL;
+		int first = 2;
+		if (argc > 2 && strncmp(argv[2], "--cache=", 8) == 0) {
+			cacheDirectory = argv[2] + 8;
+			first = 3;
+		}
+		if (argc - first != 2) {
+			fprintf(stderr, "Usage: %s -c [--cache=DIR] <input file> <object file>\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		assemble_object(argv[first], argv[first + 1], cacheDirectory);
+		return EXIT_SUCCESS;
+	}
+
+	if (argc != 4 && argc != 5) {
+		fprintf(stderr, "Usage: %s <input file> <instruction memory file> <data memory file> [symbol file]\n"
+			"       %s -c [--cache=DIR] <input file> <object file>\n", argv[0], argv[0]);
 		return EXIT_FAILURE;
 	}
 	assemble(argv[1], argv[2], argv[3]);
+	if (argc == 5)
+		write_symbol_map(argv[4]);
 	return EXIT_SUCCESS;
 }
+#endif
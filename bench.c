@@ -0,0 +1,528 @@
+// Benchmark driver for the SIMP toolchain (POSIX hosts: uses fork/exec and wait4).
+#define _GNU_SOURCE
+
+#include <stdio.h>          // For file I/O (fopen, fgets, fprintf)
+#include <stdlib.h>         // For exit, strtoull, strtod
+#include <string.h>         // For strcmp, strncmp, strstr
+#include <stdint.h>         // For fixed-width integer types
+#include <time.h>           // For clock_gettime
+#include <unistd.h>         // For fork, execv, _exit
+#include <sys/stat.h>       // For mkdir
+#include <sys/wait.h>       // For wait4
+#include <sys/resource.h>   // For struct rusage (peak RSS of a run)
+
+/*
+ * bench:
+ * -------
+ * Assembles the four example programs with asm, runs each of them on every
+ * engine of sim, once with the text trace and once with --trace-format=none, and
+ * reports host time, simulated instructions and cycles per second and peak RSS.
+ * Every program also runs as a scaled-up variant: the program repeated (see
+ * write_scaled_source) until it takes about --scale-cycles cycles, so that
+ * process start-up does not dominate the short ones. Results go to a
+ * tab-separated file that a later run can use as its --baseline:
+ *
+ *     gcc -O2 -o asm asm.c && gcc -O2 -o sim sim.c -lpthread && gcc -O2 -o bench bench.c
+ *     ./bench ./asm ./sim --output=before.txt
+ *     (change the simulator, rebuild sim)
+ *     ./bench ./asm ./sim --baseline=before.txt
+ *
+ * With --baseline, every measurement whose instructions per second dropped by
+ * more than --threshold percent is reported and bench exits with a failure.
+ * Every timed run is also checked against the switch engine: a run whose
+ * cycles.txt, regout.txt, dmemout.txt or diskout.txt differs from the reference
+ * run is reported and bench exits with a failure, so a fast but wrong engine
+ * does not pass.
+ */
+
+#define BENCH_MAX_RESULTS 128           // Programs * variants * engines * trace modes
+#define BENCH_PATH_LEN 512
+#define BENCH_DEFAULT_REPEAT 3          // Runs per measurement (the fastest counts)
+#define BENCH_DEFAULT_SCALE_CYCLES 2000000 // Target length of the scaled-up variants
+#define BENCH_DEFAULT_THRESHOLD 10.0    // Allowed slowdown against the baseline, in percent
+#define BENCH_COUNTER_ADDRESS 0x7FF     // Data word holding the remaining repetitions (unused by the
+                                        // programs; the largest address a 12-bit immediate reaches)
+
+// One measurement (a line of the results file)
+typedef struct {
+    char program[32];
+    char variant[24];           // "x1" or "x<repetitions>"
+    char engine[16];
+    char trace[8];              // "on" (text trace) or "off" (--trace-format=none)
+    double seconds;             // Fastest host wall-clock time of the runs
+    uint64_t cycles;            // Simulated cycles (cycles.txt)
+    uint64_t instructions;      // Simulated instructions (--metrics)
+    long peak_rss_kb;           // Largest peak resident set size of the runs
+} bench_result;
+
+const char *programs[] = { "mulmat", "binom", "circle", "disktest" };
+const char *all_engines[] = { "switch", "threaded", "block", "jit" };
+const char *checked_outputs[] = { "cycles.txt", "regout.txt", "dmemout.txt", "diskout.txt" };
+
+// Globals for the options
+const char *asm_path = NULL;
+const char *sim_path = NULL;
+const char *program_directory = ".";            // --programs: where the .asm files are
+const char *work_directory = "bench_work";      // --work: scratch directory
+const char *output_file_name = "bench_results.txt"; // --output
+const char *baseline_file_name = NULL;          // --baseline
+const char *engines[4];                         // --engines
+int engine_count = 0;
+int repeat_count = BENCH_DEFAULT_REPEAT;        // --repeat
+uint64_t scale_cycles = BENCH_DEFAULT_SCALE_CYCLES; // --scale-cycles
+double threshold_percent = BENCH_DEFAULT_THRESHOLD; // --threshold
+
+bench_result results[BENCH_MAX_RESULTS];
+int result_count = 0;
+int mismatch_count = 0;                         // Output files of timed runs that differ from the switch engine
+
+/*
+ * fail:
+ * ------
+ * Prints an error and exits.
+ */
+void fail(const char *message, const char *detail) {
+    fprintf(stderr, "Error: %s%s%s\n", message, detail ? " " : "", detail ? detail : "");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * run_command:
+ * -------------
+ * Runs 'arguments' (NULL-terminated, arguments[0] is the program) with its
+ * standard output discarded. Stores the wall-clock time in '*seconds' and the
+ * peak RSS in '*peak_rss_kb' (either may be NULL). Returns 1 if it exited with 0.
+ */
+int run_command(char *const arguments[], double *seconds, long *peak_rss_kb) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t child = fork();
+    if (child < 0)
+        fail("Cannot start", arguments[0]);
+    if (child == 0) {
+        if (!freopen("/dev/null", "w", stdout))
+            _exit(127);
+        execv(arguments[0], arguments);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(child, &status, 0, &usage) < 0)
+        fail("Cannot wait for", arguments[0]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (seconds)
+        *seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    if (peak_rss_kb)
+        *peak_rss_kb = usage.ru_maxrss;  // Kilobytes on Linux
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * is_halt_line:
+ * --------------
+ * Returns 1 if an assembly line is a HALT instruction (not a label named halt).
+ */
+int is_halt_line(const char *line) {
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return strncmp(line, "halt", 4) == 0 && (line[4] == ' ' || line[4] == '\t');
+}
+
+/*
+ * write_scaled_source:
+ * ---------------------
+ * Writes 'source' repeated 'repetitions' times: every HALT becomes a jump to an
+ * epilogue that counts down a word at BENCH_COUNTER_ADDRESS and, until it reaches
+ * zero, clears the registers and restarts the program at address 0. Memory and
+ * I/O registers keep what the previous pass left, so later passes may take
+ * different paths; the cycle count of each variant is measured, not assumed.
+ */
+void write_scaled_source(const char *source, const char *destination, uint64_t repetitions) {
+    FILE *in = fopen(source, "r");
+    FILE *out = fopen(destination, "w");
+    if (!in || !out)
+        fail("Cannot write scaled copy of", source);
+
+    char line[BENCH_PATH_LEN];
+    while (fgets(line, sizeof(line), in)) {
+        if (is_halt_line(line))
+            fprintf(out, "\tbeq $zero, $zero, $zero, $imm2, 0, BenchRepeat\n");
+        else
+            fputs(line, out);
+    }
+    if (line[0] && line[strlen(line) - 1] != '\n')
+        fputc('\n', out);
+
+    fprintf(out, "BenchRepeat:\n");
+    fprintf(out, "\tlw $t0, $zero, $imm2, $zero, 0, %d\n", BENCH_COUNTER_ADDRESS);
+    fprintf(out, "\tsub $t0, $t0, $imm1, $zero, 1, 0\n");
+    fprintf(out, "\tsw $t0, $zero, $imm2, $zero, 0, %d\n", BENCH_COUNTER_ADDRESS);
+    fprintf(out, "\tbgt $zero, $t0, $zero, $imm2, 0, BenchRestart\n");
+    fprintf(out, "\thalt $zero, $zero, $zero, $zero, 0, 0\n");
+    fprintf(out, "BenchRestart:\n");
+    const char *registers[] = { "$v0", "$a0", "$a1", "$a2", "$t0", "$t1", "$t2", "$s0", "$s1", "$s2", "$gp", "$sp", "$ra" };
+    for (int i = 0; i < 13; i++)
+        fprintf(out, "\tadd %s, $zero, $zero, $zero, 0, 0\n", registers[i]);
+    fprintf(out, "\tbeq $zero, $zero, $zero, $imm1, 0, 0\n");
+    fprintf(out, "\t.word %d %llu\n", BENCH_COUNTER_ADDRESS, (unsigned long long)repetitions);
+
+    fclose(in);
+    fclose(out);
+}
+
+/*
+ * run_sim:
+ * ---------
+ * Runs sim on the program assembled in 'directory' with the given extra options
+ * (NULL-terminated list). Returns 1 on success.
+ */
+int run_sim(const char *directory, const char *const options[], double *seconds, long *peak_rss_kb) {
+    static const char *files[] = { "imemin.txt", "dmemin.txt", "diskin.txt", "irq2in.txt", "dmemout.txt",
+                                   "regout.txt", "trace.txt", "hwregtrace.txt", "cycles.txt", "leds.txt",
+                                   "display7seg.txt", "diskout.txt", "monitor.txt", "monitor.yuv" };
+    char paths[14][BENCH_PATH_LEN];
+    char *arguments[24];
+    int count = 0;
+
+    arguments[count++] = (char *)sim_path;
+    for (int i = 0; i < 14; i++) {
+        snprintf(paths[i], BENCH_PATH_LEN, "%s/%s", directory, files[i]);
+        arguments[count++] = paths[i];
+    }
+    for (int i = 0; options[i]; i++)
+        arguments[count++] = (char *)options[i];
+    arguments[count] = NULL;
+
+    int succeeded = run_command(arguments, seconds, peak_rss_kb);
+
+    // Traces of the longer runs are large; only the cycle count is kept
+    char trace[BENCH_PATH_LEN];
+    snprintf(trace, sizeof(trace), "%s/trace.txt", directory);
+    remove(trace);
+    return succeeded;
+}
+
+/*
+ * read_number_after:
+ * -------------------
+ * Returns the number following 'key' in a file (0 if missing).
+ */
+uint64_t read_number_after(const char *filename, const char *key) {
+    char text[4096] = "";
+    FILE *file = fopen(filename, "r");
+    if (!file)
+        return 0;
+    size_t length = fread(text, 1, sizeof(text) - 1, file);
+    text[length] = '\0';
+    fclose(file);
+
+    char *found = key[0] ? strstr(text, key) : text;
+    return found ? strtoull(found + strlen(key), NULL, 10) : 0;
+}
+
+/*
+ * copy_output / same_output:
+ * ---------------------------
+ * Copy an output file of 'directory' to <file>.reference, and compare it with that
+ * copy (1 = same contents; a missing file never matches).
+ */
+void copy_output(const char *directory, const char *file) {
+    char from[BENCH_PATH_LEN], to[BENCH_PATH_LEN], buffer[65536];
+    snprintf(from, sizeof(from), "%s/%s", directory, file);
+    snprintf(to, sizeof(to), "%s/%s.reference", directory, file);
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    if (!in || !out)
+        fail("Cannot keep the reference copy of", from);
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        fwrite(buffer, 1, length, out);
+    fclose(in);
+    if (fclose(out) != 0)
+        fail("Cannot keep the reference copy of", from);
+}
+
+int same_output(const char *directory, const char *file) {
+    char path[BENCH_PATH_LEN], reference_path[BENCH_PATH_LEN], buffer[65536], reference_buffer[65536];
+    snprintf(path, sizeof(path), "%s/%s", directory, file);
+    snprintf(reference_path, sizeof(reference_path), "%s/%s.reference", directory, file);
+    FILE *current = fopen(path, "rb");
+    FILE *reference = fopen(reference_path, "rb");
+    int same = current && reference;
+    while (same) {
+        size_t length = fread(buffer, 1, sizeof(buffer), current);
+        size_t reference_length = fread(reference_buffer, 1, sizeof(reference_buffer), reference);
+        same = length == reference_length && memcmp(buffer, reference_buffer, length) == 0;
+        if (length == 0)
+            break;
+    }
+    if (current)
+        fclose(current);
+    if (reference)
+        fclose(reference);
+    return same;
+}
+
+/*
+ * prepare_variant:
+ * -----------------
+ * Assembles 'source' into work/<program>-<variant> together with empty disk and
+ * IRQ2 inputs, and counts its cycles and instructions with one untimed --metrics run
+ * on the switch engine. That run's checked_outputs are kept as the reference.
+ */
+void prepare_variant(const char *source, const char *directory, uint64_t *cycles, uint64_t *instructions) {
+    char imemin[BENCH_PATH_LEN], dmemin[BENCH_PATH_LEN], path[BENCH_PATH_LEN], metrics_option[BENCH_PATH_LEN];
+    mkdir(directory, 0777);
+    snprintf(imemin, sizeof(imemin), "%s/imemin.txt", directory);
+    snprintf(dmemin, sizeof(dmemin), "%s/dmemin.txt", directory);
+    char *assemble[] = { (char *)asm_path, (char *)source, imemin, dmemin, NULL };
+    if (!run_command(assemble, NULL, NULL))
+        fail("Cannot assemble", source);
+
+    const char *empty_inputs[] = { "diskin.txt", "irq2in.txt" };
+    for (int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/%s", directory, empty_inputs[i]);
+        FILE *file = fopen(path, "w");
+        if (!file)
+            fail("Cannot create", path);
+        fclose(file);
+    }
+
+    snprintf(metrics_option, sizeof(metrics_option), "--metrics=%s/metrics.json", directory);
+    const char *options[] = { "--engine=switch", "--trace-format=none", metrics_option, NULL };
+    if (!run_sim(directory, options, NULL, NULL))
+        fail("Simulation failed for", source);
+    for (size_t i = 0; i < sizeof(checked_outputs) / sizeof(checked_outputs[0]); i++)
+        copy_output(directory, checked_outputs[i]);
+
+    snprintf(path, sizeof(path), "%s/metrics.json", directory);
+    *cycles = read_number_after(path, "\"cycles\":");
+    *instructions = read_number_after(path, "\"instructions\":");
+}
+
+/*
+ * measure:
+ * ---------
+ * Times the variant in 'directory' on every engine, with and without the trace,
+ * and adds the results. Every run's outputs are checked against the reference.
+ */
+void measure(const char *program, const char *variant, const char *directory, uint64_t cycles, uint64_t instructions) {
+    for (int e = 0; e < engine_count; e++) {
+        for (int traced = 1; traced >= 0; traced--) {
+            if (result_count == BENCH_MAX_RESULTS)
+                fail("Too many measurements", NULL);
+            bench_result *result = &results[result_count++];
+            snprintf(result->program, sizeof(result->program), "%s", program);
+            snprintf(result->variant, sizeof(result->variant), "%s", variant);
+            snprintf(result->engine, sizeof(result->engine), "%s", engines[e]);
+            snprintf(result->trace, sizeof(result->trace), "%s", traced ? "on" : "off");
+            result->cycles = cycles;
+            result->instructions = instructions;
+            result->seconds = 0;
+            result->peak_rss_kb = 0;
+
+            char engine_option[32];
+            snprintf(engine_option, sizeof(engine_option), "--engine=%s", engines[e]);
+            const char *options[] = { engine_option, traced ? "--trace-format=text" : "--trace-format=none", NULL };
+            for (int run = 0; run < repeat_count; run++) {
+                double seconds;
+                long peak_rss_kb;
+                if (!run_sim(directory, options, &seconds, &peak_rss_kb))
+                    fail("Simulation failed in", directory);
+                for (size_t i = 0; i < sizeof(checked_outputs) / sizeof(checked_outputs[0]); i++) {
+                    if (!same_output(directory, checked_outputs[i])) {
+                        printf("%-9s %-7s %-9s %-4s MISMATCH: %s differs from the switch engine\n", program,
+                               variant, engines[e], result->trace, checked_outputs[i]);
+                        mismatch_count++;
+                    }
+                }
+                if (run == 0 || seconds < result->seconds)
+                    result->seconds = seconds;
+                if (peak_rss_kb > result->peak_rss_kb)
+                    result->peak_rss_kb = peak_rss_kb;
+            }
+
+            printf("%-9s %-7s %-9s %-4s %10.4f s %9.2f MIPS %9.2f Mcycles/s %8ld KB\n", program, variant,
+                   engines[e], result->trace, result->seconds, instructions / result->seconds / 1e6,
+                   cycles / result->seconds / 1e6, result->peak_rss_kb);
+            fflush(stdout);
+        }
+    }
+}
+
+/*
+ * write_results:
+ * ---------------
+ * Writes the results file: a comment header, then one tab-separated line per measurement.
+ */
+void write_results(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        fail("Cannot write", filename);
+    fprintf(file, "# program\tvariant\tengine\ttrace\tseconds\tcycles\tinstructions\tmips\tmcycles_per_second\tpeak_rss_kb\n");
+    for (int i = 0; i < result_count; i++) {
+        const bench_result *result = &results[i];
+        fprintf(file, "%s\t%s\t%s\t%s\t%.6f\t%llu\t%llu\t%.3f\t%.3f\t%ld\n", result->program, result->variant,
+                result->engine, result->trace, result->seconds, (unsigned long long)result->cycles,
+                (unsigned long long)result->instructions, result->instructions / result->seconds / 1e6,
+                result->cycles / result->seconds / 1e6, result->peak_rss_kb);
+    }
+    fclose(file);
+}
+
+/*
+ * compare_with_baseline:
+ * -----------------------
+ * Matches every measurement with the baseline line of the same program, variant,
+ * engine and trace mode and compares instructions per second. Returns the number
+ * of measurements more than --threshold percent slower than the baseline.
+ */
+int compare_with_baseline(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file)
+        fail("Cannot read baseline", filename);
+
+    int regressions = 0, compared = 0;
+    char line[BENCH_PATH_LEN];
+    printf("\nAgainst baseline %s (threshold %.1f%%):\n", filename, threshold_percent);
+    while (fgets(line, sizeof(line), file)) {
+        bench_result base;
+        double mips;
+        if (line[0] == '#' || sscanf(line, "%31s %23s %15s %7s %lf %*u %*u %lf", base.program, base.variant,
+                                     base.engine, base.trace, &base.seconds, &mips) != 6)
+            continue;
+
+        for (int i = 0; i < result_count; i++) {
+            const bench_result *result = &results[i];
+            if (strcmp(result->program, base.program) || strcmp(result->variant, base.variant)
+                || strcmp(result->engine, base.engine) || strcmp(result->trace, base.trace))
+                continue;
+
+            double current = result->instructions / result->seconds / 1e6;
+            double change = mips > 0 ? 100.0 * (current - mips) / mips : 0.0;
+            int regressed = change < -threshold_percent;
+            regressions += regressed;
+            compared++;
+            printf("%-9s %-7s %-9s %-4s %9.2f -> %9.2f MIPS %+7.1f%%%s\n", result->program, result->variant,
+                   result->engine, result->trace, mips, current, change, regressed ? "  REGRESSION" : "");
+        }
+    }
+    fclose(file);
+    printf("%d compared, %d slower than the threshold\n", compared, regressions);
+    return regressions;
+}
+
+/*
+ * parse_engines:
+ * ---------------
+ * Reads the --engines list (comma-separated engine names).
+ */
+void parse_engines(const char *list) {
+    engine_count = 0;
+    while (*list) {
+        size_t length = strcspn(list, ",");
+        int found = 0;
+        for (int i = 0; i < 4; i++) {
+            if (strlen(all_engines[i]) == length && strncmp(list, all_engines[i], length) == 0 && engine_count < 4) {
+                engines[engine_count++] = all_engines[i];
+                found = 1;
+            }
+        }
+        if (!found)
+            fail("Unknown engine in", list);
+        list += length + (list[length] == ',');
+    }
+}
+
+/*
+ * main:
+ * ------
+ *  bench [options] <asm> <sim>
+ *   --engines=LIST       Engines to measure (default: switch,threaded,block,jit)
+ *   --repeat=N           Runs per measurement, the fastest counts (default 3)
+ *   --scale-cycles=N     Approximate length of the scaled-up variants (default 2000000)
+ *   --programs=DIR       Directory holding mulmat.asm, binom.asm, ... (default .)
+ *   --work=DIR           Scratch directory (default bench_work)
+ *   --output=FILE        Results file (default bench_results.txt)
+ *   --baseline=FILE      Earlier results file to compare against
+ *   --threshold=PERCENT  Slowdown against the baseline that counts as a regression (default 10)
+ */
+int main(int argc, char *argv[]) {
+    int positional = 0;
+    const char *paths[2];
+
+    parse_engines("switch,threaded,block,jit");
+    for (int i = 1; i < argc; i++) {
+        const char *argument = argv[i];
+        if (strncmp(argument, "--engines=", 10) == 0)
+            parse_engines(argument + 10);
+        else if (strncmp(argument, "--repeat=", 9) == 0 && atoi(argument + 9) > 0)
+            repeat_count = atoi(argument + 9);
+        else if (strncmp(argument, "--scale-cycles=", 15) == 0)
+            scale_cycles = strtoull(argument + 15, NULL, 0);
+        else if (strncmp(argument, "--programs=", 11) == 0)
+            program_directory = argument + 11;
+        else if (strncmp(argument, "--work=", 7) == 0)
+            work_directory = argument + 7;
+        else if (strncmp(argument, "--output=", 9) == 0)
+            output_file_name = argument + 9;
+        else if (strncmp(argument, "--baseline=", 11) == 0)
+            baseline_file_name = argument + 11;
+        else if (strncmp(argument, "--threshold=", 12) == 0)
+            threshold_percent = strtod(argument + 12, NULL);
+        else if (strncmp(argument, "--", 2) != 0 && positional < 2)
+            paths[positional++] = argument;
+        else
+            positional = 3; // Unknown option: print usage
+    }
+    if (positional != 2) {
+        fprintf(stderr, "Usage: %s [options] <asm> <sim>\n"
+                        "  --engines=LIST        Engines to measure (default: switch,threaded,block,jit)\n"
+                        "  --repeat=N            Runs per measurement, the fastest counts (default %d)\n"
+                        "  --scale-cycles=N      Approximate length of the scaled-up variants (default %d)\n"
+                        "  --programs=DIR        Directory holding the example .asm files (default .)\n"
+                        "  --work=DIR            Scratch directory (default bench_work)\n"
+                        "  --output=FILE         Results file (default bench_results.txt)\n"
+                        "  --baseline=FILE       Earlier results file to compare against\n"
+                        "  --threshold=PERCENT   Slowdown that counts as a regression (default %.0f)\n",
+                argv[0], BENCH_DEFAULT_REPEAT, BENCH_DEFAULT_SCALE_CYCLES, BENCH_DEFAULT_THRESHOLD);
+        return EXIT_FAILURE;
+    }
+    asm_path = paths[0];
+    sim_path = paths[1];
+
+    mkdir(work_directory, 0777);
+    for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++) {
+        char source[BENCH_PATH_LEN], directory[BENCH_PATH_LEN], scaled_source[BENCH_PATH_LEN], variant[24];
+        uint64_t cycles, instructions;
+
+        // The program as it is
+        snprintf(source, sizeof(source), "%s/%s.asm", program_directory, programs[p]);
+        snprintf(directory, sizeof(directory), "%s/%s-x1", work_directory, programs[p]);
+        prepare_variant(source, directory, &cycles, &instructions);
+        measure(programs[p], "x1", directory, cycles, instructions);
+
+        // Repeated up to about --scale-cycles cycles
+        uint64_t repetitions = cycles ? scale_cycles / cycles : 0;
+        if (repetitions < 2)
+            continue;
+        snprintf(variant, sizeof(variant), "x%llu", (unsigned long long)repetitions);
+        snprintf(directory, sizeof(directory), "%s/%s-%s", work_directory, programs[p], variant);
+        snprintf(scaled_source, sizeof(scaled_source), "%s/%s-%s.asm", work_directory, programs[p], variant);
+        write_scaled_source(source, scaled_source, repetitions);
+        prepare_variant(scaled_source, directory, &cycles, &instructions);
+        measure(programs[p], variant, directory, cycles, instructions);
+    }
+
+    write_results(output_file_name);
+    printf("Results written to %s\n", output_file_name);
+    int failed = baseline_file_name && compare_with_baseline(baseline_file_name) > 0;
+    if (mismatch_count) {
+        fprintf(stderr, "Error: %d outputs differ from the switch engine\n", mismatch_count);
+        failed = 1;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
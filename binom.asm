@@ -14,7 +14,7 @@ Init:
     beq $zero, $t1, $zero, $imm2, 0, Stop #stop if first condition was satisfied
     beq $zero, $t2, $zero, $imm2, 0, Stop #stop if second condition was satisfied
 Main:
-    add $s2, $zero, $zero, $zero, $zero, 0, 0 #set result to 0
+    add $s2, $zero, $zero, $zero, 0, 0 #set result to 0
     sub $a0, $a0, $imm1, $zero, 1, 0 # n = n-1
     sub $a1, $a1, $imm1, $zero, 1, 0 # k = k-1
     jal $ra, $zero, $zero, $imm2, 0, Init #Binom(n-1,k-1)
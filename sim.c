@@ -6,11 +6,74 @@
 #include <stdint.h>     // For fixed-width integer types
 #include <stdbool.h>    // For boolean type in C
 #include <string.h>     // For string operations (strcmp, strcpy, etc.)
+#include "simp.h"       // Embedding interface (see the simp_* functions)
+
+// Output sinks are drained by a background writer thread on POSIX hosts
+#if !defined(_WIN32)
+#define SIM_ASYNC_OUTPUT 1
+#include <fcntl.h>      // For open
+#include <unistd.h>     // For close, usleep
+#include <sys/uio.h>    // For writev
+#include <pthread.h>    // For the output writer thread
+#include <stdatomic.h>  // For the ring buffer head/tail counters
+#else
+#define SIM_ASYNC_OUTPUT 0
+#endif
+
+// The IRQ2 schedule is read ahead by a background reader thread on POSIX hosts
+#if !defined(_WIN32)
+#define SIM_ASYNC_INPUT 1
+#include <errno.h>      // For errno (EINTR)
+#else
+#define SIM_ASYNC_INPUT 0
+#endif
+
+// Input images are mmap'd on POSIX hosts (read into a buffer elsewhere)
+#if !defined(_WIN32)
+#define SIM_MMAP_INPUT 1
+#include <fcntl.h>      // For open
+#include <unistd.h>     // For close
+#include <sys/mman.h>   // For mmap (input files)
+#include <sys/stat.h>   // For fstat
+#else
+#define SIM_MMAP_INPUT 0
+#endif
+
+// The JIT engine emits x86-64 machine code into an mmap'd buffer
+#if defined(__x86_64__) && !defined(_WIN32)
+#define SIM_JIT_SUPPORTED 1
+#include <sys/mman.h>   // For mmap (executable code buffer)
+#else
+#define SIM_JIT_SUPPORTED 0
+#endif
+
+// Batch jobs run on a pool of worker threads on POSIX hosts (one after another elsewhere)
+#if !defined(_WIN32)
+#define SIM_BATCH_THREADS 1
+#include <pthread.h>    // For the batch worker threads
+#include <unistd.h>     // For sysconf
+#else
+#define SIM_BATCH_THREADS 0
+#endif
+
+// Storage class of the per-thread 'machine' pointer
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
 
 // Constants
-#define MEM_SIZE 4096              // Instruction and data memory size
-#define DISK_SIZE (128 * 128)      // Disk size in words (128 sectors * 128 words/sector)
-#define MONITOR_SIZE (256 * 256)   // Monitor resolution (256x256)
+#define MEM_SIZE 4096              // Instruction memory size (and default data memory size)
+#define DISK_SECTORS 128           // Default number of disk sectors
+#define SECTOR_SIZE 128            // Default words per disk sector
+#define DISK_SIZE (DISK_SECTORS * SECTOR_SIZE) // Default disk size in words
+#define DISK_WORD_CYCLES 8         // Cycles per word moved by a disk read/write
+#define MAX_DATA_MEMORY (1u << 28) // Largest --data-memory in words (1 GB)
+#define MAX_SECTOR_SIZE 65536      // Largest --sector-words
+#define MAX_DISK_SIZE (1u << 30)   // Largest disk in words (4 GB image)
+#define MONITOR_DIM 256            // Monitor width and height in pixels
+#define MONITOR_SIZE (MONITOR_DIM * MONITOR_DIM) // Monitor resolution (256x256)
 #define NUM_CPU_REGS 16            // Number of CPU registers
 #define NUM_IO_REGS 23             // Number of I/O registers
 #define PC_START 0                 // Initial value of the Program Counter
@@ -42,26 +105,399 @@
 // Opcodes
 #define RETI_OP 18   // Return-from-interrupt opcode
 #define HALT_OP 21   // Halt opcode
+#define INVALID_OP 0xFF // Marks words whose opcode field does not fit in 8 bits
+
+// Execution engines (selected at startup with --engine=)
+#define ENGINE_SWITCH 0     // Reference switch-based interpreter
+#define ENGINE_THREADED 1   // Computed-goto threaded interpreter
+#define ENGINE_BLOCK 2      // Basic-block engine with batched cycle accounting
+#define ENGINE_JIT 3        // Block engine that compiles hot blocks to x86-64
+
+// Peripheral event sources (see schedule_events)
+#define EVENT_IRQ2 0        // Next IRQ2 arrival from the irq2in file
+#define EVENT_TIMER 1       // Next timer tick that reaches TIMER_MAX
+#define EVENT_DISK 2        // Next disk start / completion
+#define EVENT_CHECKPOINT 3  // Cycle at which --checkpoint-at saves the machine state
+#define EVENT_STOP 4        // Cycle at which simp_run_cycles returns
+#define EVENT_METRICS 5     // Cycle at which --metrics-interval rewrites the metrics files
+#define NUM_EVENT_SOURCES 6
+#define NO_EVENT UINT64_MAX // Source has nothing scheduled
+
+// Idle-loop fast-forward (see track_idle_loop)
+#define IDLE_MAX_BODY 32    // Longest loop body (in instructions) considered for fast-forward
+#define IDLE_WATCHING 0     // No candidate loop
+#define IDLE_RECORDING 1    // Recording one iteration of the loop starting at idle_loop_head
+#define IDLE_READY 2        // Two identical iterations seen: fast-forward at the next cycle
+
+// Trace control (see trace_filtered_instruction)
+#define TRACE_MAX_RANGES 16         // Most --trace-pc / --trace-cycles options accepted
+#define TRACE_NO_TRIGGER -1         // No --trace-on-irq / --trace-on-write start trigger
+#define SYMBOL_NAME_LEN 64          // Longest label name read from a symbol map
+
+// Guest-program profiler (see profile_instruction)
+#define PROFILE_MAX_DEPTH 256           // Deepest call stack tracked (deeper calls are not recorded)
+#define PROFILE_NO_LABEL -1             // Node label: code before the first label (named by address)
+#define PROFILE_INTERRUPT -2            // Node label: the "[interrupt]" frame under an interrupt handler
+#define PROFILE_NO_RETURN UINT32_MAX    // Frame return address of the root and interrupt frames
+
+// Runtime metrics (see write_metrics_json)
+#define NUM_IRQ_LINES 3                 // IRQ0 (timer), IRQ1 (disk), IRQ2 (external)
+#define IRQ_SERVICED (UINT64_MAX - 1)   // irq_raised_cycle: status still set, its latency already counted
+
+// Binary trace format (--trace-format=binary, decoded back to text by tracedec)
+#define TRACE_FORMAT_TEXT 0
+#define TRACE_FORMAT_BINARY 1
+#define TRACE_FORMAT_NONE 2             // trace.txt is left empty (benchmarks)
+#define TRACE_BINARY_MAGIC "SIMPTRC1"   // First 8 bytes of a binary trace
+#define TRACE_BINARY_VERSION 1
+#define TRACE_KEYFRAME_INTERVAL 4096    // Records between two full-state keyframes
+#define TRACE_RECORD_KEYFRAME 0xFF      // Record tag: PC and all 16 registers follow
+#define TRACE_RECORD_NEXT_PC 0x80       // Delta tag flag: PC = previous PC + 1 (else a 32-bit PC follows)
+
+// Checkpoint file format (see write_checkpoint)
+#define CHECKPOINT_MAGIC "SIMPCKP1"     // First 8 bytes of a checkpoint
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_DEFAULT_FILE "checkpoint.bin"
+
+// IRQ2 feed parameters (see irq2_feed_next)
+#define IRQ2_FEED_CHUNK (64 * 1024)         // Bytes read from the IRQ2 source at a time
+#define IRQ2_FEED_EVENTS 16384              // Parsed events buffered ahead of the simulation (power of two)
+#define IRQ2_LINE_SIZE 255                  // Line buffer size: longer lines split as with fgets
+
+// Output sink parameters
+#define OUTPUT_RING_SIZE (4 * 1024 * 1024)  // Ring buffer per output file (power of two)
+#define OUTPUT_MAX_RECORD 256               // Longest single line written to a sink
+#define OUTPUT_WRITE_THRESHOLD (256 * 1024) // Pending bytes that wake the writer thread
+#define OUTPUT_WRITER_SLEEP_MS 10           // Writer thread poll interval when idle
+#define NUM_OUTPUT_SINKS 4                  // trace, hwregtrace, leds, display7seg
+
+// JIT parameters
+#define JIT_HOT_THRESHOLD 16            // Interpreted executions of a block before it gets compiled
+#define JIT_CODE_SIZE (4 * 1024 * 1024) // Size of the executable code buffer in bytes
+#define JIT_MAX_MAPPED_REGS 11          // Host registers available for SIMP registers $v0..$ra
+
+// Pre-decoded form of one 48-bit instruction word
+typedef struct {
+    uint8_t opcode;        // Opcode (top 8 bits)
+    uint8_t registers[4];  // Register fields in order: rd, rs, rt, rm
+    int32_t imm1;          // Sign-extended 12-bit imm1
+    int32_t imm2;          // Sign-extended 12-bit imm2
+} decoded_instruction;
+
+// One suppressed trace line kept in the --trace-history ring
+typedef struct {
+    uint32_t pc;                        // PC of the instruction
+    uint64_t instruction;               // Raw 48-bit instruction word
+    uint32_t registers[NUM_CPU_REGS];   // Registers as they would have been traced
+} trace_record;
+
+// IRQ2 feed: the irq2in schedule, read in large chunks and parsed ahead of the
+// simulation into a ring of event cycles (see irq2_feed_advance / irq2_feed_next)
+typedef struct {
+#if SIM_ASYNC_INPUT
+    int fd;                                 // Source: regular file, pipe, FIFO or stdin
+    pthread_t reader_thread;
+    int reader_running;                     // 0 = no thread, the simulation thread refills the ring
+    atomic_int stop;                        // Set by close_irq2_feed
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;                  // New events (for the simulation) or free slots (for the reader)
+    _Atomic size_t head;                    // Events parsed (reader)
+    _Atomic size_t tail;                    // Events consumed (simulation)
+    atomic_int finished;                    // Every event of the source is in the ring
+#else
+    FILE *file;                             // Plain stdio stream
+    size_t head;
+    size_t tail;
+    int finished;
+#endif
+    int cycles[IRQ2_FEED_EVENTS];           // Ring of parsed event cycles
+    uint64_t line_ends[IRQ2_FEED_EVENTS];   // Source offset just past the line of each event
+    uint64_t consumed_offset;               // Source offset just past the last consumed event (checkpoints)
+    uint64_t parsed_offset;                 // Source bytes parsed so far
+    char chunk[IRQ2_FEED_CHUNK];            // Last chunk read from the source
+    size_t chunk_length;
+    size_t chunk_position;                  // Bytes of chunk already parsed
+    int source_ended;                       // The source reached its end (or a read failed)
+    char line[IRQ2_LINE_SIZE];              // Line being assembled across chunks
+    int line_length;
+} irq2_feed;
+
+// Ring indexes of the IRQ2 feed are shared with the reader thread
+#if SIM_ASYNC_INPUT
+#define FEED_LOAD(value) atomic_load_explicit(&(value), memory_order_acquire)
+#define FEED_STORE(value, new_value) atomic_store_explicit(&(value), (new_value), memory_order_release)
+#else
+#define FEED_LOAD(value) (value)
+#define FEED_STORE(value, new_value) ((value) = (new_value))
+#endif
+
+// Output sink: a file written from the simulation loop through a ring buffer
+typedef struct {
+#if SIM_ASYNC_OUTPUT
+    int fd;                     // Destination file descriptor (-1 = not open)
+    char *ring;                 // OUTPUT_RING_SIZE bytes + OUTPUT_MAX_RECORD of slack for wrapping
+    _Atomic size_t head;        // Total bytes produced (simulation thread)
+    _Atomic size_t tail;        // Total bytes written to fd (writer thread)
+#else
+    FILE *file;                 // Plain stdio stream
+#endif
+} output_sink;
+
+// Instruction memory image with its pre-decoded form. Read-only once loaded, so
+// the batch jobs that run the same imemin file share one image (see load_instruction_image).
+typedef struct instruction_image {
+    uint64_t words[MEM_SIZE];                   // Instruction memory array
+    decoded_instruction decoded[MEM_SIZE];      // Pre-decoded copy of words
+    uint16_t block_length[MEM_SIZE];            // Straight-line (ALU/lw/sw) instructions starting at each address
+    const char *path;                           // File it was loaded from (batch image cache key)
+    struct instruction_image *next;             // Next image in the batch image cache
+} instruction_image;
+
+typedef uint32_t (*jit_function)(uint32_t *registers, uint32_t *memory, uint32_t *results);
+
+// Runtime counters of one machine, exported by --metrics / --metrics-prometheus
+typedef struct {
+    uint64_t opcode_counts[256];                // Instructions executed per opcode (counted only with --metrics*)
+    uint64_t branches_taken[6];                 // Taken BEQ..BGE (not taken = opcode count - taken)
+    uint64_t irq_raised_cycle[NUM_IRQ_LINES];   // Cycle each IRQ status was first seen set (NO_EVENT = clear)
+    uint64_t irq_latency_count[NUM_IRQ_LINES];  // Handler entries with a known raise cycle, per IRQ line
+    uint64_t irq_latency_total[NUM_IRQ_LINES];  // Sum and maximum of their latencies (status set to first
+    uint64_t irq_latency_max[NUM_IRQ_LINES];    // handler instruction, in cycles)
+    uint64_t disk_busy_cycles;                  // Cycles of completed disk operations
+    uint64_t disk_start_cycle;                  // Cycle the running disk operation started
+    uint64_t disk_sectors_read;                 // Disk commands started, by direction
+    uint64_t disk_sectors_written;
+    uint64_t monitor_pixel_writes;              // monitorcmd = 1 writes to an on-screen pixel
+    uint64_t led_updates;                       // OUTs to leds / display7seg
+    uint64_t display7seg_updates;
+} machine_metrics;
+
+// Node of the profiler's call tree: one call path, optionally ending in a label inside its function
+typedef struct {
+    int parent;                 // Caller node (-1 for the root)
+    int label;                  // Symbol index, PROFILE_NO_LABEL or PROFILE_INTERRUPT
+    uint32_t address;           // Entry address of the function (label PROFILE_NO_LABEL)
+    int first_child;            // Children as a linked list (-1 = none)
+    int next_sibling;
+    uint64_t cycles;            // Cycles spent with exactly this path on top
+} profile_node;
+
+// Frame of the profiler's shadow call stack
+typedef struct {
+    uint32_t return_address;    // PC at which the frame returns (PROFILE_NO_RETURN = only by RETI / never)
+    int node;                   // Call tree node of the frame
+    int interrupt;              // 1 = frame was pushed on entry to the interrupt handler
+} profile_frame;
+
+// Per-machine profile (--profile / --profile-folded)
+typedef struct {
+    uint64_t executions[MEM_SIZE];      // Instructions executed at each PC
+    uint64_t isr_executions[MEM_SIZE];  // ... of them inside the interrupt handler
+    uint64_t stall_cycles[MEM_SIZE];    // Cycles halted at this PC waiting for the disk
+    profile_node *nodes;                // Call tree (node 0 is the root)
+    int node_count;
+    int node_capacity;
+    profile_frame stack[PROFILE_MAX_DEPTH]; // Shadow call stack (stack[0] = root frame)
+    int depth;                          // Frames on the stack
+    int leaf_frame_node;                // Cache of the last profile_leaf_node lookup
+    int leaf_label;
+    int leaf_node;
+    int have_previous;                  // 0 until the first instruction was profiled
+    uint32_t previous_pc;               // Previous instruction profiled
+    uint8_t previous_opcode;
+    int previous_isr;                   // isr_active_flag at the previous instruction
+    uint32_t call_target;               // Target of the previous instruction if it was a JAL
+    int out_of_memory;                  // 1 = the call tree stopped growing
+} profile_state;
+
+/*
+ * machine_context:
+ * -----------------
+ * Everything one simulated machine changes while it runs: memories, registers,
+ * peripheral and event queue state, the input/output files and the JIT tables.
+ * The simulator works on the context 'machine' points to (one per thread), so
+ * several machines can run side by side in batch mode (see run_batch). Embedding
+ * programs see it as the opaque simp_machine of simp.h.
+ */
+typedef struct simp_machine {
+    // CPU and memory
+    uint32_t cpu_registers[NUM_CPU_REGS];       // Array for CPU registers
+    uint32_t io_registers[NUM_IO_REGS];         // Array for I/O registers
+    uint8_t monitor_buffer[MONITOR_SIZE];       // Buffer representing monitor pixels (8-bit luma)
+    uint32_t default_data_memory[MEM_SIZE];     // Data memory of the default size
+    uint32_t default_disk_memory[DISK_SIZE];    // Disk of the default geometry
 
-// Globals for CPU and Memory
-uint64_t instruction_memory[MEM_SIZE] = { 0 };  // Instruction memory array
-uint32_t data_memory[MEM_SIZE] = { 0 };         // Data memory array
-uint32_t disk_memory[DISK_SIZE] = { 0 };        // Disk memory array
-uint32_t cpu_registers[NUM_CPU_REGS] = { 0 };   // Array for CPU registers
-uint32_t io_registers[NUM_IO_REGS] = { 0 };     // Array for I/O registers
-
-// Globals for Monitor and Special Hardware
-uint32_t monitor_buffer[MONITOR_SIZE] = { 0 };  // Buffer representing monitor pixels
-uint32_t led_status = 0;                        // LED register content (32 bits)
-uint32_t seven_segment_display = 0;             // 7-segment display register content
-
-// Globals for Simulation State
-uint32_t program_counter = PC_START;            // Current PC (program counter)
-int halt_flag = 0;                              // Flag to indicate HALT instruction encountered
-int isr_active_flag = 0;                        // Flag to indicate CPU is currently in ISR
-int irq2_next_cycle = 0;                        // Stores next clock cycle for an IRQ2 event
-int disk_cycle_counter = 0;                     // Tracks the timing for disk operations
-int disk_index = 0;                             // Tracks how many words have been transferred in a disk op
+    // Data memory and disk (see create_storage). They point at the arrays above unless
+    // --data-memory, --disk-sectors / --sector-words or --disk-image change them.
+    uint32_t *data_memory;                      // Data memory array
+    uint32_t *disk_memory;                      // Disk memory array (a heap array or the mapped --disk-image)
+    uint32_t data_memory_size;                  // Words of data_memory
+    uint32_t disk_size;                         // Words of disk_memory
+    uint32_t disk_sector_count;                 // Sectors of the disk
+    uint32_t sector_size;                       // Words per sector
+    int disk_transfer_cycles;                   // Cycles of one read/write (sector_size * DISK_WORD_CYCLES)
+    uint8_t *disk_dirty;                        // --disk-image: 1 per sector written since it was mapped
+
+    // Instruction image (possibly shared with other machines)
+    instruction_image *image;
+    int owns_image;                             // 1 = image is private and freed with the machine
+    uint64_t *instruction_memory;               // image->words
+    decoded_instruction *decoded_memory;        // image->decoded
+    uint16_t *block_length;                     // image->block_length
+
+    // JIT engine
+    jit_function jit_blocks[MEM_SIZE];          // Compiled code for the block starting at each address
+    uint16_t jit_block_length[MEM_SIZE];        // Instructions covered by jit_blocks[address]
+    uint16_t jit_block_heat[MEM_SIZE];          // Interpreted executions so far (JIT_HOT_THRESHOLD = compile)
+    uint32_t jit_results[MEM_SIZE];             // Per-instruction results of the last compiled block (trace replay)
+    uint8_t jit_block_memory[MEM_SIZE];         // 1 if jit_blocks[address] contains lw/sw
+    uint8_t *jit_code_buffer;                   // Code buffer (read/execute, read/write while compiling)
+    int jit_unavailable;                        // 1 = the buffer could not be mapped or protected: no JIT
+    size_t jit_code_used;                       // Bytes of jit_code_buffer already used
+
+    // Monitor and special hardware
+    uint64_t monitor_nonzero[MONITOR_SIZE / 64]; // Bit per pixel: last monitordata written there was non-zero
+    int monitor_dirty_top;                      // Rows / columns of the rectangle holding every written pixel
+    int monitor_dirty_bottom;                   // (top > bottom = nothing written yet)
+    int monitor_dirty_left;
+    int monitor_dirty_right;
+    uint32_t led_status;                        // LED register content (32 bits)
+    uint32_t seven_segment_display;             // 7-segment display register content
+
+    // Simulation state
+    uint32_t program_counter;                   // Current PC (program counter)
+    int halt_flag;                              // Flag to indicate HALT instruction encountered
+    int isr_active_flag;                        // Flag to indicate CPU is currently in ISR
+    int irq2_next_cycle;                        // Stores next clock cycle for an IRQ2 event
+    int disk_cycle_counter;                     // Tracks the timing for disk operations
+    int disk_index;                             // Tracks how many words have been transferred in a disk op
+    int disk_transfer_counter;                  // disk_cycle_counter value word transfers were applied up to
+
+    // Peripheral event queue (see schedule_events)
+    uint64_t simulated_cycles;                  // Cycles executed so far; the event queue is keyed on it
+    uint64_t event_cycle[NUM_EVENT_SOURCES];    // Next cycle in which each source must be evaluated
+    uint64_t next_event_cycle;                  // Earliest entry of event_cycle (head of the queue)
+    uint64_t peripherals_synced_cycle;          // Lazy timer/disk state is valid at the start of this cycle
+    uint64_t forced_event_cycle;                // Last cycle made an event cycle only by IN/OUT
+    uint64_t last_natural_event_cycle;          // Last event cycle caused by a peripheral event
+
+    // Idle-loop detection
+    int idle_loop_state;                        // IDLE_WATCHING / IDLE_RECORDING / IDLE_READY
+    uint32_t idle_loop_head;                    // Loop head (target of the backward branch)
+    uint64_t idle_loop_start_cycle;             // Cycle at which the recorded iteration started
+    uint32_t idle_loop_length;                  // Instructions recorded in the current iteration
+    uint32_t idle_loop_fetch_pc;                // PC of the instruction executing in this cycle
+    uint32_t idle_loop_pcs[IDLE_MAX_BODY];      // PC of every instruction of the iteration
+    uint32_t idle_loop_trace_registers[IDLE_MAX_BODY][NUM_CPU_REGS]; // Registers as traced for each of them
+    uint32_t idle_loop_head_registers[NUM_CPU_REGS]; // Registers when the iteration started
+
+    // Run control
+    int engine;                                 // Execution engine used by run_simulation
+    int started;                                // 1 = start_simulation initialized the run (later runs resume it)
+    uint64_t stop_cycle;                        // Cycle at which the run returns (NO_EVENT = at HALT)
+    uint64_t checkpoint_cycle;                  // Cycle to save the state at (NO_EVENT = none / done)
+    int restored_from_checkpoint;               // 1 = start_simulation keeps the restored state
+
+    // Embedding (see simp.h)
+    int embedded;                               // 1 = created by simp_create: errors are returned, not fatal
+    char error[64];                             // Why the last run failed ("" = it did not)
+    simp_callbacks callbacks;                   // Output callbacks
+
+    // Trace control and binary trace state
+    int trace_started;                          // Start trigger fired (always 1 without one)
+    trace_record *trace_history;                // Ring of the last suppressed lines (--trace-history)
+    uint32_t trace_history_count;               // Lines currently held
+    uint32_t trace_history_next;                // Slot the next suppressed line goes to
+    uint32_t trace_binary_pc;                   // PC of the previous record
+    uint32_t trace_binary_registers[NUM_CPU_REGS]; // Registers of the previous record
+    uint32_t trace_binary_records;              // Records since the last keyframe (0 = keyframe due)
+
+    // Guest-program profiler (NULL unless --profile / --profile-folded)
+    profile_state *profile;
+
+    // Runtime metrics
+    machine_metrics metrics;                    // Counters (the per-instruction ones only if count_instructions)
+    int count_instructions;                     // 1 = log_instruction_trace counts opcodes and branches
+    uint64_t metrics_cycle;                     // Next --metrics-interval export (NO_EVENT = none)
+
+    // Input feed
+    irq2_feed *irq2_feed;                       // IRQ2 events (NULL for simp machines)
+
+    // Output sinks for the files written inside the simulation loop
+    output_sink trace_sink;                     // Instruction trace output file
+    output_sink hw_register_trace_sink;         // HW register trace output file
+    output_sink led_sink;                       // LED output file
+    output_sink seven_segment_sink;             // 7-segment output file
+    output_sink *output_sinks[NUM_OUTPUT_SINKS]; // The four sinks above
+
+    // Output files written at the end of the run
+    int writes_files;                           // 1 = open_output_files opened the files (not for simp machines)
+    FILE *cycle_count_file;                     // Cycle count output file
+    FILE *disk_output_file;                     // Disk output file
+    FILE *monitor_output_file;                  // Monitor text output file
+    FILE *monitor_yuv_file;                     // Monitor YUV output file (binary)
+    FILE *register_output_file;                 // Final register values output file
+
+#if SIM_ASYNC_OUTPUT
+    // Output writer thread
+    pthread_t output_writer_thread;
+    int output_writer_running;                  // 0 = no thread, sinks are drained synchronously
+    atomic_int output_writer_stop;              // Set by close_output_sinks
+    pthread_mutex_t output_writer_mutex;
+    pthread_cond_t output_writer_wakeup;
+#endif
+} machine_context;
+
+// Machine the simulator functions operate on (each batch worker has its own)
+THREAD_LOCAL machine_context *machine = NULL;
+
+// Globals for configuration (shared by every machine, set up before any runs)
+int simulation_engine = ENGINE_SWITCH;          // --engine: execution engine of new machines
+int background_output_writer = 1;               // 0 = sinks are drained by the simulating thread (batch mode)
+int background_input_reader = 1;                // 0 = the IRQ2 feed is refilled by the simulating thread (batch mode)
+
+// Globals for checkpoints (see write_checkpoint / restore_checkpoint)
+uint64_t checkpoint_at_cycle = NO_EVENT;        // --checkpoint-at: cycle to save the state at
+const char *checkpoint_file_name = CHECKPOINT_DEFAULT_FILE; // --checkpoint-file
+const char *restore_file_name = NULL;           // --restore: checkpoint to start from
+
+// Globals for the memory and disk geometry (see create_storage / map_disk_image)
+uint32_t configured_data_memory_size = MEM_SIZE; // --data-memory: words of data memory
+uint32_t configured_disk_sectors = DISK_SECTORS; // --disk-sectors
+uint32_t configured_sector_size = SECTOR_SIZE;  // --sector-words: words per sector
+const char *disk_image_file_name = NULL;        // --disk-image: binary image used as the disk
+int disk_text_export = 0;                       // --disk-export: also write diskout.txt with --disk-image
+
+// Globals for batch mode (see run_batch)
+const char *batch_file_name = NULL;             // --batch: manifest of jobs
+int batch_threads = 0;                          // --jobs: worker threads (0 = one per online CPU)
+
+// Globals for trace control (see trace_filtered_instruction)
+int trace_control_active = 0;                   // 0 = every instruction is traced (default)
+int trace_start_irq = TRACE_NO_TRIGGER;         // --trace-on-irq: IRQ number that starts the trace
+int trace_start_io_register = TRACE_NO_TRIGGER; // --trace-on-write: I/O register whose OUT starts the trace
+uint8_t trace_pc_selected[MEM_SIZE];            // 1 for every PC inside a --trace-pc range
+char *trace_pc_specs[TRACE_MAX_RANGES];         // --trace-pc arguments, resolved after all options are read
+int trace_pc_spec_count = 0;
+uint64_t trace_window_start[TRACE_MAX_RANGES];  // --trace-cycles windows [start, end)
+uint64_t trace_window_end[TRACE_MAX_RANGES];
+int trace_window_count = 0;
+uint32_t trace_history_size = 0;                // --trace-history: capacity of each machine's trace_history
+const char *symbol_file_name = NULL;            // --symbols: label map written by the assembler
+char symbol_names[MEM_SIZE][SYMBOL_NAME_LEN];   // Labels loaded from the symbol map
+uint32_t symbol_addresses[MEM_SIZE];
+int symbol_count = 0;
+int trace_format = TRACE_FORMAT_TEXT;           // TRACE_FORMAT_TEXT / TRACE_FORMAT_BINARY / TRACE_FORMAT_NONE
+
+// Globals for runtime metrics (see write_metrics_files)
+const char *metrics_file_name = NULL;           // --metrics: JSON metrics file
+const char *metrics_prometheus_file_name = NULL; // --metrics-prometheus: Prometheus textfile
+uint64_t metrics_interval = 0;                  // --metrics-interval: cycles between exports (0 = only at exit)
+
+// Globals for the guest-program profiler (see profile_instruction)
+const char *profile_file_name = NULL;           // --profile: flat report
+const char *profile_folded_file_name = NULL;    // --profile-folded: folded stacks for flamegraph tools
+int symbol_at_pc[MEM_SIZE];                     // Symbol index of the last label at or before each PC (-1 = none)
 
 // I/O Register Names (for debug/logging)
 char *io_register_names[NUM_IO_REGS] = {
@@ -71,774 +507,4900 @@ char *io_register_names[NUM_IO_REGS] = {
     "reserved", "reserved", "monitoraddr", "monitordata", "monitorcmd"
 };
 
-// File Pointers for Input
-FILE *irq2_file = NULL;  // IRQ2 events file pointer
-
-// File Pointers for Output
-FILE *trace_file = NULL;                // Instruction trace output file
-FILE *hw_register_trace_file = NULL;    // HW register trace output file
-FILE *cycle_count_file = NULL;          // Cycle count output file
-FILE *led_output_file = NULL;           // LED output file
-FILE *seven_segment_output_file = NULL; // 7-segment output file
-FILE *disk_output_file = NULL;          // Disk output file
-FILE *monitor_output_file = NULL;       // Monitor text output file
-FILE *monitor_yuv_file = NULL;          // Monitor YUV output file (binary)
-FILE *register_output_file = NULL;      // Final register values output file
+// Opcode mnemonics (for the profile report and the metrics)
+const char *opcode_names[] = {
+    "add", "sub", "mac", "and", "or", "xor", "sll", "sra", "srl", "beq", "bne",
+    "blt", "bgt", "ble", "bge", "jal", "lw", "sw", "reti", "in", "out", "halt"
+};
 
+static const char hex_digits_upper[] = "0123456789ABCDEF";
+static const char hex_digits_lower[] = "0123456789abcdef";
 
 /*
- * log_instruction_trace:
- * -----------------------
- * Logs the current instruction in hexadecimal, along with the 16 registers in hex,
- * to the trace_file. This is meant to track each instruction execution.
+ * format_hex / format_hex32 / format_decimal:
+ * --------------------------------------------
+ * Hand-rolled replacements for the printf conversions used by the output files
+ * ("%0<n>X", "%08x" and "%d"). Each writes at 'out' and returns the new end.
  */
-void log_instruction_trace(uint32_t pc, uint64_t instruction, uint32_t *registers) {
-    // If we've halted the CPU but the disk is still busy, avoid logging additional instructions
-    if (halt_flag == 1 && io_registers[DISK_STATUS] == 1)
-        return;
+static inline char *format_hex(char *out, uint64_t value, int min_digits, const char *digits) {
+    char reversed[16];
+    int count = 0;
+    do {
+        reversed[count++] = digits[value & 0xF];
+        value >>= 4;
+    } while (value);
+    while (count < min_digits)
+        reversed[count++] = '0';
+    while (count)
+        *out++ = reversed[--count];
+    return out;
+}
 
-    // Print PC in 3-digit hex, instruction in 12-digit hex, then register values
-    fprintf(trace_file, "%03X %012llX ", pc, instruction);
-    for (int i = 0; i < NUM_CPU_REGS; i++) {
-        fprintf(trace_file, "%08x", registers[i]);
-        if (i != NUM_CPU_REGS - 1)
-            fprintf(trace_file, " ");
+static inline char *format_hex32(char *out, uint32_t value, const char *digits) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = digits[value & 0xF];
+        value >>= 4;
     }
-    fprintf(trace_file, "\n");
+    return out + 8;
 }
 
-/*
- * increment_clock_cycle:
- * -----------------------
- * Increments the system clock cycle register (CLOCK_CYCLE).
- * If it overflows (0xFFFFFFFF), wraps back to 0.
- */
-void increment_clock_cycle(uint32_t *io_registers) {
-    io_registers[CLOCK_CYCLE] = (io_registers[CLOCK_CYCLE] == 0xFFFFFFFF) ? 0 : io_registers[CLOCK_CYCLE] + 1;
+static inline char *format_decimal(char *out, int32_t value) {
+    char reversed[12];
+    int count = 0;
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    do {
+        reversed[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        *out++ = '-';
+    while (count)
+        *out++ = reversed[--count];
+    return out;
 }
 
+#if SIM_ASYNC_OUTPUT
 /*
- * sign_extend:
- * -------------
- * Extends a 'value' (bits wide) to a 32-bit signed value.
- * bits: how many bits (of 'value') are used to determine the sign bit.
+ * output_sink_drain:
+ * -------------------
+ * Writes everything produced so far into the sink's file, using one writev for the
+ * (at most two) contiguous spans of the ring. Called by the writer thread, or by the
+ * simulation thread itself when there is no writer thread.
  */
-int32_t sign_extend(int32_t value, int bits) {
-    int32_t mask = 1 << (bits - 1);  // Calculate the position of the sign bit
-    return (value ^ mask) - mask;    // XOR and subtract to preserve sign
+void output_sink_drain(output_sink *sink) {
+    size_t tail = atomic_load_explicit(&sink->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&sink->head, memory_order_acquire);
+
+    while (tail != head) {
+        size_t offset = tail & (OUTPUT_RING_SIZE - 1);
+        size_t pending = head - tail;
+        struct iovec spans[2];
+        int span_count = 1;
+
+        spans[0].iov_base = sink->ring + offset;
+        spans[0].iov_len = pending;
+        if (offset + pending > OUTPUT_RING_SIZE) {
+            spans[0].iov_len = OUTPUT_RING_SIZE - offset;
+            spans[1].iov_base = sink->ring;
+            spans[1].iov_len = pending - spans[0].iov_len;
+            span_count = 2;
+        }
+
+        ssize_t written = writev(sink->fd, spans, span_count);
+        if (written <= 0) {
+            perror("Error writing output file");
+            exit(EXIT_FAILURE);
+        }
+        tail += (size_t)written;
+        atomic_store_explicit(&sink->tail, tail, memory_order_release);
+    }
 }
 
 /*
- * decode_instruction:
+ * output_writer_main:
  * --------------------
- * Decodes a 48-bit instruction into register indices and a 24-bit immediate.
- * registerUsed: an array to store the 4 register fields (4 bits each).
- * Returns the 24-bit immediate portion of the instruction.
+ * Background writer thread: sleeps until a sink has OUTPUT_WRITE_THRESHOLD bytes
+ * pending (or OUTPUT_WRITER_SLEEP_MS passed), then drains every sink with large writes.
+ * 'context' is the machine whose sinks it drains.
  */
-uint32_t decode_instruction(uint64_t instruction, int *registersUsed) {
-    uint64_t mask = 0x00F000000000; // Mask to isolate the register fields
-    int shift = 36;                 // Bit shift amount (starting for first reg)
+void *output_writer_main(void *context) {
+    machine = context;
+    for (;;) {
+        int stopping = atomic_load(&machine->output_writer_stop);
+        for (size_t i = 0; i < NUM_OUTPUT_SINKS; i++)
+            if (machine->output_sinks[i]->fd >= 0)
+                output_sink_drain(machine->output_sinks[i]);
+        if (stopping)
+            return NULL;
 
-    // Extract 4 registers, each 4 bits
-    for (int i = 0; i < 4; i++) {
-        registersUsed[i] = (instruction & mask) >> shift;
-        mask >>= 4;  // Move mask to next 4 bits
-        shift -= 4;  // Update shift accordingly
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += OUTPUT_WRITER_SLEEP_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&machine->output_writer_mutex);
+        if (!atomic_load(&machine->output_writer_stop))
+            pthread_cond_timedwait(&machine->output_writer_wakeup, &machine->output_writer_mutex, &deadline);
+        pthread_mutex_unlock(&machine->output_writer_mutex);
     }
+}
 
-    // Return the 24 least significant bits as immediate
-    return instruction & 0xFFFFFF;
+/*
+ * output_sink_wake_writer:
+ * -------------------------
+ * Wakes the writer thread (or drains synchronously when there is none).
+ */
+void output_sink_wake_writer(output_sink *sink) {
+    if (!machine->output_writer_running) {
+        output_sink_drain(sink);
+        return;
+    }
+    pthread_mutex_lock(&machine->output_writer_mutex);
+    pthread_cond_signal(&machine->output_writer_wakeup);
+    pthread_mutex_unlock(&machine->output_writer_mutex);
 }
+#endif
 
 /*
- * read_next_irq:
- * ---------------
- * Reads the next line of IRQ2 file (already fetched as 'line') to get the
- * clock cycle where the next IRQ2 event occurs.
- * Returns -1 if the line pointer is NULL (indicating no more IRQ events).
+ * output_sink_open:
+ * ------------------
+ * Creates/truncates 'filename' for the sink ('binary' = no newline translation).
+ * Returns false if it cannot be opened.
  */
-int read_next_irq(char *line) {
-    if (!line) {
-        return -1; // No more IRQ events
+bool output_sink_open(output_sink *sink, const char *filename, bool binary) {
+#if SIM_ASYNC_OUTPUT
+    (void)binary; // No text-mode translation on POSIX
+    sink->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    sink->ring = malloc(OUTPUT_RING_SIZE + OUTPUT_MAX_RECORD);
+    atomic_init(&sink->head, 0);
+    atomic_init(&sink->tail, 0);
+    return sink->fd >= 0 && sink->ring != NULL;
+#else
+    sink->file = fopen(filename, binary ? "wb" : "w");
+    return sink->file != NULL;
+#endif
+}
+
+/*
+ * output_sink_reserve:
+ * ---------------------
+ * Returns room for one record of up to OUTPUT_MAX_RECORD bytes. The caller formats
+ * the record there and then calls output_sink_commit with its length. Only blocks
+ * if the ring is full, i.e. the disk cannot keep up with the simulation.
+ */
+static inline char *output_sink_reserve(output_sink *sink) {
+#if SIM_ASYNC_OUTPUT
+    size_t head = atomic_load_explicit(&sink->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&sink->tail, memory_order_acquire) > OUTPUT_RING_SIZE - OUTPUT_MAX_RECORD) {
+        output_sink_wake_writer(sink);
+        if (machine->output_writer_running)
+            usleep(100);
     }
-    return atoi(line); // Convert line content to an integer
+    return sink->ring + (head & (OUTPUT_RING_SIZE - 1));
+#else
+    static char record[OUTPUT_MAX_RECORD];
+    (void)sink;
+    return record;
+#endif
 }
 
 /*
- * write_monitor_data:
+ * output_sink_commit:
  * --------------------
- * Writes the entire monitor buffer to two output files:
- *   1. yuv_file: in raw binary (each byte is a pixel)
- *   2. text_file: in hex form, but only up to the highest non-zero pixel index.
+ * Publishes a record written at the pointer returned by output_sink_reserve.
+ * Bytes that ran into the slack area past the end of the ring are moved to its start.
  */
-void write_monitor_data(FILE *text_file, FILE *yuv_file) {
-    int max = 0;
+static inline void output_sink_commit(output_sink *sink, char *record, size_t length) {
+#if SIM_ASYNC_OUTPUT
+    size_t head = atomic_load_explicit(&sink->head, memory_order_relaxed);
+    size_t offset = head & (OUTPUT_RING_SIZE - 1);
+    if (offset + length > OUTPUT_RING_SIZE)
+        memcpy(sink->ring, sink->ring + OUTPUT_RING_SIZE, offset + length - OUTPUT_RING_SIZE);
+    atomic_store_explicit(&sink->head, head + length, memory_order_release);
 
-    // Find the highest monitor_buffer index that is not zero
-    for (int i = 0; i < MONITOR_SIZE; i++) {
-        uint8_t pixel_value = monitor_buffer[i];
-        if (monitor_buffer[i] != 0x0)
-            max = i;
+    // Crossing the threshold wakes the writer for a large write
+    size_t pending = head + length - atomic_load_explicit(&sink->tail, memory_order_relaxed);
+    if (pending >= OUTPUT_WRITE_THRESHOLD && pending - length < OUTPUT_WRITE_THRESHOLD)
+        output_sink_wake_writer(sink);
+    (void)record;
+#else
+    fwrite(record, 1, length, sink->file);
+#endif
+}
 
-        // Write raw pixel data to YUV file
-        fwrite(&pixel_value, sizeof(uint8_t), 1, yuv_file);
-    }
+/*
+ * start_output_writer / close_output_sinks:
+ * ------------------------------------------
+ * Start the background writer thread (falling back to synchronous draining if it
+ * cannot be created, and in batch mode, where every core already runs a job), and
+ * flush and close every sink at the end of the run.
+ */
+void start_output_writer() {
+#if SIM_ASYNC_OUTPUT
+    atomic_store(&machine->output_writer_stop, 0);
+    machine->output_writer_running = background_output_writer
+        && pthread_create(&machine->output_writer_thread, NULL, output_writer_main, machine) == 0;
+#endif
+}
 
-    // Write hex pixel values to text file up to 'max' index
-    if (max != 0) {
-        for (int i = 0; i < max + 1; i++) {
-            uint8_t pixel_value = monitor_buffer[i];
-            fprintf(text_file, "%02X\n", pixel_value);
+void close_output_sinks() {
+#if SIM_ASYNC_OUTPUT
+    if (machine->output_writer_running) {
+        pthread_mutex_lock(&machine->output_writer_mutex);
+        atomic_store(&machine->output_writer_stop, 1);
+        pthread_cond_signal(&machine->output_writer_wakeup);
+        pthread_mutex_unlock(&machine->output_writer_mutex);
+        pthread_join(machine->output_writer_thread, NULL);
+        machine->output_writer_running = 0;
+    }
+    for (size_t i = 0; i < NUM_OUTPUT_SINKS; i++) {
+        if (machine->output_sinks[i]->fd >= 0) {
+            output_sink_drain(machine->output_sinks[i]);
+            close(machine->output_sinks[i]->fd);
         }
+        machine->output_sinks[i]->fd = -1;
+        free(machine->output_sinks[i]->ring);
+        machine->output_sinks[i]->ring = NULL;
     }
+#else
+    fclose(machine->trace_sink.file);
+    fclose(machine->hw_register_trace_sink.file);
+    fclose(machine->led_sink.file);
+    fclose(machine->seven_segment_sink.file);
+#endif
 }
 
+
 /*
- * load_memory:
- * -------------
- * Loads 64-bit instruction words from a file into 'memory' (size mem_size).
- * Reads each line as a hex string of width 'hex_width' bits.
+ * put_u32:
+ * ---------
+ * Stores 'value' little-endian at 'out' and returns the new end (binary trace).
  */
-void load_memory(const char *filename, uint64_t *memory, size_t mem_size, int hex_width) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening memory input file");
-        exit(EXIT_FAILURE);
-    }
-
-    char line[256];
-    size_t addr = 0;
-
-    // Read lines until either memory is full or we reach EOF
-    while (fgets(line, sizeof(line), file) && addr < mem_size) {
-        uint64_t value;
-        sscanf(line, "%llx", &value); // Convert hex to 64-bit value
-        memory[addr++] = value;
-    }
-
-    fclose(file);
+static inline char *put_u32(char *out, uint32_t value) {
+    out[0] = (char)value;
+    out[1] = (char)(value >> 8);
+    out[2] = (char)(value >> 16);
+    out[3] = (char)(value >> 24);
+    return out + 4;
 }
 
 /*
- * load_memory32:
- * ---------------
- * Similar to 'load_memory' but for 32-bit data values.
+ * write_binary_trace_header:
+ * ---------------------------
+ * Starts a binary trace: magic, version, keyframe interval, then the instruction
+ * memory image (word count + 64-bit little-endian words, trailing zeros dropped),
+ * so tracedec can rebuild the instruction column without the original imemin.txt.
  */
-void load_memory32(const char *filename, uint32_t *memory, size_t mem_size) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening memory input file");
-        exit(EXIT_FAILURE);
-    }
+void write_binary_trace_header() {
+    uint32_t words = MEM_SIZE;
+    while (words && machine->instruction_memory[words - 1] == 0)
+        words--;
 
-    char line[256];
-    size_t addr = 0;
+    char *record = output_sink_reserve(&machine->trace_sink);
+    memcpy(record, TRACE_BINARY_MAGIC, 8);
+    char *out = put_u32(record + 8, TRACE_BINARY_VERSION);
+    out = put_u32(out, TRACE_KEYFRAME_INTERVAL);
+    out = put_u32(out, words);
+    output_sink_commit(&machine->trace_sink, record, (size_t)(out - record));
 
-    while (fgets(line, sizeof(line), file) && addr < mem_size) {
-        uint32_t value;
-        sscanf(line, "%x", &value); // Convert hex to 32-bit value
-        memory[addr++] = value;
+    for (uint32_t i = 0; i < words; i++) {
+        record = output_sink_reserve(&machine->trace_sink);
+        out = put_u32(record, (uint32_t)machine->instruction_memory[i]);
+        out = put_u32(out, (uint32_t)(machine->instruction_memory[i] >> 32));
+        output_sink_commit(&machine->trace_sink, record, (size_t)(out - record));
     }
-
-    fclose(file);
 }
 
 /*
- * save_memory:
- * -------------
- * Saves 32-bit memory array ('memory') to a file.
- * It first finds the highest nonzero index to optimize output.
+ * write_binary_trace_record:
+ * ---------------------------
+ * Binary counterpart of one trace line. Registers are compared with the previous
+ * record, where $imm1/$imm2 are first replaced by this instruction's immediates
+ * (the decoder predicts them from the instruction memory image); only the
+ * registers that differ are stored:
+ *   delta:    tag (NEXT_PC flag | count), [32-bit PC], count x (index byte, 32-bit value)
+ *   keyframe: TRACE_RECORD_KEYFRAME, 32-bit PC, 16 x 32-bit registers
+ * A keyframe starts the trace and repeats every TRACE_KEYFRAME_INTERVAL records,
+ * so a damaged or truncated trace can be decoded from the next keyframe on.
  */
-void save_memory(const char *filename, uint32_t *memory, size_t mem_size) {
-    FILE *file = fopen(filename, "w");
-    if (!file) {
-        perror("Error opening memory output file");
-        exit(EXIT_FAILURE);
-    }
-    int max = 0;
+void write_binary_trace_record(uint32_t pc, const uint32_t *registers) {
+    char *record = output_sink_reserve(&machine->trace_sink);
+    char *out = record;
 
-    // Find the highest nonzero word
-    for (int i = 0; i < mem_size; i++) {
-        if (memory[i] != 0) {
-            max = i;
-        }
+    if (machine->trace_binary_records == 0) {
+        *out++ = (char)TRACE_RECORD_KEYFRAME;
+        out = put_u32(out, pc);
+        for (int i = 0; i < NUM_CPU_REGS; i++)
+            out = put_u32(out, registers[i]);
     }
+    else {
+        machine->trace_binary_registers[1] = machine->decoded_memory[pc].imm1;
+        machine->trace_binary_registers[2] = machine->decoded_memory[pc].imm2;
 
-    // Write values up to that index
-    if (max != 0) {
-        for (int i = 0; i < max + 1; i++) {
-            fprintf(file, "%08X\n", memory[i]);
+        char *tag = out++;
+        int changed = 0;
+        *tag = (pc == machine->trace_binary_pc + 1) ? TRACE_RECORD_NEXT_PC : 0;
+        if (!*tag)
+            out = put_u32(out, pc);
+        for (int i = 0; i < NUM_CPU_REGS; i++) {
+            if (registers[i] != machine->trace_binary_registers[i]) {
+                *out++ = (char)i;
+                out = put_u32(out, registers[i]);
+                changed++;
+            }
         }
+        *tag |= (char)changed;
     }
+    output_sink_commit(&machine->trace_sink, record, (size_t)(out - record));
 
-    fclose(file);
+    machine->trace_binary_pc = pc;
+    memcpy(machine->trace_binary_registers, registers, sizeof(machine->trace_binary_registers));
+    if (++machine->trace_binary_records == TRACE_KEYFRAME_INTERVAL)
+        machine->trace_binary_records = 0;
 }
 
 /*
- * update_timer:
- * --------------
- * Increments the timer if TIMER_ENABLE is set and compares TIMER_CURRENT with TIMER_MAX.
- * If they match, it resets TIMER_CURRENT and triggers IRQ0_STATUS.
+ * write_trace_line:
+ * ------------------
+ * Writes one trace line: the instruction in hexadecimal, along with the 16 registers in hex
+ * (or its binary record with --trace-format=binary), and passes it to the trace callback.
  */
-void update_timer(uint32_t *io_registers) {
-    if (io_registers[TIMER_ENABLE]) {
-        if (io_registers[TIMER_CURRENT] == io_registers[TIMER_MAX]) {
-            io_registers[TIMER_CURRENT] = 0;
-            io_registers[IRQ0_STATUS] = 1; // Trigger timer interrupt
-        }
-        else {
-            io_registers[TIMER_CURRENT]++;
-        }
+void write_trace_line(uint32_t pc, uint64_t instruction, const uint32_t *registers) {
+    if (machine->callbacks.trace)
+        machine->callbacks.trace(machine->callbacks.context, pc, instruction, registers);
+    if (!machine->writes_files || trace_format == TRACE_FORMAT_NONE)
+        return;
+
+    if (trace_format == TRACE_FORMAT_BINARY) {
+        write_binary_trace_record(pc, registers);
+        return;
+    }
+
+    // PC in 3-digit hex, instruction in 12-digit hex, then register values
+    char *record = output_sink_reserve(&machine->trace_sink);
+    char *out = format_hex(record, pc, 3, hex_digits_upper);
+    *out++ = ' ';
+    out = format_hex(out, instruction, 12, hex_digits_upper);
+    *out++ = ' ';
+    for (int i = 0; i < NUM_CPU_REGS; i++) {
+        out = format_hex32(out, registers[i], hex_digits_lower);
+        *out++ = (i != NUM_CPU_REGS - 1) ? ' ' : '\n';
     }
+    output_sink_commit(&machine->trace_sink, record, (size_t)(out - record));
 }
 
 /*
- * handle_disk_operations:
- * ------------------------
- * Manages disk read/write operations (based on DISK_CMD).
- * Disk operations proceed in cycles, each 8 clock cycles transferring one word.
- * After 1024 cycles (128 words transferred), the operation is complete.
+ * trace_filtered_instruction:
+ * ----------------------------
+ * Trace path used when any --trace-* option is given. A line is written only once
+ * the start trigger has fired (--trace-on-irq / --trace-on-write, if any), while
+ * 'cycle' is inside a --trace-cycles window (if any) and the PC is inside a
+ * --trace-pc range (if any). Suppressed lines go to the --trace-history ring, which
+ * is written out in front of the next line that passes, so the trace shows the
+ * last N instructions leading up to every point where a trigger opened it.
  */
-void handle_disk_operations() {
-    int buffer_address = io_registers[DISK_BUFFER];  // Memory address for transfer
-    int sector_number = io_registers[DISK_SECTOR];   // Sector index on the disk
-
-    // If there's a disk command and we're starting a new operation (disk_cycle_counter == 0)
-    if (io_registers[DISK_CMD] != 0 && disk_cycle_counter == 0) {
-        io_registers[DISK_STATUS] = 1; // Disk is busy
-        disk_index = 0;
-    }
+void trace_filtered_instruction(uint64_t cycle, uint32_t pc, uint64_t instruction, uint32_t *registers) {
+    // An OUT to the trigger register starts the trace with its own line
+    const decoded_instruction *decoded = &machine->decoded_memory[pc];
+    if (!machine->trace_started && decoded->opcode == 20
+        && registers[decoded->registers[1]] + registers[decoded->registers[2]] == (uint32_t)trace_start_io_register)
+        machine->trace_started = 1;
 
-    // READ operation (DISK_CMD == 1), every 8 cycles transfer 1 word
-    if (io_registers[DISK_CMD] == 1 && (disk_cycle_counter % 8 == 0)) {
-        data_memory[buffer_address + disk_index] = disk_memory[sector_number * 128 + disk_index];
-        disk_index++;
-    }
-    // WRITE operation (DISK_CMD == 2), every 8 cycles transfer 1 word
-    else if (io_registers[DISK_CMD] == 2 && (disk_cycle_counter % 8 == 0)) {
-        disk_memory[sector_number * 128 + disk_index] = data_memory[buffer_address + disk_index];
-        disk_index++;
-    }
+    int in_window = trace_window_count == 0;
+    for (int i = 0; i < trace_window_count && !in_window; i++)
+        in_window = cycle >= trace_window_start[i] && cycle < trace_window_end[i];
 
-    // After 1024 cycles (128 words * 8 cycles/word), finish operation
-    if (disk_cycle_counter == 1024) {
-        disk_cycle_counter = 0;
-        disk_index = 0;
-        io_registers[DISK_CMD] = 0;     // Reset the disk command
-        io_registers[DISK_STATUS] = 0;  // Disk is now free
-        io_registers[IRQ1_STATUS] = 1;  // Trigger IRQ1 (disk operation complete)
+    if (machine->trace_started && in_window && trace_pc_selected[pc]) {
+        // Dump the history (oldest first) ahead of the line that opened the trace
+        if (machine->trace_history_count) {
+            uint32_t slot = (machine->trace_history_next + trace_history_size - machine->trace_history_count) % trace_history_size;
+            for (; machine->trace_history_count; machine->trace_history_count--) {
+                write_trace_line(machine->trace_history[slot].pc, machine->trace_history[slot].instruction, machine->trace_history[slot].registers);
+                slot = (slot + 1) % trace_history_size;
+            }
+        }
+        write_trace_line(pc, instruction, registers);
+        return;
     }
 
-    // If a disk command is ongoing, increment the cycle counter
-    if (io_registers[DISK_CMD] != 0) {
-        disk_cycle_counter++;
+    if (trace_history_size) {
+        trace_record *record = &machine->trace_history[machine->trace_history_next];
+        record->pc = pc;
+        record->instruction = instruction;
+        memcpy(record->registers, registers, sizeof(record->registers));
+        machine->trace_history_next = (machine->trace_history_next + 1) % trace_history_size;
+        if (machine->trace_history_count < trace_history_size)
+            machine->trace_history_count++;
     }
 }
 
 /*
- * handle_timer_operations:
- * -------------------------
- * Similar to update_timer, increments TIMER_CURRENT if enabled
- * and triggers IRQ0_STATUS if we hit TIMER_MAX.
- * (This appears to be a duplicate approach; see update_timer above.)
+ * trace_interrupt_taken:
+ * -----------------------
+ * Called when the CPU enters the interrupt handler while a --trace-on-irq trigger
+ * is still armed; starts the trace if the configured IRQ is one of the causes.
  */
-void handle_timer_operations() {
-    if (io_registers[TIMER_ENABLE] == 1) {
-        if (io_registers[TIMER_CURRENT] == io_registers[TIMER_MAX]) {
-            io_registers[TIMER_CURRENT] = 0;
-            io_registers[IRQ0_STATUS] = 1;
-        }
-        else {
-            io_registers[TIMER_CURRENT]++;
-        }
-    }
+void trace_interrupt_taken() {
+    if (trace_start_irq != TRACE_NO_TRIGGER && machine->io_registers[IRQ0_ENABLE + trace_start_irq]
+        && machine->io_registers[IRQ0_STATUS + trace_start_irq])
+        machine->trace_started = 1;
 }
 
 /*
- * handle_led_and_display_operations:
- * -----------------------------------
- * For OUT instruction (opcode == 20), checks if the target I/O register is LEDs or DISPLAY_7SEG
- * and logs it into respective output files.
+ * profile_entry_label:
+ * ---------------------
+ * Label of a function entered at 'address': the symbol placed exactly there,
+ * or PROFILE_NO_LABEL (the function is then named by its address).
  */
-void handle_led_and_display_operations(int opcode, int *registers_used) {
-    if (opcode == 20) { // OUT instruction
-        int io_register_index = cpu_registers[registers_used[1]] + cpu_registers[registers_used[2]];
-        if (io_register_index == LEDS) {
-            // Log LED change
-            fprintf(led_output_file, "%d %08x\n", io_registers[CLOCK_CYCLE], io_registers[LEDS]);
-        }
-        else if (io_register_index == DISPLAY_7SEG) {
-            // Log 7-segment display change
-            fprintf(seven_segment_output_file, "%d %08X\n", io_registers[CLOCK_CYCLE], io_registers[DISPLAY_7SEG]);
-        }
-    }
+int profile_entry_label(uint32_t address) {
+    int symbol = symbol_at_pc[address];
+    return (symbol >= 0 && symbol_addresses[symbol] == address) ? symbol : PROFILE_NO_LABEL;
 }
 
 /*
- * handle_monitor_operations:
- * ---------------------------
- * If monitorcmd is set to 1, writes a pixel to 'monitor_buffer' at address = monitoraddr
- * with value = monitordata.
+ * profile_child:
+ * ---------------
+ * Returns the call tree node for 'label' (entered at 'address') under 'parent',
+ * adding it on first use. If memory runs out the tree stops growing and the
+ * cycles are charged to 'parent' instead.
  */
-void handle_monitor_operations() {
-    if (io_registers[MONITOR_CMD] == 1) {
-        monitor_buffer[io_registers[MONITOR_ADDR]] = io_registers[MONITOR_DATA];
+int profile_child(int parent, int label, uint32_t address) {
+    profile_state *profile = machine->profile;
+    for (int child = profile->nodes[parent].first_child; child >= 0; child = profile->nodes[child].next_sibling)
+        if (profile->nodes[child].label == label && profile->nodes[child].address == address)
+            return child;
+
+    if (profile->node_count == profile->node_capacity) {
+        profile_node *nodes = realloc(profile->nodes, 2 * (size_t)profile->node_capacity * sizeof(profile_node));
+        if (!nodes) {
+            profile->out_of_memory = 1;
+            return parent;
+        }
+        profile->nodes = nodes;
+        profile->node_capacity *= 2;
     }
+
+    int node = profile->node_count++;
+    profile->nodes[node].parent = parent;
+    profile->nodes[node].label = label;
+    profile->nodes[node].address = address;
+    profile->nodes[node].first_child = -1;
+    profile->nodes[node].next_sibling = profile->nodes[parent].first_child;
+    profile->nodes[node].cycles = 0;
+    profile->nodes[parent].first_child = node;
+    return node;
+}
+
+/*
+ * profile_push:
+ * --------------
+ * Pushes a frame on the shadow call stack (dropped beyond PROFILE_MAX_DEPTH).
+ */
+void profile_push(int node, uint32_t return_address, int interrupt) {
+    profile_state *profile = machine->profile;
+    if (profile->depth == PROFILE_MAX_DEPTH)
+        return;
+    profile->stack[profile->depth].return_address = return_address;
+    profile->stack[profile->depth].node = node;
+    profile->stack[profile->depth].interrupt = interrupt;
+    profile->depth++;
+}
+
+/*
+ * profile_follow_control_flow:
+ * -----------------------------
+ * Updates the shadow call stack for the step from the previous profiled
+ * instruction to the one at 'pc':
+ *   JAL                          pushes a frame for its target, returning at JAL + 1
+ *   taken branch to a return     pops back to that frame (a return through $ra or a copy of it)
+ *   RETI                         pops the innermost interrupt frame
+ *   entry to the handler         pushes "[interrupt]" and the handler
+ */
+void profile_follow_control_flow(uint32_t pc) {
+    profile_state *profile = machine->profile;
+    uint8_t previous = profile->previous_opcode;
+
+    if (previous == RETI_OP) {
+        // Also drops the calls the handler did not return from
+        for (int i = profile->depth - 1; i > 0; i--) {
+            if (profile->stack[i].interrupt) {
+                profile->depth = i;
+                break;
+            }
+        }
+    }
+    else if (previous == 15) { // JAL
+        int caller = profile->stack[profile->depth - 1].node;
+        uint32_t target = profile->call_target;
+        profile_push(profile_child(caller, profile_entry_label(target), target), profile->previous_pc + 1, 0);
+    }
+    else if (previous >= 9 && previous <= 14 && pc != profile->previous_pc + 1) {
+        // Returns never cross an interrupt frame
+        for (int i = profile->depth - 1; i > 0 && !profile->stack[i].interrupt; i--) {
+            if (profile->stack[i].return_address == pc) {
+                profile->depth = i;
+                break;
+            }
+        }
+    }
+
+    // The interrupt was taken at the end of the previous cycle
+    if (machine->isr_active_flag && (!profile->previous_isr || previous == RETI_OP)) {
+        int marker = profile_child(profile->stack[profile->depth - 1].node, PROFILE_INTERRUPT, 0);
+        profile_push(profile_child(marker, profile_entry_label(pc), pc), PROFILE_NO_RETURN, 1);
+    }
+}
+
+/*
+ * profile_leaf_node:
+ * -------------------
+ * Node the cycles of the instruction at 'pc' are charged to: the frame on top of
+ * the stack, or its child for the label 'pc' lies under when that differs from
+ * the function's own label (so folded stacks end in loops and other inner labels).
+ */
+static inline int profile_leaf_node(uint32_t pc) {
+    profile_state *profile = machine->profile;
+    int frame = profile->stack[profile->depth - 1].node;
+    int label = symbol_at_pc[pc];
+    if (label < 0 || label == profile->nodes[frame].label)
+        return frame;
+
+    if (frame != profile->leaf_frame_node || label != profile->leaf_label) {
+        profile->leaf_frame_node = frame;
+        profile->leaf_label = label;
+        profile->leaf_node = profile_child(frame, label, symbol_addresses[label]);
+    }
+    return profile->leaf_node;
+}
+
+/*
+ * profile_stall:
+ * ---------------
+ * Charges 'cycles' halted at the HALT at 'pc' while the disk finishes its transfer.
+ */
+void profile_stall(uint32_t pc, uint64_t cycles) {
+    machine->profile->stall_cycles[pc] += cycles;
+    machine->profile->nodes[profile_leaf_node(pc)].cycles += cycles;
+}
+
+/*
+ * profile_instruction:
+ * ---------------------
+ * Profiles the instruction executing at 'pc' ('registers' as traced). Every cycle
+ * of the run passes here (or through profile_stall), so the counts add up to
+ * the cycle count. Called from log_instruction_trace when profiling is enabled.
+ */
+void profile_instruction(uint32_t pc, const uint32_t *registers) {
+    profile_state *profile = machine->profile;
+
+    // Halted re-execution of HALT while the disk is busy
+    if (machine->halt_flag == 1 && machine->io_registers[DISK_STATUS] == 1) {
+        profile_stall(pc, 1);
+        return;
+    }
+
+    if (profile->have_previous)
+        profile_follow_control_flow(pc);
+
+    const decoded_instruction *decoded = &machine->decoded_memory[pc];
+    profile->executions[pc]++;
+    if (machine->isr_active_flag)
+        profile->isr_executions[pc]++;
+    profile->nodes[profile_leaf_node(pc)].cycles++;
+
+    profile->have_previous = 1;
+    profile->previous_pc = pc;
+    profile->previous_opcode = decoded->opcode;
+    profile->previous_isr = machine->isr_active_flag;
+    if (decoded->opcode == 15) // JAL: R[rd] = PC + 1 is written before R[rm] is read
+        profile->call_target = (decoded->registers[0] == decoded->registers[3] ? pc + 1 : registers[decoded->registers[3]]) & 0xFFF;
+}
+
+/*
+ * count_instruction:
+ * -------------------
+ * Metrics counters of the instruction at 'pc' ('registers' as traced, i.e. as it
+ * reads them): its opcode and, for a branch, whether it is taken.
+ */
+static inline void count_instruction(uint32_t pc, const uint32_t *registers) {
+    const decoded_instruction *decoded = &machine->decoded_memory[pc];
+    machine->metrics.opcode_counts[decoded->opcode]++;
+    if (decoded->opcode < 9 || decoded->opcode > 14)
+        return;
+
+    int32_t rs = (int32_t)registers[decoded->registers[1]], rt = (int32_t)registers[decoded->registers[2]];
+    int taken;
+    switch (decoded->opcode) {
+    case 9:  taken = rs == rt; break; // BEQ
+    case 10: taken = rs != rt; break; // BNE
+    case 11: taken = rs < rt;  break; // BLT
+    case 12: taken = rs > rt;  break; // BGT
+    case 13: taken = rs <= rt; break; // BLE
+    default: taken = rs >= rt; break; // BGE
+    }
+    machine->metrics.branches_taken[decoded->opcode - 9] += taken;
+}
+
+/*
+ * log_instruction_trace:
+ * -----------------------
+ * Logs the instruction executing in simulated cycle 'cycle' to the trace sink,
+ * through trace_filtered_instruction if trace control is enabled, and passes it
+ * to the profiler and the metrics counters if they are enabled.
+ * This is meant to track each instruction execution.
+ */
+static inline void log_instruction_trace(uint64_t cycle, uint32_t pc, uint64_t instruction, uint32_t *registers) {
+    if (machine->profile)
+        profile_instruction(pc, registers);
+
+    // If we've halted the CPU but the disk is still busy, avoid logging additional instructions
+    if (machine->halt_flag == 1 && machine->io_registers[DISK_STATUS] == 1)
+        return;
+
+    if (machine->count_instructions)
+        count_instruction(pc, registers);
+    if (trace_control_active)
+        trace_filtered_instruction(cycle, pc, instruction, registers);
+    else
+        write_trace_line(pc, instruction, registers);
+}
+
+/*
+ * increment_clock_cycle:
+ * -----------------------
+ * Increments the system clock cycle register (CLOCK_CYCLE).
+ * If it overflows (0xFFFFFFFF), wraps back to 0.
+ */
+void increment_clock_cycle(uint32_t *io_registers) {
+    io_registers[CLOCK_CYCLE] = (io_registers[CLOCK_CYCLE] == 0xFFFFFFFF) ? 0 : io_registers[CLOCK_CYCLE] + 1;
+}
+
+/*
+ * sign_extend:
+ * -------------
+ * Extends a 'value' (bits wide) to a 32-bit signed value.
+ * bits: how many bits (of 'value') are used to determine the sign bit.
+ */
+int32_t sign_extend(int32_t value, int bits) {
+    int32_t mask = 1 << (bits - 1);  // Calculate the position of the sign bit
+    return (value ^ mask) - mask;    // XOR and subtract to preserve sign
+}
+
+/*
+ * decode_instruction:
+ * --------------------
+ * Decodes a 48-bit instruction into register indices and a 24-bit immediate.
+ * registerUsed: an array to store the 4 register fields (4 bits each).
+ * Returns the 24-bit immediate portion of the instruction.
+ */
+uint32_t decode_instruction(uint64_t instruction, int *registersUsed) {
+    uint64_t mask = 0x00F000000000; // Mask to isolate the register fields
+    int shift = 36;                 // Bit shift amount (starting for first reg)
+
+    // Extract 4 registers, each 4 bits
+    for (int i = 0; i < 4; i++) {
+        registersUsed[i] = (instruction & mask) >> shift;
+        mask >>= 4;  // Move mask to next 4 bits
+        shift -= 4;  // Update shift accordingly
+    }
+
+    // Return the 24 least significant bits as immediate
+    return instruction & 0xFFFFFF;
+}
+
+/*
+ * predecode_instruction:
+ * -----------------------
+ * Splits a raw 48-bit instruction word into a decoded_instruction record:
+ * opcode, the four register fields and both sign-extended immediates.
+ */
+void predecode_instruction(uint64_t instruction, decoded_instruction *decoded) {
+    int operand_registers[4] = { 0 };
+    uint32_t immediate_value = decode_instruction(instruction, operand_registers);
+    uint64_t opcode = instruction >> 40;
+
+    // Opcodes wider than 8 bits can never be valid, keep them out of the table range
+    decoded->opcode = (opcode > 0xFF) ? INVALID_OP : (uint8_t)opcode;
+    for (int i = 0; i < 4; i++)
+        decoded->registers[i] = (uint8_t)operand_registers[i];
+
+    // Split 24-bit immediate into two sign-extended 12-bit parts
+    decoded->imm1 = sign_extend((immediate_value & 0xFFF000) >> 12, 12);
+    decoded->imm2 = sign_extend(immediate_value & 0xFFF, 12);
+}
+
+/*
+ * find_straight_line_runs:
+ * -------------------------
+ * For every address, counts how many consecutive instructions starting there
+ * are straight-line: ALU ops (add..srl), lw and sw. Any branch, jal, reti,
+ * in, out or halt ends the run.
+ */
+void find_straight_line_runs(instruction_image *image) {
+    int run = 0;
+
+    // Walk backwards so each entry is one more than its successor's
+    for (int i = MEM_SIZE - 1; i >= 0; i--) {
+        int opcode = image->decoded[i].opcode;
+        int straight_line = opcode <= 8 || opcode == 16 || opcode == 17; // add..srl, lw, sw
+
+        run = straight_line ? run + 1 : 0;
+        image->block_length[i] = (uint16_t)run;
+    }
+}
+
+/*
+ * predecode_image:
+ * -----------------
+ * Load-time pass that decodes every word of an instruction image into its decoded
+ * form, so the simulation loop never has to shift and mask the raw words again.
+ */
+void predecode_image(instruction_image *image) {
+    for (int i = 0; i < MEM_SIZE; i++)
+        predecode_instruction(image->words[i], &image->decoded[i]);
+
+    find_straight_line_runs(image);
+}
+
+/*
+ * predecode_instruction_memory:
+ * ------------------------------
+ * Re-decodes the machine's instruction_memory (into decoded_memory / block_length)
+ * and drops its compiled blocks. Must be called again whenever instruction_memory
+ * is (re)loaded.
+ */
+void predecode_instruction_memory() {
+    predecode_image(machine->image);
+
+    // Compiled blocks were derived from the old image
+    memset(machine->jit_blocks, 0, sizeof(machine->jit_blocks));
+    memset(machine->jit_block_length, 0, sizeof(machine->jit_block_length));
+    memset(machine->jit_block_heat, 0, sizeof(machine->jit_block_heat));
+    memset(machine->jit_block_memory, 0, sizeof(machine->jit_block_memory));
+    machine->jit_code_used = 0;
+}
+
+/*
+ * read_next_irq:
+ * ---------------
+ * Reads the next line of IRQ2 file (already fetched as 'line') to get the
+ * clock cycle where the next IRQ2 event occurs.
+ * Returns -1 if the line pointer is NULL (indicating no more IRQ events).
+ */
+int read_next_irq(char *line) {
+    if (!line) {
+        return -1; // No more IRQ events
+    }
+    return atoi(line); // Convert line content to an integer
+}
+
+/*
+ * open_irq2_feed:
+ * ----------------
+ * Opens the IRQ2 source 'filename' ("-" = stdin; pipes and FIFOs work as well as
+ * regular files) without reading from it yet. Returns NULL if it cannot be opened.
+ */
+irq2_feed *open_irq2_feed(const char *filename) {
+    irq2_feed *feed = calloc(1, sizeof(irq2_feed));
+    if (!feed)
+        return NULL;
+#if SIM_ASYNC_INPUT
+    feed->fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (feed->fd < 0) {
+        free(feed);
+        return NULL;
+    }
+    pthread_mutex_init(&feed->mutex, NULL);
+    pthread_cond_init(&feed->wakeup, NULL);
+#else
+    feed->file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+    if (!feed->file) {
+        free(feed);
+        return NULL;
+    }
+#endif
+    return feed;
+}
+
+/*
+ * irq2_feed_read_chunk:
+ * ----------------------
+ * Reads the next chunk of the source (blocking on a pipe until data or its end arrives).
+ */
+void irq2_feed_read_chunk(irq2_feed *feed) {
+#if SIM_ASYNC_INPUT
+    ssize_t got;
+    int cancel_state;
+    // The reader thread may be cancelled here (and only here) by close_irq2_feed
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &cancel_state);
+    do
+        got = read(feed->fd, feed->chunk, sizeof(feed->chunk));
+    while (got < 0 && errno == EINTR);
+    pthread_setcancelstate(cancel_state, NULL);
+    if (got < 0)
+        perror("Error reading irq2in file");
+    feed->chunk_length = got > 0 ? (size_t)got : 0;
+#else
+    feed->chunk_length = fread(feed->chunk, 1, sizeof(feed->chunk), feed->file);
+    if (ferror(feed->file))
+        perror("Error reading irq2in file");
+#endif
+    feed->chunk_position = 0;
+    feed->source_ended = feed->chunk_length == 0;
+}
+
+/*
+ * irq2_feed_queue_line:
+ * ----------------------
+ * Queues the event of the assembled line (the ring has a free slot).
+ */
+void irq2_feed_queue_line(irq2_feed *feed, size_t *head) {
+    feed->line[feed->line_length] = '\0';
+    feed->cycles[*head & (IRQ2_FEED_EVENTS - 1)] = read_next_irq(feed->line);
+    feed->line_ends[*head & (IRQ2_FEED_EVENTS - 1)] = feed->parsed_offset;
+    feed->line_length = 0;
+    (*head)++;
+}
+
+/*
+ * irq2_feed_advance:
+ * -------------------
+ * One refill step: reads the next chunk once the last one is parsed, then parses
+ * into the free slots of the ring. Lines end after '\n' or after IRQ2_LINE_SIZE - 1
+ * bytes, exactly as fgets split them with the former line buffer, and each one is
+ * one event (read_next_irq). Returns 1 once every event of the source is queued.
+ */
+int irq2_feed_advance(irq2_feed *feed) {
+    if (feed->chunk_position == feed->chunk_length && !feed->source_ended)
+        irq2_feed_read_chunk(feed);
+
+    size_t head = FEED_LOAD(feed->head);
+    size_t tail = FEED_LOAD(feed->tail);
+    while (feed->chunk_position < feed->chunk_length && head - tail < IRQ2_FEED_EVENTS) {
+        char c = feed->chunk[feed->chunk_position++];
+        feed->line[feed->line_length++] = c;
+        feed->parsed_offset++;
+        if (c == '\n' || feed->line_length == IRQ2_LINE_SIZE - 1)
+            irq2_feed_queue_line(feed, &head);
+    }
+
+    // A last line without '\n' still counts
+    int ended = feed->source_ended && feed->chunk_position == feed->chunk_length;
+    if (ended && feed->line_length && head - tail < IRQ2_FEED_EVENTS)
+        irq2_feed_queue_line(feed, &head);
+    FEED_STORE(feed->head, head);
+    if (ended && !feed->line_length) {
+        FEED_STORE(feed->finished, 1);
+        return 1;
+    }
+    return 0;
+}
+
+#if SIM_ASYNC_INPUT
+/*
+ * irq2_reader_main:
+ * ------------------
+ * Background reader thread: keeps the ring of 'context' (an irq2_feed) filled,
+ * sleeping while it is full, until the source ends or the feed is closed.
+ */
+void *irq2_reader_main(void *context) {
+    irq2_feed *feed = context;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    for (;;) {
+        int done = irq2_feed_advance(feed);
+        pthread_mutex_lock(&feed->mutex);
+        pthread_cond_broadcast(&feed->wakeup);
+        while (!done && !atomic_load(&feed->stop)
+               && FEED_LOAD(feed->head) - FEED_LOAD(feed->tail) == IRQ2_FEED_EVENTS)
+            pthread_cond_wait(&feed->wakeup, &feed->mutex);
+        int stopping = atomic_load(&feed->stop);
+        pthread_mutex_unlock(&feed->mutex);
+        if (done || stopping)
+            return NULL;
+    }
+}
+#endif
+
+/*
+ * start_irq2_reader:
+ * -------------------
+ * Starts the background reader thread of the machine's IRQ2 feed (after
+ * restore_checkpoint skipped the consumed part). Without it, or in batch mode,
+ * irq2_feed_next refills the ring itself.
+ */
+void start_irq2_reader() {
+#if SIM_ASYNC_INPUT
+    irq2_feed *feed = machine->irq2_feed;
+    feed->reader_running = background_input_reader
+        && pthread_create(&feed->reader_thread, NULL, irq2_reader_main, feed) == 0;
+#endif
+}
+
+/*
+ * skip_irq2_feed:
+ * ----------------
+ * Drops the first 'offset' bytes of the source (lines a checkpointed run had
+ * consumed): seeks in a regular file, reads them away from a pipe. Returns false
+ * if the source is shorter.
+ */
+bool skip_irq2_feed(irq2_feed *feed, uint64_t offset) {
+#if SIM_ASYNC_INPUT
+    if (lseek(feed->fd, (off_t)offset, SEEK_SET) == (off_t)offset) {
+        feed->parsed_offset = feed->consumed_offset = offset;
+        return true;
+    }
+#else
+    if (fseek(feed->file, (long)offset, SEEK_SET) == 0) {
+        feed->parsed_offset = feed->consumed_offset = offset;
+        return true;
+    }
+#endif
+    while (feed->parsed_offset < offset) {
+        irq2_feed_read_chunk(feed);
+        if (feed->source_ended)
+            return false;
+        size_t skipped = feed->chunk_length;
+        if (skipped > offset - feed->parsed_offset)
+            skipped = (size_t)(offset - feed->parsed_offset);
+        feed->chunk_position = skipped;
+        feed->parsed_offset += skipped;
+    }
+    feed->consumed_offset = offset;
+    return true;
+}
+
+/*
+ * close_irq2_feed:
+ * -----------------
+ * Stops the reader thread (cancelling it if it waits for more input on a pipe
+ * nobody writes to any more), closes the source and frees the feed.
+ */
+void close_irq2_feed(irq2_feed *feed) {
+#if SIM_ASYNC_INPUT
+    if (feed->reader_running) {
+        pthread_mutex_lock(&feed->mutex);
+        atomic_store(&feed->stop, 1);
+        pthread_cond_broadcast(&feed->wakeup);
+        pthread_mutex_unlock(&feed->mutex);
+        pthread_cancel(feed->reader_thread);
+        pthread_join(feed->reader_thread, NULL);
+    }
+    if (feed->fd != STDIN_FILENO)
+        close(feed->fd);
+    pthread_mutex_destroy(&feed->mutex);
+    pthread_cond_destroy(&feed->wakeup);
+#else
+    if (feed->file != stdin)
+        fclose(feed->file);
+#endif
+    free(feed);
+}
+
+/*
+ * irq2_feed_next:
+ * ----------------
+ * Takes the next event cycle off the ring (-1 once the source has no more),
+ * waiting for the reader thread or refilling the ring when it is empty.
+ */
+int irq2_feed_next(irq2_feed *feed) {
+    size_t tail = FEED_LOAD(feed->tail);
+    while (tail == FEED_LOAD(feed->head)) {
+        if (FEED_LOAD(feed->finished)) {
+            if (tail == FEED_LOAD(feed->head))
+                return read_next_irq(NULL); // No more IRQ events
+            continue;
+        }
+#if SIM_ASYNC_INPUT
+        if (feed->reader_running) {
+            pthread_mutex_lock(&feed->mutex);
+            while (tail == FEED_LOAD(feed->head) && !FEED_LOAD(feed->finished))
+                pthread_cond_wait(&feed->wakeup, &feed->mutex);
+            pthread_mutex_unlock(&feed->mutex);
+            continue;
+        }
+#endif
+        irq2_feed_advance(feed);
+    }
+
+    int cycle = feed->cycles[tail & (IRQ2_FEED_EVENTS - 1)];
+    feed->consumed_offset = feed->line_ends[tail & (IRQ2_FEED_EVENTS - 1)];
+    FEED_STORE(feed->tail, tail + 1);
+#if SIM_ASYNC_INPUT
+    // A reader waiting on a full ring is woken once half of it is free again
+    if (feed->reader_running && FEED_LOAD(feed->head) - (tail + 1) == IRQ2_FEED_EVENTS / 2) {
+        pthread_mutex_lock(&feed->mutex);
+        pthread_cond_broadcast(&feed->wakeup);
+        pthread_mutex_unlock(&feed->mutex);
+    }
+#endif
+    return cycle;
+}
+
+/*
+ * next_irq2_event:
+ * -----------------
+ * Returns the clock cycle of the next IRQ2 event from the IRQ2 feed (-1 = none; simp
+ * machines have no IRQ2 file and raise IRQ2 through simp_raise_irq2 instead).
+ */
+int next_irq2_event() {
+    if (!machine->irq2_feed)
+        return -1;
+    return irq2_feed_next(machine->irq2_feed);
+}
+
+/*
+ * write_monitor_data:
+ * --------------------
+ * Writes the entire monitor buffer to two output files:
+ *   1. yuv_file: in raw binary (each byte is a pixel), with a single fwrite
+ *   2. text_file: in hex form, but only up to the highest non-zero pixel index.
+ * A pixel counts as non-zero if the full 32-bit monitordata written to it was
+ * (monitor_nonzero); only the rows of the dirty rectangle are searched for it.
+ */
+void write_monitor_data(FILE *text_file, FILE *yuv_file) {
+    int max = 0;
+
+    // Find the highest non-zero index, from the bottom of the dirty rectangle up
+    for (int row = machine->monitor_dirty_bottom; row >= machine->monitor_dirty_top && max == 0; row--) {
+        for (int word = (row + 1) * MONITOR_DIM / 64 - 1; word >= row * MONITOR_DIM / 64; word--) {
+            if (machine->monitor_nonzero[word]) {
+                int bit = 63;
+                while (!(machine->monitor_nonzero[word] >> bit & 1))
+                    bit--;
+                max = word * 64 + bit;
+                break;
+            }
+        }
+    }
+
+    // Write raw pixel data to YUV file
+    fwrite(machine->monitor_buffer, sizeof(uint8_t), MONITOR_SIZE, yuv_file);
+
+    // Write hex pixel values to text file up to 'max' index
+    if (max != 0) {
+        char *text = malloc(3 * (size_t)(max + 1));
+        if (!text) {
+            perror("Error writing monitor output");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < max + 1; i++) {
+            text[3 * i] = hex_digits_upper[machine->monitor_buffer[i] >> 4];
+            text[3 * i + 1] = hex_digits_upper[machine->monitor_buffer[i] & 0xF];
+            text[3 * i + 2] = '\n';
+        }
+        fwrite(text, 1, 3 * (size_t)(max + 1), text_file);
+        free(text);
+    }
+}
+
+/*
+ * read_input_stream:
+ * -------------------
+ * Reads 'file' up to its end into a heap buffer and sets '*size' (for inputs that
+ * cannot be mapped: pipes, FIFOs, stdin). Exits if reading fails.
+ */
+char *read_input_stream(FILE *file, size_t *size) {
+    size_t capacity = 64 * 1024;
+    char *data = malloc(capacity);
+    *size = 0;
+    for (;;) {
+        if (!data) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        *size += fread(data + *size, 1, capacity - *size, file);
+        if (*size < capacity)
+            break;
+        capacity *= 2;
+        data = realloc(data, capacity);
+    }
+    if (ferror(file)) {
+        perror("Error reading memory input file");
+        exit(EXIT_FAILURE);
+    }
+    return data;
+}
+
+/*
+ * map_input_file / unmap_input_file:
+ * -----------------------------------
+ * Makes the whole of 'filename' readable in memory and sets '*size'. A regular file
+ * is mmap'd on POSIX hosts ('*mapped' = true); anything else ("-" = stdin, a pipe
+ * or a FIFO, or any file elsewhere) is read into a heap copy. Exits if the file
+ * cannot be opened.
+ */
+const char *map_input_file(const char *filename, size_t *size, bool *mapped) {
+    bool standard_input = strcmp(filename, "-") == 0;
+    *mapped = false;
+#if SIM_MMAP_INPUT
+    int fd = standard_input ? STDIN_FILENO : open(filename, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror("Error opening memory input file");
+        exit(EXIT_FAILURE);
+    }
+    if (S_ISREG(info.st_mode)) {
+        *size = (size_t)info.st_size;
+        const char *data = NULL;
+        if (*size) {
+            data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                perror("Error mapping memory input file");
+                exit(EXIT_FAILURE);
+            }
+            *mapped = true;
+        }
+        if (!standard_input)
+            close(fd);
+        return data;
+    }
+    FILE *file = standard_input ? stdin : fdopen(fd, "rb");
+#else
+    FILE *file = standard_input ? stdin : fopen(filename, "rb");
+#endif
+    if (!file) {
+        perror("Error opening memory input file");
+        exit(EXIT_FAILURE);
+    }
+    char *data = read_input_stream(file, size);
+    if (!standard_input)
+        fclose(file);
+    return data;
+}
+
+void unmap_input_file(const char *data, size_t size, bool mapped) {
+#if SIM_MMAP_INPUT
+    if (mapped) {
+        munmap((void *)data, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)mapped;
+    free((void *)data);
+}
+
+/*
+ * parse_hex8:
+ * ------------
+ * SWAR parse of 8 hex digits at 'text' (one 64-bit load, no per-character branches).
+ * Returns false if any of the 8 characters is not a hex digit.
+ */
+static inline bool parse_hex8(const char *text, uint32_t *value) {
+    const uint64_t ones = 0x0101010101010101ULL, high = 0x8080808080808080ULL;
+    uint64_t v;
+    memcpy(&v, text, 8); // Little-endian: the first digit is the lowest byte
+
+    // Per byte: '0'..'9' or (after folding case) 'a'..'f', all below 0x80
+    uint64_t lower = v | (0x20 * ones);
+    uint64_t digit = (v + (0x80 - '0') * ones) & ~(v + (0x80 - '9' - 1) * ones);
+    uint64_t letter = (lower + (0x80 - 'a') * ones) & ~(lower + (0x80 - 'f' - 1) * ones);
+    if ((((digit | letter) & high) != high) | ((v & high) != 0))
+        return false;
+
+    // Nibble values, then pack pairs of digits, pairs of bytes and pairs of halves
+    v = (v & (0x0F * ones)) + ((letter & high) >> 7) * 9;
+    v = ((v << 4) | (v >> 8)) & 0x00FF00FF00FF00FFULL;
+    v = ((v << 8) | (v >> 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v << 16) | (v >> 32);
+    *value = (uint32_t)v;
+    return true;
+}
+
+/*
+ * next_hex_line:
+ * ---------------
+ * Parses the next line of a mapped memory image, exactly like the former
+ * fgets(line, 256) + sscanf("%llx" / "%x") loop: a "line" ends after '\n' or at 255
+ * characters, and a line without a number (blank, garbage) leaves '*value' as it was.
+ * Lines of exactly 'hex_digits' (8 or 12) hex digits take the SWAR path; anything
+ * else (CRLF is fine, but signs, "0x", leading spaces or other widths) goes through sscanf.
+ * Returns false at the end of the data.
+ */
+static inline bool next_hex_line(const char **cursor, const char *end, int hex_digits, bool wide, uint64_t *value) {
+    const char *line = *cursor;
+    if (line == end)
+        return false;
+
+    size_t available = (size_t)(end - line);
+    size_t limit = available < 255 ? available : 255;
+    const char *newline = memchr(line, '\n', limit);
+    size_t length = newline ? (size_t)(newline - line) + 1 : limit;
+    *cursor = line + length;
+
+    // Fast path: the digits are followed by a non-digit inside this line
+    if (length > (size_t)hex_digits) {
+        uint32_t high_part, low_part;
+        char next = line[hex_digits];
+        bool next_is_digit = (next >= '0' && next <= '9') || ((next | 0x20) >= 'a' && (next | 0x20) <= 'f');
+        if (!next_is_digit && hex_digits == 8 && parse_hex8(line, &low_part)) {
+            *value = low_part;
+            return true;
+        }
+        if (!next_is_digit && hex_digits == 12 && parse_hex8(line, &high_part) && parse_hex8(line + 4, &low_part)) {
+            *value = ((uint64_t)high_part << 16) | (low_part & 0xFFFF);
+            return true;
+        }
+    }
+
+    char text[256];
+    memcpy(text, line, length);
+    text[length] = '\0';
+    if (wide) {
+        unsigned long long parsed;
+        if (sscanf(text, "%llx", &parsed) == 1)
+            *value = parsed;
+    }
+    else {
+        unsigned int parsed;
+        if (sscanf(text, "%x", &parsed) == 1)
+            *value = parsed;
+    }
+    return true;
+}
+
+/*
+ * parse_memory / parse_memory32:
+ * -------------------------------
+ * Fill 'memory' (size mem_size) from the 'size' bytes of text at 'data', one word
+ * per line: 64-bit instruction words of 'hex_width' hex digits, or 32-bit data
+ * values of 8 (see next_hex_line). Words past the end of the text are not touched.
+ * parse_memory32 returns the number of words it filled.
+ */
+void parse_memory(const char *data, size_t size, uint64_t *memory, size_t mem_size, int hex_width) {
+    const char *cursor = data, *end = data + size;
+    size_t addr = 0;
+    uint64_t value = 0;
+
+    // Read lines until either memory is full or we reach EOF
+    while (addr < mem_size && next_hex_line(&cursor, end, hex_width, true, &value))
+        memory[addr++] = value;
+}
+
+size_t parse_memory32(const char *data, size_t size, uint32_t *memory, size_t mem_size) {
+    const char *cursor = data, *end = data + size;
+    size_t addr = 0;
+    uint64_t value = 0;
+
+    while (addr < mem_size && next_hex_line(&cursor, end, 8, false, &value))
+        memory[addr++] = (uint32_t)value;
+    return addr;
+}
+
+/*
+ * load_memory:
+ * -------------
+ * Loads 64-bit instruction words from a file into 'memory' (size mem_size).
+ * Reads each line as a hex string of 'hex_width' digits (see next_hex_line).
+ */
+void load_memory(const char *filename, uint64_t *memory, size_t mem_size, int hex_width) {
+    size_t size;
+    bool mapped;
+    const char *data = map_input_file(filename, &size, &mapped);
+    parse_memory(data, size, memory, mem_size, hex_width);
+    unmap_input_file(data, size, mapped);
+}
+
+/*
+ * load_memory32:
+ * ---------------
+ * Similar to 'load_memory' but for 32-bit data values (8 hex digits per line).
+ * Returns the number of words read.
+ */
+size_t load_memory32(const char *filename, uint32_t *memory, size_t mem_size) {
+    size_t size;
+    bool mapped;
+    const char *data = map_input_file(filename, &size, &mapped);
+    size_t words = parse_memory32(data, size, memory, mem_size);
+    unmap_input_file(data, size, mapped);
+    return words;
+}
+
+/*
+ * save_memory:
+ * -------------
+ * Saves 32-bit memory array ('memory') to a file.
+ * It first finds the highest nonzero index to optimize output.
+ */
+void save_memory(const char *filename, uint32_t *memory, size_t mem_size) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        perror("Error opening memory output file");
+        exit(EXIT_FAILURE);
+    }
+    size_t max = 0;
+
+    // Find the highest nonzero word
+    for (size_t i = 0; i < mem_size; i++) {
+        if (memory[i] != 0) {
+            max = i;
+        }
+    }
+
+    // Write values up to that index
+    if (max != 0) {
+        for (size_t i = 0; i < max + 1; i++) {
+            fprintf(file, "%08X\n", memory[i]);
+        }
+    }
+
+    fclose(file);
+}
+
+/*
+ * update_timer:
+ * --------------
+ * Increments the timer if TIMER_ENABLE is set and compares TIMER_CURRENT with TIMER_MAX.
+ * If they match, it resets TIMER_CURRENT and triggers IRQ0_STATUS.
+ */
+void update_timer(uint32_t *io_registers) {
+    if (io_registers[TIMER_ENABLE]) {
+        if (io_registers[TIMER_CURRENT] == io_registers[TIMER_MAX]) {
+            io_registers[TIMER_CURRENT] = 0;
+            io_registers[IRQ0_STATUS] = 1; // Trigger timer interrupt
+        }
+        else {
+            io_registers[TIMER_CURRENT]++;
+        }
+    }
+}
+
+/*
+ * disk_transfer_in_bounds:
+ * -------------------------
+ * Returns 1 if all sector_size + 1 words of the current transfer lie inside
+ * data_memory and disk_memory, so they can be copied as one block. Out-of-range
+ * transfers (e.g. a negative sector) go word by word through
+ * transfer_disk_words_in_range, which drops the words that fall outside.
+ */
+static inline int disk_transfer_in_bounds() {
+    int buffer_address = machine->io_registers[DISK_BUFFER];
+    int sector_number = machine->io_registers[DISK_SECTOR];
+    return buffer_address >= 0 && (uint32_t)buffer_address + machine->sector_size < machine->data_memory_size
+        && sector_number >= 0 && (uint32_t)sector_number < machine->disk_sector_count - 1;
+}
+
+/*
+ * mark_disk_dirty:
+ * -----------------
+ * Records that the 'words' disk words from 'address' on were written, so the
+ * sectors holding them go back to the --disk-image (see flush_disk_image).
+ */
+static inline void mark_disk_dirty(uint64_t address, uint64_t words) {
+    if (!machine->disk_dirty || words == 0)
+        return;
+    for (uint64_t sector = address / machine->sector_size; sector <= (address + words - 1) / machine->sector_size; sector++)
+        machine->disk_dirty[sector] = 1;
+}
+
+/*
+ * transfer_disk_words_in_range:
+ * ------------------------------
+ * Moves the 'words' words of an out-of-range transfer. Words whose data memory or
+ * disk address falls outside its array are dropped.
+ */
+void transfer_disk_words_in_range(int64_t buffer_address, int64_t disk_address, int words) {
+    for (int i = 0; i < words; i++) {
+        if (buffer_address + i < 0 || buffer_address + i >= machine->data_memory_size
+            || disk_address + i < 0 || disk_address + i >= machine->disk_size)
+            continue;
+        if (machine->io_registers[DISK_CMD] == 1)
+            machine->data_memory[buffer_address + i] = machine->disk_memory[disk_address + i];
+        else {
+            machine->disk_memory[disk_address + i] = machine->data_memory[buffer_address + i];
+            mark_disk_dirty((uint64_t)(disk_address + i), 1);
+        }
+    }
+}
+
+/*
+ * transfer_due_disk_words:
+ * -------------------------
+ * Lazy DMA. A read (DISK_CMD == 1) or write (DISK_CMD == 2) moves the word at
+ * disk_index in every cycle whose disk_cycle_counter is a multiple of 8. Rather than
+ * once every 8 cycles, those words are copied here with a single memcpy for all
+ * counter values from disk_transfer_counter up to (not including) 'counter'.
+ * DISK_CMD, DISK_BUFFER and DISK_SECTOR only change through OUT, which brings the
+ * transfer up to date first, so they are the same for the whole span.
+ */
+void transfer_due_disk_words(int counter) {
+    int words = (counter + DISK_WORD_CYCLES - 1) / DISK_WORD_CYCLES
+              - (machine->disk_transfer_counter + DISK_WORD_CYCLES - 1) / DISK_WORD_CYCLES;
+    machine->disk_transfer_counter = counter;
+    if (words <= 0)
+        return;
+
+    int buffer_address = machine->io_registers[DISK_BUFFER];  // Memory address for transfer
+    int sector_number = machine->io_registers[DISK_SECTOR];   // Sector index on the disk
+    if (machine->io_registers[DISK_CMD] != 1 && machine->io_registers[DISK_CMD] != 2)
+        return;
+    if (!disk_transfer_in_bounds())
+        transfer_disk_words_in_range((int64_t)buffer_address + machine->disk_index,
+                                     (int64_t)sector_number * machine->sector_size + machine->disk_index, words);
+    else {
+        int disk_address = sector_number * (int)machine->sector_size + machine->disk_index;
+        if (machine->io_registers[DISK_CMD] == 1)
+            memcpy(&machine->data_memory[buffer_address + machine->disk_index], &machine->disk_memory[disk_address], words * sizeof(uint32_t));
+        else {
+            memcpy(&machine->disk_memory[disk_address], &machine->data_memory[buffer_address + machine->disk_index], words * sizeof(uint32_t));
+            mark_disk_dirty((uint64_t)disk_address, (uint64_t)words);
+        }
+    }
+    machine->disk_index += words;
+}
+
+/*
+ * disk_transfer_pending:
+ * -----------------------
+ * Returns 1 if a running read/write still has to move the word at data memory 'address'.
+ */
+static inline int disk_transfer_pending(uint32_t address) {
+    uint32_t offset = address - machine->io_registers[DISK_BUFFER];
+    return machine->io_registers[DISK_CMD] - 1u < 2u && offset >= (uint32_t)machine->disk_index && offset <= machine->sector_size;
+}
+
+/*
+ * sync_disk_transfer:
+ * --------------------
+ * Called before lw/sw access data memory 'address'. If a running transfer still
+ * covers it, the words due before the current cycle are copied first, so the access
+ * sees (and is seen by) the DMA exactly as with a word moved every 8 cycles.
+ */
+static inline void sync_disk_transfer(uint32_t address) {
+    if (disk_transfer_pending(address))
+        transfer_due_disk_words(machine->disk_cycle_counter + (int)(machine->simulated_cycles - machine->peripherals_synced_cycle));
+}
+
+/*
+ * handle_disk_operations:
+ * ------------------------
+ * Manages disk read/write operations (based on DISK_CMD).
+ * Disk operations proceed in cycles, each 8 clock cycles transferring one word.
+ * After disk_transfer_cycles (1024 with the default 128-word sectors), the
+ * operation is complete. A word whose data memory or disk address is out of
+ * range (e.g. sector -1, or a buffer near the end of memory) is dropped, whatever
+ * the storage: embedded arrays, heap arrays or a --disk-image.
+ */
+void handle_disk_operations() {
+    // If there's a disk command and we're starting a new operation (disk_cycle_counter == 0)
+    if (machine->io_registers[DISK_CMD] != 0 && machine->disk_cycle_counter == 0) {
+        machine->io_registers[DISK_STATUS] = 1; // Disk is busy
+        machine->disk_index = 0;
+        machine->disk_transfer_counter = 0;
+        machine->metrics.disk_start_cycle = machine->simulated_cycles;
+        machine->metrics.disk_sectors_read += machine->io_registers[DISK_CMD] == 1;
+        machine->metrics.disk_sectors_written += machine->io_registers[DISK_CMD] == 2;
+    }
+
+    // READ (DISK_CMD == 1) / WRITE (DISK_CMD == 2) move 1 word every 8 cycles,
+    // applied lazily: this copies the words due up to and including this cycle
+    if (machine->io_registers[DISK_CMD] != 0)
+        transfer_due_disk_words(machine->disk_cycle_counter + 1);
+
+    // After disk_transfer_cycles (sector_size words * 8 cycles/word), finish operation
+    if (machine->disk_cycle_counter == machine->disk_transfer_cycles) {
+        machine->disk_cycle_counter = 0;
+        machine->disk_index = 0;
+        machine->disk_transfer_counter = 0;
+        machine->io_registers[DISK_CMD] = 0;     // Reset the disk command
+        machine->io_registers[DISK_STATUS] = 0;  // Disk is now free
+        machine->io_registers[IRQ1_STATUS] = 1;  // Trigger IRQ1 (disk operation complete)
+        machine->metrics.disk_busy_cycles += machine->simulated_cycles - machine->metrics.disk_start_cycle;
+    }
+
+    // If a disk command is ongoing, increment the cycle counter
+    if (machine->io_registers[DISK_CMD] != 0) {
+        machine->disk_cycle_counter++;
+    }
+}
+
+/*
+ * handle_timer_operations:
+ * -------------------------
+ * Similar to update_timer, increments TIMER_CURRENT if enabled
+ * and triggers IRQ0_STATUS if we hit TIMER_MAX.
+ * (This appears to be a duplicate approach; see update_timer above.)
+ */
+void handle_timer_operations() {
+    if (machine->io_registers[TIMER_ENABLE] == 1) {
+        if (machine->io_registers[TIMER_CURRENT] == machine->io_registers[TIMER_MAX]) {
+            machine->io_registers[TIMER_CURRENT] = 0;
+            machine->io_registers[IRQ0_STATUS] = 1;
+        }
+        else {
+            machine->io_registers[TIMER_CURRENT]++;
+        }
+    }
+}
+
+/*
+ * handle_led_and_display_operations:
+ * -----------------------------------
+ * For OUT instruction (opcode == 20), checks if the target I/O register is LEDs or DISPLAY_7SEG
+ * and logs it into respective output files (and callbacks).
+ */
+void handle_led_and_display_operations(int opcode, const uint8_t *registers_used) {
+    if (opcode == 20) { // OUT instruction
+        int io_register_index = machine->cpu_registers[registers_used[1]] + machine->cpu_registers[registers_used[2]];
+        machine->metrics.led_updates += io_register_index == LEDS;
+        machine->metrics.display7seg_updates += io_register_index == DISPLAY_7SEG;
+        if (io_register_index == LEDS && machine->callbacks.leds)
+            machine->callbacks.leds(machine->callbacks.context, machine->io_registers[CLOCK_CYCLE], machine->io_registers[LEDS]);
+        if (io_register_index == DISPLAY_7SEG && machine->callbacks.display7seg)
+            machine->callbacks.display7seg(machine->callbacks.context, machine->io_registers[CLOCK_CYCLE], machine->io_registers[DISPLAY_7SEG]);
+        if (!machine->writes_files)
+            return;
+
+        if (io_register_index == LEDS) {
+            // Log LED change ("%d %08x")
+            char *record = output_sink_reserve(&machine->led_sink);
+            char *out = format_decimal(record, (int32_t)machine->io_registers[CLOCK_CYCLE]);
+            *out++ = ' ';
+            out = format_hex32(out, machine->io_registers[LEDS], hex_digits_lower);
+            *out++ = '\n';
+            output_sink_commit(&machine->led_sink, record, (size_t)(out - record));
+        }
+        else if (io_register_index == DISPLAY_7SEG) {
+            // Log 7-segment display change ("%d %08X")
+            char *record = output_sink_reserve(&machine->seven_segment_sink);
+            char *out = format_decimal(record, (int32_t)machine->io_registers[CLOCK_CYCLE]);
+            *out++ = ' ';
+            out = format_hex32(out, machine->io_registers[DISPLAY_7SEG], hex_digits_upper);
+            *out++ = '\n';
+            output_sink_commit(&machine->seven_segment_sink, record, (size_t)(out - record));
+        }
+    }
+}
+
+/*
+ * handle_monitor_operations:
+ * ---------------------------
+ * If monitorcmd is set to 1, writes a pixel to 'monitor_buffer' at address = monitoraddr
+ * with value = monitordata (its low 8 bits; addresses past the screen are ignored),
+ * and updates the non-zero bitmap and the dirty rectangle.
+ */
+void handle_monitor_operations() {
+    uint32_t address = machine->io_registers[MONITOR_ADDR];
+    if (machine->io_registers[MONITOR_CMD] == 1 && address < MONITOR_SIZE) {
+        uint64_t bit = 1ULL << (address % 64);
+        machine->monitor_buffer[address] = (uint8_t)machine->io_registers[MONITOR_DATA];
+        machine->metrics.monitor_pixel_writes++;
+        if (machine->io_registers[MONITOR_DATA] != 0)
+            machine->monitor_nonzero[address / 64] |= bit;
+        else
+            machine->monitor_nonzero[address / 64] &= ~bit;
+
+        // Grow the dirty rectangle to cover this pixel
+        int row = (int)(address / MONITOR_DIM), column = (int)(address % MONITOR_DIM);
+        if (row < machine->monitor_dirty_top) machine->monitor_dirty_top = row;
+        if (row > machine->monitor_dirty_bottom) machine->monitor_dirty_bottom = row;
+        if (column < machine->monitor_dirty_left) machine->monitor_dirty_left = column;
+        if (column > machine->monitor_dirty_right) machine->monitor_dirty_right = column;
+    }
+}
+
+/*
+ * log_hw_register_access:
+ * ------------------------
+ * Writes one hwregtrace line ("%d READ|WRITE %s %08x") for an access to
+ * 'io_register_index' at clock cycle 'clock', and passes it to the io_access callback.
+ * An out-of-range index (the in/out was reported and did nothing) is not logged.
+ */
+void log_hw_register_access(uint32_t clock, const char *access, uint32_t io_register_index) {
+    if (io_register_index >= NUM_IO_REGS)
+        return;
+    if (machine->callbacks.io_access)
+        machine->callbacks.io_access(machine->callbacks.context, clock, access[0] == 'W', io_register_index,
+                                     machine->io_registers[io_register_index]);
+    if (!machine->writes_files)
+        return;
+
+    char *record = output_sink_reserve(&machine->hw_register_trace_sink);
+    char *out = format_decimal(record, (int32_t)clock);
+    *out++ = ' ';
+    while (*access)
+        *out++ = *access++;
+    *out++ = ' ';
+    for (const char *name = io_register_names[io_register_index]; *name; name++)
+        *out++ = *name;
+    *out++ = ' ';
+    out = format_hex32(out, machine->io_registers[io_register_index], hex_digits_lower);
+    *out++ = '\n';
+    output_sink_commit(&machine->hw_register_trace_sink, record, (size_t)(out - record));
 }
 
 /*
  * log_hw_register_operations:
  * ----------------------------
- * Logs every IN or OUT instruction to the hw_register_trace_file,
+ * Logs every IN or OUT instruction to the hwregtrace sink,
  * showing clock cycle, read/write type, register name, and the data.
  */
-void log_hw_register_operations(int opcode, int *registers_used) {
-    if (opcode == 19) { // IN instruction
-        int io_register_index = cpu_registers[registers_used[1]] + cpu_registers[registers_used[2]];
-        fprintf(hw_register_trace_file, "%d READ %s %08x\n", io_registers[CLOCK_CYCLE],
-                io_register_names[io_register_index], io_registers[io_register_index]);
+void log_hw_register_operations(int opcode, const uint8_t *registers_used) {
+    if (opcode == 19) { // IN instruction
+        uint32_t io_register_index = machine->cpu_registers[registers_used[1]] + machine->cpu_registers[registers_used[2]];
+        log_hw_register_access(machine->io_registers[CLOCK_CYCLE], "READ", io_register_index);
+    }
+    else if (opcode == 20) { // OUT instruction
+        uint32_t io_register_index = machine->cpu_registers[registers_used[1]] + machine->cpu_registers[registers_used[2]];
+        log_hw_register_access(machine->io_registers[CLOCK_CYCLE], "WRITE", io_register_index);
+    }
+}
+
+/*
+ * check_interrupts:
+ * ------------------
+ * Returns 1 if any of IRQ0, IRQ1, or IRQ2 is enabled and pending.
+ * Otherwise, returns 0.
+ */
+int check_interrupts() {
+    int irq_pending = 0;
+
+    // Check Timer Interrupt
+    if (machine->io_registers[IRQ0_ENABLE] && machine->io_registers[IRQ0_STATUS]) {
+        irq_pending = 1;
+    }
+    // Check Disk Interrupt
+    if (machine->io_registers[IRQ1_ENABLE] && machine->io_registers[IRQ1_STATUS]) {
+        irq_pending = 1;
+    }
+    // Check External Interrupt
+    if (machine->io_registers[IRQ2_ENABLE] && machine->io_registers[IRQ2_STATUS]) {
+        irq_pending = 1;
+    }
+
+    return irq_pending;
+}
+
+/*
+ * handle_io_peripherals:
+ * -----------------------
+ * Peripheral work that only an IN or OUT instruction can trigger: LED / 7-segment
+ * logging, monitor writes (monitorcmd is only ever set by OUT) and HW register traces.
+ */
+void handle_io_peripherals(int opcode, const uint8_t *registers_used) {
+    handle_led_and_display_operations(opcode, registers_used);
+    handle_monitor_operations();
+    log_hw_register_operations(opcode, registers_used);
+}
+
+/*
+ * sync_peripherals:
+ * ------------------
+ * Brings the lazily evaluated timer and disk state up to the start of the current
+ * cycle. schedule_events guarantees that none of the skipped cycles was one in which
+ * their per-cycle handlers would do more than count: the timer only ticked
+ * (no TIMER_MAX hit) and a running disk only advanced disk_cycle_counter.
+ */
+void sync_peripherals() {
+    uint64_t skipped = machine->simulated_cycles - machine->peripherals_synced_cycle;
+
+    if (skipped) {
+        // handle_timer_operations ticks when enable == 1, update_timer for any non-zero enable
+        uint32_t ticks_per_cycle = (machine->io_registers[TIMER_ENABLE] == 1) + (machine->io_registers[TIMER_ENABLE] != 0);
+        machine->io_registers[TIMER_CURRENT] += (uint32_t)(ticks_per_cycle * skipped);
+
+        // handle_disk_operations counts cycles while a command is set
+        if (machine->io_registers[DISK_CMD] != 0)
+            machine->disk_cycle_counter += (int)skipped;
+
+        // and moves the words that fell due in the meantime
+        transfer_due_disk_words(machine->disk_cycle_counter);
+    }
+    machine->peripherals_synced_cycle = machine->simulated_cycles;
+}
+
+/*
+ * schedule_events:
+ * -----------------
+ * Rebuilds the event queue from the current peripheral state (valid at the start of
+ * cycle 'simulated_cycles'). For each source it computes the next cycle in which its
+ * per-cycle handler does something beyond counting:
+ *   - IRQ2:  CLOCK_CYCLE reaches irq2_next_cycle
+ *   - timer: a tick (two per cycle when enable == 1, one otherwise) finds TIMER_CURRENT == TIMER_MAX
+ *   - checkpoint / stop / metrics: the --checkpoint-at cycle, the simp_run_cycles limit
+ *            and the next --metrics-interval export
+ *   - disk:  a command starts or the operation completes (disk_cycle_counter == disk_transfer_cycles);
+ *            words move lazily (transfer_due_disk_words)
+ * Cycles in between are skipped entirely; sync_peripherals catches up on them.
+ */
+void schedule_events() {
+    uint64_t now = machine->simulated_cycles;
+
+    // IRQ2 is compared against the 32-bit clock, so it wraps like the clock does
+    machine->event_cycle[EVENT_IRQ2] = now + (uint32_t)((uint32_t)machine->irq2_next_cycle - machine->io_registers[CLOCK_CYCLE]);
+
+    uint32_t ticks_per_cycle = (machine->io_registers[TIMER_ENABLE] == 1) + (machine->io_registers[TIMER_ENABLE] != 0);
+    if (ticks_per_cycle) {
+        uint32_t ticks_until_expiry = machine->io_registers[TIMER_MAX] - machine->io_registers[TIMER_CURRENT];
+        machine->event_cycle[EVENT_TIMER] = now + ticks_until_expiry / ticks_per_cycle;
+    }
+    else
+        machine->event_cycle[EVENT_TIMER] = NO_EVENT;
+
+    int disk_command = machine->io_registers[DISK_CMD];
+    if (machine->disk_cycle_counter == machine->disk_transfer_cycles || (disk_command != 0 && machine->disk_cycle_counter == 0))
+        machine->event_cycle[EVENT_DISK] = now;                       // Completion or start
+    else if (disk_command != 0)
+        machine->event_cycle[EVENT_DISK] = now + (machine->disk_transfer_cycles - machine->disk_cycle_counter); // Completion (words move lazily)
+    else
+        machine->event_cycle[EVENT_DISK] = NO_EVENT;
+
+    // A checkpoint is taken at the start of its cycle, with every lazy state synced
+    machine->event_cycle[EVENT_CHECKPOINT] = machine->checkpoint_cycle >= now ? machine->checkpoint_cycle : NO_EVENT;
+    machine->event_cycle[EVENT_STOP] = machine->stop_cycle >= now ? machine->stop_cycle : NO_EVENT;
+    machine->event_cycle[EVENT_METRICS] = machine->metrics_cycle >= now ? machine->metrics_cycle : NO_EVENT;
+
+    machine->next_event_cycle = NO_EVENT;
+    for (int i = 0; i < NUM_EVENT_SOURCES; i++)
+        if (machine->event_cycle[i] < machine->next_event_cycle)
+            machine->next_event_cycle = machine->event_cycle[i];
+}
+
+/*
+ * force_event_cycle:
+ * -------------------
+ * Makes the current cycle an event cycle: timer and disk are synced now and their
+ * per-cycle handlers run for this cycle. Used before IN/OUT, which read or
+ * reconfigure peripheral registers; the queue is rebuilt at the end of the cycle.
+ */
+void force_event_cycle() {
+    sync_peripherals();
+    if (machine->next_event_cycle != machine->simulated_cycles)
+        machine->forced_event_cycle = machine->simulated_cycles;
+    machine->next_event_cycle = machine->simulated_cycles;
+}
+
+/*
+ * cycles_until_next_event:
+ * -------------------------
+ * Number of upcoming cycles (starting with the current one) in which no peripheral
+ * needs to be evaluated. Faster engines may batch that many instructions.
+ */
+uint64_t cycles_until_next_event() {
+    return machine->next_event_cycle - machine->simulated_cycles;
+}
+
+/*
+ * check_and_handle_interrupts:
+ * -----------------------------
+ * If an interrupt is pending and we are not in an ISR, jump to the IRQ_HANDLER
+ * and set isr_active_flag.
+ */
+void check_and_handle_interrupts(uint32_t *pc) {
+    int interrupt_pending = (machine->io_registers[IRQ0_ENABLE] && machine->io_registers[IRQ0_STATUS]) ||
+                            (machine->io_registers[IRQ1_ENABLE] && machine->io_registers[IRQ1_STATUS]) ||
+                            (machine->io_registers[IRQ2_ENABLE] && machine->io_registers[IRQ2_STATUS]);
+
+    // If there's a pending interrupt and we're not already servicing one
+    if (interrupt_pending && !machine->isr_active_flag) {
+        machine->io_registers[IRQ_RETURN] = *pc;  // Save current PC
+        *pc = machine->io_registers[IRQ_HANDLER]; // Jump to ISR
+        machine->isr_active_flag = 1;             // Set ISR flag
+    }
+}
+
+/*
+ * handle_reti:
+ * -------------
+ * RETI instruction logic: restore PC from IRQ_RETURN and clear ISR flag.
+ */
+void handle_reti(uint32_t *pc) {
+    *pc = machine->io_registers[IRQ_RETURN];
+    machine->isr_active_flag = 0;
+}
+
+/*
+ * clear_serviced_interrupts:
+ * ---------------------------
+ * Clears the status bits of IRQ0, IRQ1, and IRQ2 if they're enabled and active.
+ */
+void clear_serviced_interrupts() {
+    if (machine->io_registers[IRQ0_STATUS] && machine->io_registers[IRQ0_ENABLE]) {
+        machine->io_registers[IRQ0_STATUS] = 0;
+    }
+    if (machine->io_registers[IRQ1_STATUS] && machine->io_registers[IRQ1_ENABLE]) {
+        machine->io_registers[IRQ1_STATUS] = 0;
+    }
+    if (machine->io_registers[IRQ2_STATUS] && machine->io_registers[IRQ2_ENABLE]) {
+        machine->io_registers[IRQ2_STATUS] = 0;
+    }
+}
+
+/*
+ * stop_after_error:
+ * ------------------
+ * Makes a simp machine stop at the end of the cycle after an error was recorded
+ * in machine->error (simp_run_cycles then returns SIMP_RUN_ERROR).
+ */
+void stop_after_error() {
+    machine->stop_cycle = machine->simulated_cycles + 1;
+    if (machine->next_event_cycle > machine->stop_cycle)
+        machine->next_event_cycle = machine->stop_cycle;
+}
+
+/*
+ * report_unknown_opcode:
+ * -----------------------
+ * The command-line simulator exits on an unknown opcode. A simp machine records
+ * the error instead and stops at the end of the cycle.
+ */
+void report_unknown_opcode(int opcode) {
+    if (!machine->embedded) {
+        fprintf(stderr, "Error: Unknown opcode %d\n", opcode);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(machine->error, sizeof(machine->error), "Unknown opcode %d at PC %u", opcode, machine->program_counter);
+    stop_after_error();
+}
+
+/*
+ * report_data_address:
+ * ---------------------
+ * Like report_unknown_opcode, for an lw/sw whose address is outside data memory.
+ */
+void report_data_address(uint32_t address) {
+    if (!machine->embedded) {
+        fprintf(stderr, "Error: Data memory address %u out of range at PC %u\n", address, machine->program_counter);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(machine->error, sizeof(machine->error), "Data memory address %u out of range at PC %u", address, machine->program_counter);
+    stop_after_error();
+}
+
+/*
+ * report_io_register:
+ * --------------------
+ * Like report_unknown_opcode, for an in/out whose I/O register index is out of range.
+ */
+void report_io_register(uint32_t io_register_index) {
+    if (!machine->embedded) {
+        fprintf(stderr, "Error: I/O register %u out of range at PC %u\n", io_register_index, machine->program_counter);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(machine->error, sizeof(machine->error), "I/O register %u out of range at PC %u", io_register_index, machine->program_counter);
+    stop_after_error();
+}
+
+/*
+ * data_address_valid:
+ * --------------------
+ * Returns 1 if lw/sw may access data memory 'address'. Otherwise the error is
+ * reported and the instruction does nothing.
+ */
+static inline int data_address_valid(uint32_t address) {
+    if (address < machine->data_memory_size)
+        return 1;
+    report_data_address(address);
+    return 0;
+}
+
+/*
+ * io_register_valid:
+ * -------------------
+ * Returns 1 if in/out may access I/O register 'io_register_index'. Otherwise the
+ * error is reported and the instruction does nothing.
+ */
+static inline int io_register_valid(uint32_t io_register_index) {
+    if (io_register_index < NUM_IO_REGS)
+        return 1;
+    report_io_register(io_register_index);
+    return 0;
+}
+
+/*
+ * process_instruction:
+ * ---------------------
+ * Main ALU and control logic for each opcode. Modifies cpu_registers or PC as required.
+ * Returns jump_flag=1 if the PC is changed by instruction itself, else 0.
+ */
+int process_instruction(const decoded_instruction *instruction, uint32_t *pc) {
+    const uint8_t *registersUsed = instruction->registers; // rd, rs, rt, rm
+    int jump_flag = 0; // 1 if we do a branch/jump
+    uint32_t address;  // Data memory address of lw/sw, I/O register index of in/out
+
+    switch (instruction->opcode) {
+    case 0: // ADD
+        machine->cpu_registers[registersUsed[0]] = machine->cpu_registers[registersUsed[1]]
+                                          + machine->cpu_registers[registersUsed[2]]
+                                          + machine->cpu_registers[registersUsed[3]];
+        break;
+
+    case 1: // SUB
+        machine->cpu_registers[registersUsed[0]] = machine->cpu_registers[registersUsed[1]]
+                                          - machine->cpu_registers[registersUsed[2]]
+                                          - machine->cpu_registers[registersUsed[3]];
+        break;
+
+    case 2: // MAC
+        machine->cpu_registers[registersUsed[0]] = (machine->cpu_registers[registersUsed[1]]
+                                           * machine->cpu_registers[registersUsed[2]])
+                                          + machine->cpu_registers[registersUsed[3]];
+        break;
+
+    case 3: // AND
+        machine->cpu_registers[registersUsed[0]] = machine->cpu_registers[registersUsed[1]]
+                                          & machine->cpu_registers[registersUsed[2]]
+                                          & machine->cpu_registers[registersUsed[3]];
+        break;
+
+    case 4: // OR
+        machine->cpu_registers[registersUsed[0]] = machine->cpu_registers[registersUsed[1]]
+                                          | machine->cpu_registers[registersUsed[2]]
+                                          | machine->cpu_registers[registersUsed[3]];
+        break;
+
+    case 5: // XOR
+        machine->cpu_registers[registersUsed[0]] = machine->cpu_registers[registersUsed[1]]
+                                          ^ machine->cpu_registers[registersUsed[2]]
+                                          ^ machine->cpu_registers[registersUsed[3]];
+        break;
+
+    case 6: // SLL
+        machine->cpu_registers[registersUsed[0]] = machine->cpu_registers[registersUsed[1]]
+                                          << machine->cpu_registers[registersUsed[2]];
+        break;
+
+    case 7: // SRA
+        machine->cpu_registers[registersUsed[0]] = (int32_t)machine->cpu_registers[registersUsed[1]]
+                                          >> machine->cpu_registers[registersUsed[2]];
+        break;
+
+    case 8: // SRL
+        machine->cpu_registers[registersUsed[0]] = (uint32_t)machine->cpu_registers[registersUsed[1]]
+                                          >> machine->cpu_registers[registersUsed[2]];
+        break;
+
+    case 9: // BEQ
+        if (machine->cpu_registers[registersUsed[1]] == machine->cpu_registers[registersUsed[2]]) {
+            *pc = machine->cpu_registers[registersUsed[3]] & 0xFFF;
+            jump_flag = 1;
+        }
+        break;
+
+    case 10: // BNE
+        if (machine->cpu_registers[registersUsed[1]] != machine->cpu_registers[registersUsed[2]]) {
+            *pc = machine->cpu_registers[registersUsed[3]] & 0xFFF;
+            jump_flag = 1;
+        }
+        break;
+
+    case 11: // BLT
+        if ((int)machine->cpu_registers[registersUsed[1]] < (int)machine->cpu_registers[registersUsed[2]]) {
+            *pc = machine->cpu_registers[registersUsed[3]] & 0xFFF;
+            jump_flag = 1;
+        }
+        break;
+
+    case 12: // BGT
+        if ((int)machine->cpu_registers[registersUsed[1]] > (int)machine->cpu_registers[registersUsed[2]]) {
+            *pc = machine->cpu_registers[registersUsed[3]] & 0xFFF;
+            jump_flag = 1;
+        }
+        break;
+
+    case 13: // BLE
+        if ((int)machine->cpu_registers[registersUsed[1]] <= (int)machine->cpu_registers[registersUsed[2]]) {
+            *pc = machine->cpu_registers[registersUsed[3]] & 0xFFF;
+            jump_flag = 1;
+        }
+        break;
+
+    case 14: // BGE
+        if ((int)machine->cpu_registers[registersUsed[1]] >= (int)machine->cpu_registers[registersUsed[2]]) {
+            *pc = machine->cpu_registers[registersUsed[3]] & 0xFFF;
+            jump_flag = 1;
+        }
+        break;
+
+    case 15: // JAL
+        machine->cpu_registers[registersUsed[0]] = *pc + 1; // Store return address
+        *pc = machine->cpu_registers[registersUsed[3]] & 0xFFF;
+        jump_flag = 1;
+        break;
+
+    case 16: // LW
+        address = machine->cpu_registers[registersUsed[1]] + machine->cpu_registers[registersUsed[2]];
+        if (!data_address_valid(address))
+            break;
+        sync_disk_transfer(address);
+        machine->cpu_registers[registersUsed[0]] = machine->data_memory[address] + machine->cpu_registers[registersUsed[3]];
+        break;
+
+    case 17: // SW
+        address = machine->cpu_registers[registersUsed[1]] + machine->cpu_registers[registersUsed[2]];
+        if (!data_address_valid(address))
+            break;
+        sync_disk_transfer(address);
+        machine->data_memory[address] = machine->cpu_registers[registersUsed[3]] + machine->cpu_registers[registersUsed[0]];
+        break;
+
+    case 18: // RETI
+        *pc = machine->io_registers[IRQ_RETURN]; // Return from ISR
+        break;
+
+    case 19: // IN
+        address = machine->cpu_registers[registersUsed[1]] + machine->cpu_registers[registersUsed[2]];
+        if (!io_register_valid(address))
+            break;
+        if (address == MONITOR_CMD) {
+            // Reading from MONITOR_CMD always returns 0
+            machine->cpu_registers[registersUsed[0]] = 0;
+        }
+        else {
+            machine->cpu_registers[registersUsed[0]] = machine->io_registers[address];
+        }
+        break;
+
+    case 20: // OUT
+        address = machine->cpu_registers[registersUsed[1]] + machine->cpu_registers[registersUsed[2]];
+        if (!io_register_valid(address))
+            break;
+        machine->io_registers[address] = machine->cpu_registers[registersUsed[3]];
+        break;
+
+    case 21: // HALT
+        machine->halt_flag = 1;
+        break;
+
+    default:
+        report_unknown_opcode(instruction->opcode);
+        break;
+    }
+
+    // Make sure register $zero (index 0) is always 0
+    machine->cpu_registers[0] = 0;
+    return jump_flag;
+}
+
+/*
+ * create_storage / destroy_storage:
+ * ----------------------------------
+ * Give a new machine the data memory and disk of the configured geometry: the
+ * embedded arrays for the default sizes, zeroed heap arrays otherwise. The disk of
+ * --disk-image is mapped later, by map_disk_image. create_storage returns false if
+ * memory runs out.
+ */
+bool create_storage(machine_context *context) {
+    context->data_memory_size = configured_data_memory_size;
+    context->disk_sector_count = configured_disk_sectors;
+    context->sector_size = configured_sector_size;
+    context->disk_size = configured_disk_sectors * configured_sector_size;
+    context->disk_transfer_cycles = (int)configured_sector_size * DISK_WORD_CYCLES;
+
+    if (context->data_memory_size == MEM_SIZE)
+        context->data_memory = context->default_data_memory;
+    else
+        context->data_memory = calloc(context->data_memory_size, sizeof(uint32_t));
+    if (disk_image_file_name)
+        context->disk_memory = NULL;
+    else if (context->disk_size == DISK_SIZE)
+        context->disk_memory = context->default_disk_memory;
+    else
+        context->disk_memory = calloc(context->disk_size, sizeof(uint32_t));
+
+    return context->data_memory && (context->disk_memory || disk_image_file_name);
+}
+
+void destroy_storage(machine_context *context) {
+    if (context->data_memory != context->default_data_memory)
+        free(context->data_memory);
+    if (context->disk_dirty) {
+#if SIM_MMAP_INPUT
+        munmap(context->disk_memory, (size_t)context->disk_size * sizeof(uint32_t));
+#else
+        free(context->disk_memory);
+#endif
+        free(context->disk_dirty);
+    }
+    else if (context->disk_memory != context->default_disk_memory)
+        free(context->disk_memory);
+}
+
+/*
+ * map_disk_image:
+ * ----------------
+ * Makes the --disk-image file the machine's disk. The file holds the disk as raw
+ * 32-bit words in host byte order, sector after sector. On POSIX hosts it is mapped
+ * shared: only the sectors the program touches are paged in, and written ones reach
+ * the file through the page cache. Elsewhere it is read into a heap copy. A missing
+ * or empty file is created with the size of the configured geometry and filled from
+ * the diskin text file 'import_file'; an existing image is used as it is. Exits if
+ * the file cannot be used or its size does not match the geometry.
+ */
+void map_disk_image(const char *import_file) {
+    size_t bytes = (size_t)machine->disk_size * sizeof(uint32_t);
+    uint64_t existing_bytes;
+
+    machine->disk_dirty = calloc(machine->disk_sector_count, 1);
+    if (!machine->disk_dirty) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+#if SIM_MMAP_INPUT
+    int fd = open(disk_image_file_name, O_RDWR | O_CREAT, 0644);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror("Error opening disk image");
+        exit(EXIT_FAILURE);
+    }
+    existing_bytes = (uint64_t)info.st_size;
+    if (existing_bytes == 0 && ftruncate(fd, (off_t)bytes) != 0) {
+        perror("Error creating disk image");
+        exit(EXIT_FAILURE);
+    }
+    if (existing_bytes == 0 || existing_bytes == bytes) {
+        void *disk = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (disk == MAP_FAILED) {
+            perror("Error mapping disk image");
+            exit(EXIT_FAILURE);
+        }
+        posix_madvise(disk, bytes, POSIX_MADV_RANDOM); // Sectors are paged in one by one, without read-ahead
+        machine->disk_memory = disk;
+    }
+    close(fd);
+#else
+    machine->disk_memory = calloc(machine->disk_size, sizeof(uint32_t));
+    if (!machine->disk_memory) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    FILE *file = fopen(disk_image_file_name, "rb");
+    existing_bytes = 0;
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        existing_bytes = (uint64_t)ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (existing_bytes == bytes && fread(machine->disk_memory, 1, bytes, file) != bytes) {
+            perror("Error reading disk image");
+            exit(EXIT_FAILURE);
+        }
+        fclose(file);
+    }
+    if (existing_bytes == 0) {
+        // Create the file at its full size; the imported sectors are written back as dirty ones
+        file = fopen(disk_image_file_name, "wb");
+        if (!file || fseek(file, (long)(bytes - 1), SEEK_SET) != 0 || fputc(0, file) == EOF || fclose(file) != 0) {
+            perror("Error creating disk image");
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+    if (existing_bytes != 0 && existing_bytes != bytes) {
+        fprintf(stderr, "Error: Disk image '%s' has %llu bytes, the disk geometry needs %llu\n", disk_image_file_name,
+                (unsigned long long)existing_bytes, (unsigned long long)bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    if (existing_bytes == 0)
+        mark_disk_dirty(0, load_memory32(import_file, machine->disk_memory, machine->disk_size));
+}
+
+/*
+ * flush_disk_image:
+ * ------------------
+ * Writes the dirty sectors of the --disk-image back to the file, one range of
+ * consecutive dirty sectors at a time: msync on POSIX hosts (the mapping already
+ * holds the data), fwrite of the heap copy elsewhere. Returns false if that fails.
+ */
+bool flush_disk_image() {
+    size_t sector_bytes = (size_t)machine->sector_size * sizeof(uint32_t);
+    bool succeeded = true;
+#if SIM_MMAP_INPUT
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+#else
+    FILE *file = fopen(disk_image_file_name, "r+b");
+    if (!file)
+        return false;
+#endif
+
+    for (uint32_t first = 0; first < machine->disk_sector_count;) {
+        if (!machine->disk_dirty[first]) {
+            first++;
+            continue;
+        }
+        uint32_t end = first;
+        while (end < machine->disk_sector_count && machine->disk_dirty[end])
+            machine->disk_dirty[end++] = 0;
+
+        size_t offset = first * sector_bytes, length = (end - first) * sector_bytes;
+#if SIM_MMAP_INPUT
+        size_t page_start = offset - offset % page_size; // msync wants a page-aligned start
+        if (msync((char *)machine->disk_memory + page_start, offset + length - page_start, MS_SYNC) != 0)
+            succeeded = false;
+#else
+#if defined(_WIN32)
+        if (_fseeki64(file, (__int64)offset, SEEK_SET) != 0
+#else
+        if (fseek(file, (long)offset, SEEK_SET) != 0
+#endif
+            || fwrite((char *)machine->disk_memory + offset, 1, length, file) != length)
+            succeeded = false;
+#endif
+        first = end;
+    }
+
+#if !SIM_MMAP_INPUT
+    if (fclose(file) != 0)
+        succeeded = false;
+#endif
+    return succeeded;
+}
+
+/*
+ * load_instruction_image:
+ * ------------------------
+ * Loads an imemin file into a new instruction image and decodes it once, up front.
+ */
+instruction_image *load_instruction_image(const char *filename) {
+    instruction_image *image = calloc(1, sizeof(instruction_image));
+    if (!image) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    load_memory(filename, image->words, MEM_SIZE, 12);
+    predecode_image(image);
+    image->path = filename;
+    return image;
+}
+
+/*
+ * use_instruction_image:
+ * -----------------------
+ * Makes 'image' the machine's instruction memory.
+ */
+void use_instruction_image(instruction_image *image) {
+    machine->image = image;
+    machine->instruction_memory = image->words;
+    machine->decoded_memory = image->decoded;
+    machine->block_length = image->block_length;
+}
+
+/*
+ * load_input_files:
+ * ------------------
+ * Loads instruction memory, data memory, disk memory, and opens the IRQ2 feed.
+ * The instruction memory is only loaded if the machine has no image yet (batch jobs
+ * get a shared one from the image cache). With --disk-image, diskin.txt is only
+ * read when the image is created (see map_disk_image).
+ * argv[]: command-line arguments with file names.
+ * Returns true if successful, false otherwise.
+ */
+bool load_input_files(char *argv[]) {
+    machine->irq2_feed = open_irq2_feed(argv[4]);
+    if (!machine->irq2_feed) {
+        perror("Error opening irq2in file");
+        return false;
+    }
+
+    // Load instruction, data, and disk from specified input files
+    if (!machine->image) {
+        machine->image = load_instruction_image(argv[1]);
+        machine->owns_image = 1;
+    }
+    use_instruction_image(machine->image);
+    load_memory32(argv[2], machine->data_memory, machine->data_memory_size);
+    if (disk_image_file_name)
+        map_disk_image(argv[3]);
+    else
+        load_memory32(argv[3], machine->disk_memory, machine->disk_size);
+
+    return true;
+}
+
+/*
+ * open_output_files:
+ * -------------------
+ * Opens (for writing) all the required output files specified in argv[].
+ * Returns true if all files could be opened, false otherwise.
+ */
+bool open_output_files(char *argv[]) {
+    machine->register_output_file = fopen(argv[6], "w");
+    bool sinks_open = output_sink_open(&machine->trace_sink, argv[7], trace_format == TRACE_FORMAT_BINARY);
+    sinks_open = output_sink_open(&machine->hw_register_trace_sink, argv[8], false) && sinks_open;
+    machine->cycle_count_file = fopen(argv[9], "w");
+    sinks_open = output_sink_open(&machine->led_sink, argv[10], false) && sinks_open;
+    sinks_open = output_sink_open(&machine->seven_segment_sink, argv[11], false) && sinks_open;
+    machine->disk_output_file = fopen(argv[12], "w");
+    machine->monitor_output_file = fopen(argv[13], "w");
+    machine->monitor_yuv_file = fopen(argv[14], "wb");
+
+    // Return whether all are non-NULL
+    if (!sinks_open)
+        return false;
+    machine->writes_files = 1;
+
+    if (trace_format == TRACE_FORMAT_BINARY)
+        write_binary_trace_header();
+
+    // Trace, hwregtrace, leds and display7seg are written in the background
+    start_output_writer();
+
+    return machine->cycle_count_file && machine->disk_output_file && machine->monitor_output_file && machine->monitor_yuv_file;
+}
+
+/*
+ * write_output_files:
+ * --------------------
+ * Writes final states (data memory, disk memory, CPU registers, cycle count, monitor data).
+ * argv[]: command-line arguments for file names.
+ * Returns true if writing is successful.
+ */
+bool write_output_files(char *argv[]) {
+    // Save data memory
+    save_memory(argv[5], machine->data_memory, machine->data_memory_size);
+    // Save disk memory (a --disk-image gets its dirty sectors back instead; diskout.txt
+    // is then left empty unless --disk-export asks for the text copy too)
+    if (machine->disk_dirty && !flush_disk_image()) {
+        perror("Error writing disk image");
+        return false;
+    }
+    if (!machine->disk_dirty || disk_text_export)
+        save_memory(argv[12], machine->disk_memory, machine->disk_size);
+
+    // Write CPU register values (indices 3..15)
+    for (int i = 3; i < NUM_CPU_REGS; i++) {
+        fprintf(machine->register_output_file, "%08X\n", machine->cpu_registers[i]);
+    }
+
+    // Write cycle count to file
+    fprintf(machine->cycle_count_file, "%d\n", machine->io_registers[CLOCK_CYCLE]);
+
+    // Write monitor buffer in both text and YUV formats
+    write_monitor_data(machine->monitor_output_file, machine->monitor_yuv_file);
+
+    return true;
+}
+
+/*
+ * cleanup_files:
+ * ---------------
+ * Closes all file pointers used during the simulation.
+ */
+void cleanup_files() {
+    close_output_sinks();
+    fclose(machine->register_output_file);
+    fclose(machine->cycle_count_file);
+    fclose(machine->disk_output_file);
+    fclose(machine->monitor_output_file);
+    fclose(machine->monitor_yuv_file);
+    close_irq2_feed(machine->irq2_feed);
+    machine->irq2_feed = NULL;
+}
+
+/*
+ * create_profile:
+ * ----------------
+ * Allocates an empty profile whose call tree holds the root frame (the program
+ * entry). Returns NULL if memory runs out.
+ */
+profile_state *create_profile() {
+    profile_state *profile = calloc(1, sizeof(profile_state));
+    if (!profile)
+        return NULL;
+    profile->node_capacity = 64;
+    profile->nodes = malloc((size_t)profile->node_capacity * sizeof(profile_node));
+    if (!profile->nodes) {
+        free(profile);
+        return NULL;
+    }
+
+    profile->nodes[0].parent = -1;
+    profile->nodes[0].label = profile_entry_label(PC_START);
+    profile->nodes[0].address = PC_START;
+    profile->nodes[0].first_child = -1;
+    profile->nodes[0].next_sibling = -1;
+    profile->nodes[0].cycles = 0;
+    profile->node_count = 1;
+    profile->stack[0].return_address = PROFILE_NO_RETURN;
+    profile->stack[0].node = 0;
+    profile->depth = 1;
+    profile->leaf_frame_node = -1;
+    return profile;
+}
+
+/*
+ * create_machine / destroy_machine:
+ * ----------------------------------
+ * Allocate a machine in its power-on state (with the engine, --trace-history ring,
+ * profile, memory and disk geometry and --checkpoint-at cycle of the options), and
+ * free one together with its private instruction image, storage and JIT code buffer. create_machine returns NULL
+ * if memory runs out.
+ */
+void destroy_machine(machine_context *context);
+
+machine_context *create_machine() {
+    machine_context *context = calloc(1, sizeof(machine_context));
+    if (!context)
+        return NULL;
+    if (trace_history_size) {
+        context->trace_history = calloc(trace_history_size, sizeof(trace_record));
+        if (!context->trace_history) {
+            free(context);
+            return NULL;
+        }
+    }
+    if (profile_file_name || profile_folded_file_name) {
+        context->profile = create_profile();
+        if (!context->profile) {
+            free(context->trace_history);
+            free(context);
+            return NULL;
+        }
+    }
+
+    context->monitor_dirty_top = MONITOR_DIM;
+    context->monitor_dirty_bottom = -1;
+    context->monitor_dirty_left = MONITOR_DIM;
+    context->monitor_dirty_right = -1;
+    context->program_counter = PC_START;
+    context->forced_event_cycle = NO_EVENT;
+    context->last_natural_event_cycle = NO_EVENT;
+    context->idle_loop_state = IDLE_WATCHING;
+    context->engine = simulation_engine;
+    context->stop_cycle = NO_EVENT;
+    context->checkpoint_cycle = checkpoint_at_cycle;
+    context->count_instructions = metrics_file_name || metrics_prometheus_file_name;
+    context->metrics_cycle = (context->count_instructions && metrics_interval) ? metrics_interval : NO_EVENT;
+    for (int line = 0; line < NUM_IRQ_LINES; line++)
+        context->metrics.irq_raised_cycle[line] = NO_EVENT;
+    context->trace_started = trace_start_irq == TRACE_NO_TRIGGER && trace_start_io_register == TRACE_NO_TRIGGER;
+
+    context->output_sinks[0] = &context->trace_sink;
+    context->output_sinks[1] = &context->hw_register_trace_sink;
+    context->output_sinks[2] = &context->led_sink;
+    context->output_sinks[3] = &context->seven_segment_sink;
+#if SIM_ASYNC_OUTPUT
+    for (int i = 0; i < NUM_OUTPUT_SINKS; i++)
+        context->output_sinks[i]->fd = -1;
+    pthread_mutex_init(&context->output_writer_mutex, NULL);
+    pthread_cond_init(&context->output_writer_wakeup, NULL);
+#endif
+    if (!create_storage(context)) {
+        destroy_machine(context);
+        return NULL;
+    }
+    return context;
+}
+
+void destroy_machine(machine_context *context) {
+#if SIM_JIT_SUPPORTED
+    if (context->jit_code_buffer)
+        munmap(context->jit_code_buffer, JIT_CODE_SIZE);
+#endif
+#if SIM_ASYNC_OUTPUT
+    pthread_mutex_destroy(&context->output_writer_mutex);
+    pthread_cond_destroy(&context->output_writer_wakeup);
+#endif
+    if (context->owns_image)
+        free(context->image);
+    destroy_storage(context);
+    free(context->trace_history);
+    if (context->profile) {
+        free(context->profile->nodes);
+        free(context->profile);
+    }
+    free(context);
+}
+
+/*
+ * Checkpoint file:
+ * -----------------
+ * A checkpoint_header followed by the raw arrays, in host byte order:
+ * instruction_memory, data_memory, disk_memory, monitor_buffer, monitor_nonzero.
+ * Every part has the size given by the header, so the file is written with a
+ * handful of fwrite calls and restored by mapping it and copying each part into
+ * place. A checkpoint only restores into the same memory and disk geometry.
+ */
+typedef struct {
+    char magic[8];                          // CHECKPOINT_MAGIC
+    uint32_t version;                       // CHECKPOINT_VERSION
+    uint32_t mem_size;                      // Data memory / disk / sector / monitor sizes of the writer
+    uint32_t disk_size;
+    uint32_t sector_size;
+    uint32_t monitor_size;
+    uint64_t simulated_cycles;              // Cycles completed (the checkpoint is at the start of the next)
+    int64_t irq2_file_position;             // Offset of the next unconsumed line of the IRQ2 source
+    uint32_t program_counter;
+    int32_t halt_flag;
+    int32_t isr_active_flag;
+    int32_t irq2_next_cycle;                // Pending IRQ2 event (-1 = none)
+    int32_t disk_cycle_counter;             // Disk DMA progress
+    int32_t disk_index;
+    int32_t disk_transfer_counter;
+    int32_t monitor_dirty[4];               // Dirty rectangle: top, bottom, left, right
+    uint32_t cpu_registers[NUM_CPU_REGS];
+    uint32_t io_registers[NUM_IO_REGS];
+    machine_metrics metrics;                // Runtime counters, including the start cycle of a running
+                                            // disk operation and the raise cycles of pending IRQs
+} checkpoint_header;
+
+#define CHECKPOINT_SIZE (sizeof(checkpoint_header) + sizeof(machine->image->words) + DATA_MEMORY_BYTES + DISK_BYTES \
+                         + sizeof(machine->monitor_buffer) + sizeof(machine->monitor_nonzero))
+#define DATA_MEMORY_BYTES ((size_t)machine->data_memory_size * sizeof(uint32_t))
+#define DISK_BYTES ((size_t)machine->disk_size * sizeof(uint32_t))
+
+/*
+ * write_checkpoint:
+ * ------------------
+ * Saves the machine state at the start of the current cycle to 'filename'.
+ * Called from begin_cycle at the --checkpoint-at cycle, after sync_peripherals, so
+ * the lazily evaluated timer and disk state are up to date.
+ */
+void write_checkpoint(const char *filename) {
+    checkpoint_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.mem_size = machine->data_memory_size;
+    header.disk_size = machine->disk_size;
+    header.sector_size = machine->sector_size;
+    header.monitor_size = MONITOR_SIZE;
+    header.simulated_cycles = machine->simulated_cycles;
+    header.irq2_file_position = (int64_t)machine->irq2_feed->consumed_offset;
+    header.program_counter = machine->program_counter;
+    header.halt_flag = machine->halt_flag;
+    header.isr_active_flag = machine->isr_active_flag;
+    header.irq2_next_cycle = machine->irq2_next_cycle;
+    header.disk_cycle_counter = machine->disk_cycle_counter;
+    header.disk_index = machine->disk_index;
+    header.disk_transfer_counter = machine->disk_transfer_counter;
+    header.monitor_dirty[0] = machine->monitor_dirty_top;
+    header.monitor_dirty[1] = machine->monitor_dirty_bottom;
+    header.monitor_dirty[2] = machine->monitor_dirty_left;
+    header.monitor_dirty[3] = machine->monitor_dirty_right;
+    memcpy(header.cpu_registers, machine->cpu_registers, sizeof(machine->cpu_registers));
+    memcpy(header.io_registers, machine->io_registers, sizeof(machine->io_registers));
+    header.metrics = machine->metrics;
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        perror("Error opening checkpoint file");
+        exit(EXIT_FAILURE);
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(machine->instruction_memory, sizeof(machine->image->words), 1, file);
+    fwrite(machine->data_memory, DATA_MEMORY_BYTES, 1, file);
+    fwrite(machine->disk_memory, DISK_BYTES, 1, file);
+    fwrite(machine->monitor_buffer, sizeof(machine->monitor_buffer), 1, file);
+    fwrite(machine->monitor_nonzero, sizeof(machine->monitor_nonzero), 1, file);
+    if (ferror(file) || fclose(file) != 0) {
+        perror("Error writing checkpoint file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * restore_checkpoint:
+ * --------------------
+ * Replaces the state loaded from the input files with the checkpoint in 'filename'
+ * (including the instruction memory, so imemin/dmemin/diskin are only placeholders)
+ * and skips the lines of the IRQ2 source the checkpointed run had consumed.
+ * The run then continues at the checkpoint's cycle. Exits if the file is not a
+ * checkpoint of this simulator configuration.
+ */
+void restore_checkpoint(const char *filename) {
+    size_t size;
+    bool mapped;
+    const char *data = map_input_file(filename, &size, &mapped);
+    checkpoint_header header;
+
+    if (size != CHECKPOINT_SIZE) {
+        fprintf(stderr, "Error: '%s' is not a checkpoint of this simulator\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION
+        || header.mem_size != machine->data_memory_size || header.disk_size != machine->disk_size
+        || header.sector_size != machine->sector_size || header.monitor_size != MONITOR_SIZE) {
+        fprintf(stderr, "Error: '%s' is not a checkpoint of this simulator\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *part = data + sizeof(header);
+    memcpy(machine->instruction_memory, part, sizeof(machine->image->words));
+    part += sizeof(machine->image->words);
+    memcpy(machine->data_memory, part, DATA_MEMORY_BYTES);
+    part += DATA_MEMORY_BYTES;
+    memcpy(machine->disk_memory, part, DISK_BYTES);
+    part += DISK_BYTES;
+    mark_disk_dirty(0, machine->disk_size);
+    memcpy(machine->monitor_buffer, part, sizeof(machine->monitor_buffer));
+    part += sizeof(machine->monitor_buffer);
+    memcpy(machine->monitor_nonzero, part, sizeof(machine->monitor_nonzero));
+    unmap_input_file(data, size, mapped);
+
+    machine->simulated_cycles = header.simulated_cycles;
+    machine->program_counter = header.program_counter;
+    machine->halt_flag = header.halt_flag;
+    machine->isr_active_flag = header.isr_active_flag;
+    machine->irq2_next_cycle = header.irq2_next_cycle;
+    machine->disk_cycle_counter = header.disk_cycle_counter;
+    machine->disk_index = header.disk_index;
+    machine->disk_transfer_counter = header.disk_transfer_counter;
+    machine->monitor_dirty_top = header.monitor_dirty[0];
+    machine->monitor_dirty_bottom = header.monitor_dirty[1];
+    machine->monitor_dirty_left = header.monitor_dirty[2];
+    machine->monitor_dirty_right = header.monitor_dirty[3];
+    memcpy(machine->cpu_registers, header.cpu_registers, sizeof(machine->cpu_registers));
+    memcpy(machine->io_registers, header.io_registers, sizeof(machine->io_registers));
+    machine->metrics = header.metrics;
+
+    if (!skip_irq2_feed(machine->irq2_feed, (uint64_t)header.irq2_file_position)) {
+        fprintf(stderr, "Error: The irq2in source ends before the checkpoint's position\n");
+        exit(EXIT_FAILURE);
+    }
+
+    predecode_instruction_memory();
+    machine->restored_from_checkpoint = 1;
+}
+
+/*
+ * get_instruction:
+ * -----------------
+ * Fetches the pre-decoded instruction at 'program_counter'.
+ * If the disk is busy (DISK_STATUS == 1) and CPU is halted (halt_flag == 1),
+ * it tries to re-fetch the same instruction. Otherwise, it just returns
+ * the instruction at 'program_counter'.
+ */
+const decoded_instruction *get_instruction()
+{
+    if(machine->io_registers[DISK_STATUS] == 1 && machine->halt_flag == 1) {
+        // Return an instruction but effectively stall by decrementing PC
+        machine->program_counter -= 1;
+    }
+    return &machine->decoded_memory[machine->program_counter];
+}
+
+/*
+ * record_idle_loop_instruction:
+ * ------------------------------
+ * Called for every fetched instruction while an iteration is being recorded.
+ * Stores its PC and traced registers, and drops the candidate if the instruction
+ * has a side effect (sw, out, reti, halt) or reads an I/O register that changes
+ * every cycle (clks, timercurrent), or if the body gets too long.
+ */
+void record_idle_loop_instruction(const decoded_instruction *instruction) {
+    int opcode = instruction->opcode;
+
+    if (machine->idle_loop_length == IDLE_MAX_BODY || opcode == 17 || opcode == RETI_OP
+        || opcode == 20 || opcode == HALT_OP) {
+        machine->idle_loop_state = IDLE_WATCHING;
+        return;
+    }
+    if (opcode == 16 && disk_transfer_pending(machine->cpu_registers[instruction->registers[1]] + machine->cpu_registers[instruction->registers[2]])) {
+        machine->idle_loop_state = IDLE_WATCHING; // Polls a word the DMA has yet to deliver
+        return;
+    }
+    if (opcode == 19) { // IN
+        uint32_t io_register_index = machine->cpu_registers[instruction->registers[1]] + machine->cpu_registers[instruction->registers[2]];
+        if (io_register_index >= NUM_IO_REGS || io_register_index == CLOCK_CYCLE || io_register_index == TIMER_CURRENT) {
+            machine->idle_loop_state = IDLE_WATCHING;
+            return;
+        }
+    }
+
+    machine->idle_loop_pcs[machine->idle_loop_length] = machine->program_counter;
+    memcpy(machine->idle_loop_trace_registers[machine->idle_loop_length], machine->cpu_registers, sizeof(machine->cpu_registers));
+    machine->idle_loop_length++;
+}
+
+/*
+ * track_idle_loop:
+ * -----------------
+ * Called at the end of every stepped cycle. A taken backward branch to 'head'
+ * (re)starts recording one iteration there. When the branch closes an iteration
+ * that started at the same head with identical registers, with no side effects and
+ * no peripheral event in between, every following iteration must repeat it exactly
+ * until the next event: the loop is marked ready for fast_forward_idle.
+ */
+void track_idle_loop(int interrupt_taken) {
+    uint32_t branch_pc = machine->idle_loop_fetch_pc;
+
+    if (interrupt_taken) {
+        machine->idle_loop_state = IDLE_WATCHING;
+        return;
+    }
+    if (machine->program_counter > branch_pc || branch_pc - machine->program_counter >= IDLE_MAX_BODY)
+        return; // Not the closing branch of a short loop
+
+    if (machine->idle_loop_state == IDLE_RECORDING && machine->program_counter == machine->idle_loop_head
+        && machine->last_natural_event_cycle < machine->idle_loop_start_cycle
+        && memcmp(machine->idle_loop_head_registers, machine->cpu_registers, sizeof(machine->cpu_registers)) == 0) {
+        machine->idle_loop_state = IDLE_READY;
+        return;
+    }
+
+    // Start recording a new iteration at this head
+    machine->idle_loop_state = IDLE_RECORDING;
+    machine->idle_loop_head = machine->program_counter;
+    machine->idle_loop_start_cycle = machine->simulated_cycles + 1; // The iteration starts with the next cycle
+    machine->idle_loop_length = 0;
+    memcpy(machine->idle_loop_head_registers, machine->cpu_registers, sizeof(machine->cpu_registers));
+}
+
+/*
+ * fast_forward_idle:
+ * -------------------
+ * Called at the start of every cycle (after the IRQ2 check). Skips cycles in which
+ * nothing can happen before the next peripheral event (see schedule_events):
+ *   - an idle loop (see track_idle_loop) is advanced by as many whole iterations as
+ *     fit before the event; their trace and hwregtrace lines are synthesized
+ *   - a CPU halted at a HALT while the disk is still busy (the stall get_instruction
+ *     implements by rewinding the PC) jumps straight to the event
+ * Returns 1 if cycles were skipped (the caller starts a new cycle), 0 otherwise.
+ */
+int fast_forward_idle() {
+    int loop_ready = machine->idle_loop_state == IDLE_READY && machine->program_counter == machine->idle_loop_head;
+    uint32_t body_length = machine->idle_loop_length;
+
+    if (machine->idle_loop_state == IDLE_READY) {
+        // Whatever happens now, the next iteration is verified again from scratch
+        machine->idle_loop_state = IDLE_RECORDING;
+        machine->idle_loop_head = machine->program_counter;
+        machine->idle_loop_start_cycle = machine->simulated_cycles;
+        machine->idle_loop_length = 0;
+        memcpy(machine->idle_loop_head_registers, machine->cpu_registers, sizeof(machine->cpu_registers));
+    }
+
+    // A pending interrupt would be taken at the end of the next cycle
+    if (!machine->isr_active_flag && check_interrupts())
+        return 0;
+
+    uint64_t until_event = cycles_until_next_event();
+    if (until_event == 0)
+        return 0;
+
+    if (machine->halt_flag == 1) {
+        // Stalled re-execution of HALT: no trace lines, no state change
+        if (machine->io_registers[DISK_STATUS] != 1 || machine->decoded_memory[(machine->program_counter - 1) & (MEM_SIZE - 1)].opcode != HALT_OP)
+            return 0;
+        if (machine->profile)
+            profile_stall((machine->program_counter - 1) & (MEM_SIZE - 1), until_event);
+        machine->io_registers[CLOCK_CYCLE] += (uint32_t)until_event;
+        machine->simulated_cycles += until_event;
+        return 1;
+    }
+
+    if (!loop_ready)
+        return 0;
+
+    // Replay the recorded iteration as many times as fits before the event
+    uint64_t iterations = until_event / body_length;
+    for (uint64_t i = 0; i < iterations; i++) {
+        uint32_t clock = machine->io_registers[CLOCK_CYCLE] + (uint32_t)(i * body_length);
+        for (uint32_t j = 0; j < body_length; j++) {
+            uint32_t pc = machine->idle_loop_pcs[j];
+            uint32_t *registers = machine->idle_loop_trace_registers[j];
+            log_instruction_trace(machine->simulated_cycles + i * body_length + j, pc, machine->instruction_memory[pc], registers);
+            if (machine->decoded_memory[pc].opcode == 19) // IN
+                log_hw_register_access(clock + j, "READ", registers[machine->decoded_memory[pc].registers[1]]
+                                                + registers[machine->decoded_memory[pc].registers[2]]);
+        }
+    }
+
+    uint64_t skipped = iterations * body_length;
+    machine->io_registers[CLOCK_CYCLE] += (uint32_t)skipped;
+    machine->simulated_cycles += skipped;
+    machine->idle_loop_start_cycle = machine->simulated_cycles;
+    return skipped != 0;
+}
+
+/*
+ * instruction_class:
+ * -------------------
+ * Class of an opcode in the metrics: index into metrics_class_names.
+ */
+const char *metrics_class_names[] = { "alu", "branch", "jump", "memory", "interrupt", "io", "halt", "invalid" };
+
+int instruction_class(int opcode) {
+    if (opcode <= 8)
+        return 0;                       // add .. srl
+    if (opcode <= 14)
+        return 1;                       // beq .. bge
+    if (opcode <= 18)
+        return opcode == 15 ? 2 : opcode == 18 ? 4 : 3; // jal / reti / lw, sw
+    return opcode <= 20 ? 5 : opcode == HALT_OP ? 6 : 7; // in, out / halt
+}
+
+/*
+ * disk_busy_cycles:
+ * ------------------
+ * Cycles the disk has been busy so far, including the running operation.
+ */
+uint64_t disk_busy_cycles() {
+    uint64_t busy = machine->metrics.disk_busy_cycles;
+    if (machine->io_registers[DISK_STATUS] == 1)
+        busy += machine->simulated_cycles - machine->metrics.disk_start_cycle;
+    return busy;
+}
+
+/*
+ * write_metrics_json / write_metrics_prometheus:
+ * -----------------------------------------------
+ * The metrics as one JSON object (--metrics) and in the Prometheus text
+ * exposition format (--metrics-prometheus, for the node_exporter textfile
+ * collector). 'final' is 1 for the export at the end of the run.
+ */
+void write_metrics_json(FILE *file, int final) {
+    const machine_metrics *metrics = &machine->metrics;
+    uint64_t instructions = 0, classes[8] = { 0 };
+    for (int opcode = 0; opcode < 256; opcode++) {
+        instructions += metrics->opcode_counts[opcode];
+        classes[instruction_class(opcode)] += metrics->opcode_counts[opcode];
+    }
+    uint64_t cycles = machine->simulated_cycles, busy = disk_busy_cycles();
+
+    fprintf(file, "{\n  \"cycles\": %llu,\n  \"final\": %s,\n  \"instructions\": %llu,\n",
+            (unsigned long long)cycles, final ? "true" : "false", (unsigned long long)instructions);
+
+    fprintf(file, "  \"classes\": {");
+    for (int i = 0; i < 8; i++)
+        fprintf(file, "%s\"%s\": %llu", i ? ", " : " ", metrics_class_names[i], (unsigned long long)classes[i]);
+    fprintf(file, " },\n  \"opcodes\": {");
+    for (int opcode = 0; opcode <= HALT_OP; opcode++)
+        fprintf(file, "%s\"%s\": %llu", opcode ? ", " : " ", opcode_names[opcode], (unsigned long long)metrics->opcode_counts[opcode]);
+    fprintf(file, " },\n  \"branches\": {\n");
+    for (int i = 0; i < 6; i++)
+        fprintf(file, "    \"%s\": { \"taken\": %llu, \"not_taken\": %llu }%s\n", opcode_names[9 + i],
+                (unsigned long long)metrics->branches_taken[i],
+                (unsigned long long)(metrics->opcode_counts[9 + i] - metrics->branches_taken[i]), i < 5 ? "," : "");
+
+    fprintf(file, "  },\n  \"irq_latency\": {\n");
+    for (int line = 0; line < NUM_IRQ_LINES; line++) {
+        uint64_t count = metrics->irq_latency_count[line];
+        fprintf(file, "    \"irq%d\": { \"count\": %llu, \"total_cycles\": %llu, \"mean_cycles\": %.2f, \"max_cycles\": %llu }%s\n",
+                line, (unsigned long long)count, (unsigned long long)metrics->irq_latency_total[line],
+                count ? (double)metrics->irq_latency_total[line] / (double)count : 0.0,
+                (unsigned long long)metrics->irq_latency_max[line], line < NUM_IRQ_LINES - 1 ? "," : "");
+    }
+
+    fprintf(file, "  },\n  \"disk\": { \"busy_cycles\": %llu, \"busy_fraction\": %.6f, \"sectors_read\": %llu, \"sectors_written\": %llu },\n",
+            (unsigned long long)busy, cycles ? (double)busy / (double)cycles : 0.0,
+            (unsigned long long)metrics->disk_sectors_read, (unsigned long long)metrics->disk_sectors_written);
+    fprintf(file, "  \"monitor_pixel_writes\": %llu,\n  \"led_updates\": %llu,\n  \"display7seg_updates\": %llu\n}\n",
+            (unsigned long long)metrics->monitor_pixel_writes, (unsigned long long)metrics->led_updates,
+            (unsigned long long)metrics->display7seg_updates);
+}
+
+void write_metrics_prometheus(FILE *file, int final) {
+    const machine_metrics *metrics = &machine->metrics;
+
+    fprintf(file, "# HELP simp_cycles_total Cycles simulated.\n# TYPE simp_cycles_total counter\n");
+    fprintf(file, "simp_cycles_total %llu\n", (unsigned long long)machine->simulated_cycles);
+    fprintf(file, "# HELP simp_run_finished 1 once the program halted and the disk is idle.\n# TYPE simp_run_finished gauge\n");
+    fprintf(file, "simp_run_finished %d\n", final);
+
+    fprintf(file, "# HELP simp_instructions_total Instructions executed, by opcode.\n# TYPE simp_instructions_total counter\n");
+    for (int opcode = 0; opcode <= HALT_OP; opcode++)
+        fprintf(file, "simp_instructions_total{opcode=\"%s\",class=\"%s\"} %llu\n", opcode_names[opcode],
+                metrics_class_names[instruction_class(opcode)], (unsigned long long)metrics->opcode_counts[opcode]);
+
+    fprintf(file, "# HELP simp_branches_total Conditional branches executed, by outcome.\n# TYPE simp_branches_total counter\n");
+    for (int i = 0; i < 6; i++) {
+        fprintf(file, "simp_branches_total{opcode=\"%s\",outcome=\"taken\"} %llu\n", opcode_names[9 + i],
+                (unsigned long long)metrics->branches_taken[i]);
+        fprintf(file, "simp_branches_total{opcode=\"%s\",outcome=\"not_taken\"} %llu\n", opcode_names[9 + i],
+                (unsigned long long)(metrics->opcode_counts[9 + i] - metrics->branches_taken[i]));
+    }
+
+    fprintf(file, "# HELP simp_irq_latency_cycles Cycles from IRQ status set to the first handler instruction.\n"
+                  "# TYPE simp_irq_latency_cycles summary\n");
+    for (int line = 0; line < NUM_IRQ_LINES; line++) {
+        fprintf(file, "simp_irq_latency_cycles_sum{irq=\"%d\"} %llu\n", line, (unsigned long long)metrics->irq_latency_total[line]);
+        fprintf(file, "simp_irq_latency_cycles_count{irq=\"%d\"} %llu\n", line, (unsigned long long)metrics->irq_latency_count[line]);
+    }
+    fprintf(file, "# HELP simp_irq_latency_max_cycles Longest IRQ latency.\n# TYPE simp_irq_latency_max_cycles gauge\n");
+    for (int line = 0; line < NUM_IRQ_LINES; line++)
+        fprintf(file, "simp_irq_latency_max_cycles{irq=\"%d\"} %llu\n", line, (unsigned long long)metrics->irq_latency_max[line]);
+
+    fprintf(file, "# HELP simp_disk_busy_cycles_total Cycles the disk was busy.\n# TYPE simp_disk_busy_cycles_total counter\n");
+    fprintf(file, "simp_disk_busy_cycles_total %llu\n", (unsigned long long)disk_busy_cycles());
+    fprintf(file, "# HELP simp_disk_sectors_total Disk sectors transferred, by direction.\n# TYPE simp_disk_sectors_total counter\n");
+    fprintf(file, "simp_disk_sectors_total{direction=\"read\"} %llu\n", (unsigned long long)metrics->disk_sectors_read);
+    fprintf(file, "simp_disk_sectors_total{direction=\"write\"} %llu\n", (unsigned long long)metrics->disk_sectors_written);
+
+    fprintf(file, "# HELP simp_monitor_pixel_writes_total Pixels written to the monitor.\n# TYPE simp_monitor_pixel_writes_total counter\n");
+    fprintf(file, "simp_monitor_pixel_writes_total %llu\n", (unsigned long long)metrics->monitor_pixel_writes);
+    fprintf(file, "# HELP simp_led_updates_total Writes to the leds register.\n# TYPE simp_led_updates_total counter\n");
+    fprintf(file, "simp_led_updates_total %llu\n", (unsigned long long)metrics->led_updates);
+    fprintf(file, "# HELP simp_display7seg_updates_total Writes to the display7seg register.\n# TYPE simp_display7seg_updates_total counter\n");
+    fprintf(file, "simp_display7seg_updates_total %llu\n", (unsigned long long)metrics->display7seg_updates);
+}
+
+/*
+ * write_metrics_file / write_metrics_files:
+ * ------------------------------------------
+ * Write the metrics files of the options. Each is written next to its final name
+ * and renamed over it, so readers polling it during the run never see half a file.
+ * Return false if a file cannot be written.
+ */
+bool write_metrics_file(const char *filename, void (*write)(FILE *file, int final), int final) {
+    char temporary[FILENAME_MAX];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", filename) >= (int)sizeof(temporary))
+        return false;
+    FILE *file = fopen(temporary, "w");
+    if (!file)
+        return false;
+    write(file, final);
+    if (fclose(file) != 0) {
+        remove(temporary);
+        return false;
+    }
+#ifdef _WIN32
+    remove(filename); // rename does not replace existing files on Windows
+#endif
+    return rename(temporary, filename) == 0;
+}
+
+bool write_metrics_files(int final) {
+    if (metrics_file_name && !write_metrics_file(metrics_file_name, write_metrics_json, final))
+        return false;
+    if (metrics_prometheus_file_name && !write_metrics_file(metrics_prometheus_file_name, write_metrics_prometheus, final))
+        return false;
+    return true;
+}
+
+/*
+ * start_simulation:
+ * ------------------
+ * Common setup shared by every execution engine: initializes the timer, loads the
+ * first IRQ2 event into irq2_next_cycle (unless a checkpoint was restored, or this
+ * continues an earlier simp_run_cycles) and builds the initial event queue.
+ */
+void start_simulation() {
+    // A restored checkpoint already holds all of this (see restore_checkpoint)
+    if (!machine->restored_from_checkpoint && !machine->started) {
+        machine->io_registers[TIMER_MAX] = 0xFFFFFFFF; // Initialize timer max
+
+        // Load next IRQ2 event into irq2_next_cycle
+        machine->irq2_next_cycle = next_irq2_event();
+
+        machine->simulated_cycles = 0;
+    }
+
+    // A resumed run may have been changed through simp.h since the last one
+    if (machine->started)
+        machine->idle_loop_state = IDLE_WATCHING;
+    machine->started = 1;
+
+    machine->peripherals_synced_cycle = machine->simulated_cycles;
+    schedule_events();
+}
+
+/*
+ * begin_cycle:
+ * -------------
+ * Start-of-cycle check, only done in event cycles: writes the --checkpoint-at checkpoint
+ * and the --metrics-interval metrics files, raises IRQ2_STATUS if the current clock cycle matches the next IRQ2 event, and loads
+ * the following event from the IRQ2 file. Returns 1 if the run must stop before
+ * this cycle (the simp_run_cycles limit), else 0.
+ */
+static inline int begin_cycle() {
+    if (machine->simulated_cycles != machine->next_event_cycle)
+        return 0;
+
+    // simp_run_cycles limit: return before this cycle (which is then done by the next run)
+    if (machine->simulated_cycles == machine->stop_cycle)
+        return 1;
+
+    if (machine->simulated_cycles == machine->checkpoint_cycle) {
+        sync_peripherals();
+        write_checkpoint(checkpoint_file_name);
+        machine->checkpoint_cycle = NO_EVENT;
+    }
+
+    if (machine->simulated_cycles == machine->metrics_cycle) {
+        machine->metrics_cycle += metrics_interval;
+        if (!write_metrics_files(0)) {
+            fprintf(stderr, "Warning: Cannot write the metrics files, periodic export stopped\n");
+            machine->metrics_cycle = NO_EVENT;
+        }
+    }
+
+    if (machine->irq2_next_cycle == machine->io_registers[CLOCK_CYCLE]) {
+        machine->irq2_next_cycle = next_irq2_event();
+        machine->io_registers[IRQ2_STATUS] = 1; // Trigger IRQ2 status
+    }
+    return 0;
+}
+
+/*
+ * fetch_instruction:
+ * -------------------
+ * Fetches the pre-decoded instruction at the PC, loads its immediates into
+ * $imm1/$imm2 and logs the instruction trace line. IN and OUT turn the cycle
+ * into an event cycle so they see (and may change) up-to-date peripheral state.
+ */
+static inline const decoded_instruction *fetch_instruction() {
+    // Fetch the pre-decoded instruction
+    const decoded_instruction *current_instruction = get_instruction();
+
+    // Write immediate1 and immediate2 to $imm1 and $imm2 registers (indexes 1 and 2)
+    machine->cpu_registers[1] = current_instruction->imm1;
+    machine->cpu_registers[2] = current_instruction->imm2;
+
+    // Log instruction trace to file (the raw word is still needed for the trace text)
+    log_instruction_trace(machine->simulated_cycles, machine->program_counter, machine->instruction_memory[machine->program_counter], machine->cpu_registers);
+
+    machine->idle_loop_fetch_pc = machine->program_counter;
+    if (machine->idle_loop_state == IDLE_RECORDING)
+        record_idle_loop_instruction(current_instruction);
+
+    if (current_instruction->opcode == 19 || current_instruction->opcode == 20) // IN / OUT
+        force_event_cycle();
+
+    return current_instruction;
+}
+
+/*
+ * track_irq_status / count_interrupt_entry:
+ * ------------------------------------------
+ * IRQ latency metrics. Status bits only change in event cycles (timer and disk
+ * events, IRQ2 arrivals, OUT), where track_irq_status notes the cycle each one
+ * was first seen set. count_interrupt_entry then adds, for every line that
+ * causes the interrupt, the cycles from there up to the first handler instruction.
+ */
+void track_irq_status() {
+    for (int line = 0; line < NUM_IRQ_LINES; line++) {
+        if (!machine->io_registers[IRQ0_STATUS + line])
+            machine->metrics.irq_raised_cycle[line] = NO_EVENT;
+        else if (machine->metrics.irq_raised_cycle[line] == NO_EVENT)
+            machine->metrics.irq_raised_cycle[line] = machine->simulated_cycles;
+    }
+}
+
+void count_interrupt_entry() {
+    for (int line = 0; line < NUM_IRQ_LINES; line++) {
+        uint64_t raised = machine->metrics.irq_raised_cycle[line];
+        if (!machine->io_registers[IRQ0_ENABLE + line] || !machine->io_registers[IRQ0_STATUS + line] || raised >= IRQ_SERVICED)
+            continue;
+        uint64_t latency = machine->simulated_cycles + 1 - raised;
+        machine->metrics.irq_latency_count[line]++;
+        machine->metrics.irq_latency_total[line] += latency;
+        if (latency > machine->metrics.irq_latency_max[line])
+            machine->metrics.irq_latency_max[line] = latency;
+        machine->metrics.irq_raised_cycle[line] = IRQ_SERVICED;
+    }
+}
+
+/*
+ * complete_cycle:
+ * ----------------
+ * End-of-cycle work after an instruction has executed and the PC was updated:
+ * peripherals, RETI / interrupt entry, clock and timer, monitor command reset.
+ * Disk and timer handlers only run in event cycles; the queue is rebuilt after them.
+ */
+static inline void complete_cycle(const decoded_instruction *current_instruction) {
+    int event_cycle_due = machine->simulated_cycles == machine->next_event_cycle;
+    int opcode = current_instruction->opcode;
+
+    // Update peripherals (disk, timer, displays, etc.)
+    if (event_cycle_due) {
+        if (machine->forced_event_cycle != machine->simulated_cycles)
+            machine->last_natural_event_cycle = machine->simulated_cycles;
+        sync_peripherals();
+        handle_disk_operations();
+        handle_timer_operations();
+    }
+    if (opcode == 19 || opcode == 20)
+        handle_io_peripherals(opcode, current_instruction->registers);
+
+    if (event_cycle_due)
+        track_irq_status();
+
+    // Check for RETI (ends ISR) or pending interrupts
+    if (opcode == RETI_OP) {
+        machine->isr_active_flag = 0;
+    }
+    int interrupt_taken = 0;
+    if (!machine->isr_active_flag) {
+        if (check_interrupts()) {
+            // Save return address as PC-1
+            machine->io_registers[IRQ_RETURN] = machine->program_counter - 1;
+            // Jump to ISR
+            machine->program_counter = machine->io_registers[IRQ_HANDLER];
+            machine->isr_active_flag = 1;
+            interrupt_taken = 1;
+        }
+    }
+
+    // An interrupt may be the trigger that starts the trace
+    if (interrupt_taken) {
+        count_interrupt_entry();
+        if (!machine->trace_started)
+            trace_interrupt_taken();
+    }
+
+    // Look for loops that only wait for the next event
+    track_idle_loop(interrupt_taken);
+
+    // Increment clock
+    increment_clock_cycle(machine->io_registers);
+    machine->simulated_cycles++;
+
+    if (event_cycle_due) {
+        // Update timer, then queue the next events from the end-of-cycle state
+        update_timer(machine->io_registers);
+        track_irq_status();
+        machine->peripherals_synced_cycle = machine->simulated_cycles;
+        schedule_events();
+    }
+
+    // Reset monitor command after use
+    if (machine->io_registers[MONITOR_CMD] == 1)
+        machine->io_registers[MONITOR_CMD] = 0;
+}
+
+/*
+ * execute_simulation_loop:
+ * -------------------------
+ * Main CPU execution loop (reference switch engine). Continues until we see HALT + disk free.
+ *  - Reads IRQ2 events at the right clock cycles
+ *  - Fetches pre-decoded instructions
+ *  - Logs trace
+ *  - Executes instruction
+ *  - Handles peripherals
+ *  - Manages interrupts
+ *  - Increments clock cycle, updates timer
+ */
+void execute_simulation_loop() {
+    start_simulation();
+
+    // Continue running until CPU is halted AND disk is idle
+    while (!(machine->halt_flag == 1 && machine->io_registers[DISK_STATUS] == 0)) {
+        // IRQ2 events (event cycles only), then skip idle cycles up to the next event
+        if (begin_cycle())
+            break;
+        if (fast_forward_idle())
+            continue;
+
+        // Fetch, load immediates and trace
+        const decoded_instruction *current_instruction = fetch_instruction();
+
+        // Execute the current instruction, possibly modifying program_counter
+        if (!process_instruction(current_instruction, &machine->program_counter)) {
+            machine->program_counter++; // If no jump/branch occurred, move to next
+        }
+
+        // Peripherals, interrupts, clock and timer
+        complete_cycle(current_instruction);
+    }
+}
+
+/*
+ * execute_threaded_loop:
+ * -----------------------
+ * Threaded-code engine built on GCC/Clang labels-as-values. Every opcode has its
+ * own handler that executes the instruction, does its own PC bookkeeping, finishes
+ * the cycle and then jumps straight to the handler of the next instruction, so each
+ * handler ends in its own (separately predicted) indirect branch.
+ * Produces exactly the same registers, memory and trace as execute_simulation_loop.
+ * Falls back to the switch engine on compilers without computed goto.
+ */
+void execute_threaded_loop() {
+#if defined(__GNUC__) || defined(__clang__)
+    void *handlers[256];
+    const decoded_instruction *instruction;
+    const uint8_t *r;
+    uint32_t address;
+
+    // Any opcode outside add..halt dispatches to the error handler
+    for (int i = 0; i < 256; i++)
+        handlers[i] = &&op_invalid;
+    handlers[0] = &&op_add;   handlers[1] = &&op_sub;   handlers[2] = &&op_mac;
+    handlers[3] = &&op_and;   handlers[4] = &&op_or;    handlers[5] = &&op_xor;
+    handlers[6] = &&op_sll;   handlers[7] = &&op_sra;   handlers[8] = &&op_srl;
+    handlers[9] = &&op_beq;   handlers[10] = &&op_bne;  handlers[11] = &&op_blt;
+    handlers[12] = &&op_bgt;  handlers[13] = &&op_ble;  handlers[14] = &&op_bge;
+    handlers[15] = &&op_jal;  handlers[16] = &&op_lw;   handlers[17] = &&op_sw;
+    handlers[18] = &&op_reti; handlers[19] = &&op_in;   handlers[20] = &&op_out;
+    handlers[21] = &&op_halt;
+
+    start_simulation();
+
+// Start the next cycle: stop on HALT + disk free, skip idle cycles, else fetch and jump to its handler
+#define DISPATCH()                                                                  \
+    do {                                                                            \
+        do {                                                                        \
+            if (machine->halt_flag == 1 && machine->io_registers[DISK_STATUS] == 0) \
+                goto done;                                                          \
+            if (begin_cycle())                                                      \
+                goto done;                                                          \
+        } while (fast_forward_idle());                                              \
+        instruction = fetch_instruction();                                          \
+        r = instruction->registers;                                                 \
+        goto *handlers[instruction->opcode];                                        \
+    } while (0)
+
+// Finish the current cycle ($zero stays 0) and dispatch the next instruction
+#define NEXT()                                                                      \
+    do {                                                                            \
+        machine->cpu_registers[0] = 0;                                              \
+        complete_cycle(instruction);                                                \
+        DISPATCH();                                                                 \
+    } while (0)
+
+// Conditional branch: jump to R[rm] if the condition holds, else fall through
+#define BRANCH_IF(condition)                                                        \
+    do {                                                                            \
+        if (condition)                                                              \
+            machine->program_counter = machine->cpu_registers[r[3]] & 0xFFF;        \
+        else                                                                        \
+            machine->program_counter++;                                             \
+        NEXT();                                                                     \
+    } while (0)
+
+    DISPATCH();
+
+op_add:
+    machine->cpu_registers[r[0]] = machine->cpu_registers[r[1]] + machine->cpu_registers[r[2]] + machine->cpu_registers[r[3]];
+    machine->program_counter++;
+    NEXT();
+op_sub:
+    machine->cpu_registers[r[0]] = machine->cpu_registers[r[1]] - machine->cpu_registers[r[2]] - machine->cpu_registers[r[3]];
+    machine->program_counter++;
+    NEXT();
+op_mac:
+    machine->cpu_registers[r[0]] = (machine->cpu_registers[r[1]] * machine->cpu_registers[r[2]]) + machine->cpu_registers[r[3]];
+    machine->program_counter++;
+    NEXT();
+op_and:
+    machine->cpu_registers[r[0]] = machine->cpu_registers[r[1]] & machine->cpu_registers[r[2]] & machine->cpu_registers[r[3]];
+    machine->program_counter++;
+    NEXT();
+op_or:
+    machine->cpu_registers[r[0]] = machine->cpu_registers[r[1]] | machine->cpu_registers[r[2]] | machine->cpu_registers[r[3]];
+    machine->program_counter++;
+    NEXT();
+op_xor:
+    machine->cpu_registers[r[0]] = machine->cpu_registers[r[1]] ^ machine->cpu_registers[r[2]] ^ machine->cpu_registers[r[3]];
+    machine->program_counter++;
+    NEXT();
+op_sll:
+    machine->cpu_registers[r[0]] = machine->cpu_registers[r[1]] << machine->cpu_registers[r[2]];
+    machine->program_counter++;
+    NEXT();
+op_sra:
+    machine->cpu_registers[r[0]] = (int32_t)machine->cpu_registers[r[1]] >> machine->cpu_registers[r[2]];
+    machine->program_counter++;
+    NEXT();
+op_srl:
+    machine->cpu_registers[r[0]] = (uint32_t)machine->cpu_registers[r[1]] >> machine->cpu_registers[r[2]];
+    machine->program_counter++;
+    NEXT();
+op_beq:
+    BRANCH_IF(machine->cpu_registers[r[1]] == machine->cpu_registers[r[2]]);
+op_bne:
+    BRANCH_IF(machine->cpu_registers[r[1]] != machine->cpu_registers[r[2]]);
+op_blt:
+    BRANCH_IF((int)machine->cpu_registers[r[1]] < (int)machine->cpu_registers[r[2]]);
+op_bgt:
+    BRANCH_IF((int)machine->cpu_registers[r[1]] > (int)machine->cpu_registers[r[2]]);
+op_ble:
+    BRANCH_IF((int)machine->cpu_registers[r[1]] <= (int)machine->cpu_registers[r[2]]);
+op_bge:
+    BRANCH_IF((int)machine->cpu_registers[r[1]] >= (int)machine->cpu_registers[r[2]]);
+op_jal:
+    machine->cpu_registers[r[0]] = machine->program_counter + 1; // Store return address
+    machine->program_counter = machine->cpu_registers[r[3]] & 0xFFF;
+    NEXT();
+op_lw:
+    address = machine->cpu_registers[r[1]] + machine->cpu_registers[r[2]];
+    if (data_address_valid(address)) {
+        sync_disk_transfer(address);
+        machine->cpu_registers[r[0]] = machine->data_memory[address] + machine->cpu_registers[r[3]];
+    }
+    machine->program_counter++;
+    NEXT();
+op_sw:
+    address = machine->cpu_registers[r[1]] + machine->cpu_registers[r[2]];
+    if (data_address_valid(address)) {
+        sync_disk_transfer(address);
+        machine->data_memory[address] = machine->cpu_registers[r[3]] + machine->cpu_registers[r[0]];
+    }
+    machine->program_counter++;
+    NEXT();
+op_reti:
+    // Same as the switch engine: PC = IRQ_RETURN, then the normal increment
+    machine->program_counter = machine->io_registers[IRQ_RETURN] + 1;
+    NEXT();
+op_in:
+    address = machine->cpu_registers[r[1]] + machine->cpu_registers[r[2]];
+    if (io_register_valid(address)) {
+        if (address == MONITOR_CMD) {
+            // Reading from MONITOR_CMD always returns 0
+            machine->cpu_registers[r[0]] = 0;
+        }
+        else {
+            machine->cpu_registers[r[0]] = machine->io_registers[address];
+        }
+    }
+    machine->program_counter++;
+    NEXT();
+op_out:
+    address = machine->cpu_registers[r[1]] + machine->cpu_registers[r[2]];
+    if (io_register_valid(address))
+        machine->io_registers[address] = machine->cpu_registers[r[3]];
+    machine->program_counter++;
+    NEXT();
+op_halt:
+    machine->halt_flag = 1;
+    machine->program_counter++;
+    NEXT();
+op_invalid:
+    report_unknown_opcode(instruction->opcode);
+    goto done;
+
+done:
+    return;
+
+#undef BRANCH_IF
+#undef NEXT
+#undef DISPATCH
+#else
+    // No labels-as-values support: use the reference engine
+    execute_simulation_loop();
+#endif
+}
+
+/*
+ * block_cycle_budget:
+ * --------------------
+ * Returns how many straight-line instructions starting at the PC can run as one
+ * unit, with the cycle bookkeeping of all of them applied in a single step afterwards.
+ * A block must end before the next event cycle (IRQ2 arrival, timer expiry, disk
+ * start / word transfer / completion, see schedule_events): only then is skipping
+ * the per-cycle work invisible to the instructions and to the interrupt check.
+ * Returns 0 or 1 when the engine has to step instruction by instruction.
+ */
+uint32_t block_cycle_budget() {
+    // A pending interrupt would be taken after the first instruction
+    if (machine->halt_flag || (!machine->isr_active_flag && check_interrupts()))
+        return 0;
+
+    uint32_t budget = machine->block_length[machine->program_counter];
+    uint64_t until_event = cycles_until_next_event();
+    if (until_event < budget)
+        budget = (uint32_t)until_event;
+
+    return budget;
+}
+
+/*
+ * advance_block_cycles:
+ * ----------------------
+ * Applies the per-cycle work of 'length' straight-line cycles in one step. None of
+ * them is an event cycle, so only CLOCK_CYCLE moves now; the timer and the disk
+ * catch up lazily in sync_peripherals.
+ */
+void advance_block_cycles(uint32_t length) {
+    // Clock advances by the block length (wraps like increment_clock_cycle)
+    machine->io_registers[CLOCK_CYCLE] += length;
+    machine->simulated_cycles += length;
+}
+
+/*
+ * execute_block:
+ * ---------------
+ * Runs 'length' straight-line instructions back to back (each one still loads its
+ * immediates and is traced), then advances the clock by 'length' cycles at once.
+ * block_cycle_budget guarantees none of those cycles is an event cycle, so the
+ * result matches single stepping exactly. simulated_cycles still moves per
+ * instruction, as the trace triggers see the cycle of every traced line. An error
+ * (lw/sw out of range on a simp machine) ends the block after its instruction.
+ */
+void execute_block(uint32_t length) {
+    uint32_t executed = 0;
+    while (executed < length) {
+        const decoded_instruction *current_instruction = fetch_instruction();
+        process_instruction(current_instruction, &machine->program_counter);
+        machine->program_counter++; // Straight-line instructions never jump
+        machine->simulated_cycles++;
+        executed++;
+        if (machine->error[0])
+            break;
+    }
+
+    // Clock advances by the instructions run (wraps like increment_clock_cycle)
+    machine->io_registers[CLOCK_CYCLE] += executed;
+}
+
+/*
+ * execute_block_loop:
+ * --------------------
+ * Basic-block engine. At the start of every cycle it asks block_cycle_budget how
+ * many straight-line instructions can run as one unit; runs of 2 or more go through
+ * execute_block, everything else (I/O, branches, interrupt boundaries) is stepped
+ * exactly like execute_simulation_loop.
+ */
+void execute_block_loop() {
+    start_simulation();
+
+    // Continue running until CPU is halted AND disk is idle
+    while (!(machine->halt_flag == 1 && machine->io_registers[DISK_STATUS] == 0)) {
+        // IRQ2 events (event cycles only), then skip idle cycles up to the next event
+        if (begin_cycle())
+            break;
+        if (fast_forward_idle())
+            continue;
+
+        uint32_t budget = block_cycle_budget();
+        if (budget >= 2) {
+            execute_block(budget);
+            continue;
+        }
+
+        // Single step
+        const decoded_instruction *current_instruction = fetch_instruction();
+        if (!process_instruction(current_instruction, &machine->program_counter)) {
+            machine->program_counter++;
+        }
+        complete_cycle(current_instruction);
+    }
+}
+
+#if SIM_JIT_SUPPORTED
+/*
+ * JIT code generation:
+ * ---------------------
+ * A compiled block is a function jit_function(registers, memory, results):
+ *   rdi = cpu_registers (saved on the stack after the prologue)
+ *   rsi = data_memory base
+ *   r15 = results (one 32-bit slot per instruction, used to replay the trace)
+ *   edi, ecx = scratch (ecx also holds shift counts)
+ * It returns the number of instructions it ran: the whole block, or the ones
+ * before an lw/sw whose address is outside data memory (that one does not run).
+ * SIMP registers $v0..$ra used by the block live in the host registers below for
+ * the whole block; $zero, $imm1 and $imm2 are compile-time constants per instruction.
+ */
+static const uint8_t jit_host_registers[JIT_MAX_MAPPED_REGS] = {
+    0, 2, 8, 9, 10, 11, 3, 5, 12, 13, 14 // eax, edx, r8d-r11d, ebx, ebp, r12d-r14d
+};
+#define JIT_RDI 7
+#define JIT_RCX 1
+#define JIT_RSI 6
+
+static THREAD_LOCAL uint8_t *jit_emit_pointer; // Next free byte while compiling
+
+static void jit_emit8(uint8_t byte) {
+    *jit_emit_pointer++ = byte;
+}
+
+static void jit_emit32(uint32_t value) {
+    memcpy(jit_emit_pointer, &value, 4);
+    jit_emit_pointer += 4;
+}
+
+// REX prefix for a ModRM 'reg' / 'rm' pair (omitted when no extension bit is needed)
+static void jit_emit_rex(int wide, int reg, int rm) {
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40)
+        jit_emit8(rex);
+}
+
+// <opcode> r/m32, r32 (or r32, r/m32) in register-direct form
+static void jit_emit_rr(uint8_t opcode, int reg, int rm) {
+    jit_emit_rex(0, reg, rm);
+    jit_emit8(opcode);
+    jit_emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// Operand of an instruction: either a host register or a constant
+typedef struct {
+    int is_constant;
+    int host;        // Host register when !is_constant
+    int32_t value;   // Constant value ($zero, $imm1 or $imm2)
+} jit_operand;
+
+static jit_operand jit_get_operand(const decoded_instruction *instruction, int simp_register,
+                                   const int8_t *host_of) {
+    jit_operand operand = { 1, 0, 0 };
+    if (simp_register == 1)
+        operand.value = instruction->imm1;
+    else if (simp_register == 2)
+        operand.value = instruction->imm2;
+    else if (simp_register != 0) {
+        operand.is_constant = 0;
+        operand.host = host_of[simp_register];
+    }
+    return operand;
+}
+
+// dst = operand
+static void jit_emit_load(int dst, jit_operand operand) {
+    if (operand.is_constant) {
+        jit_emit_rex(0, 0, dst);
+        jit_emit8(0xB8 + (dst & 7)); // mov r32, imm32
+        jit_emit32((uint32_t)operand.value);
+    }
+    else
+        jit_emit_rr(0x89, operand.host, dst); // mov r32, r32
+}
+
+// dst <op>= operand for add/sub/and/or/xor; 'ext' is the /digit of the 0x81 imm32 form
+static void jit_emit_alu(uint8_t opcode, int ext, int dst, jit_operand operand) {
+    if (operand.is_constant) {
+        jit_emit_rex(0, 0, dst);
+        jit_emit8(0x81);
+        jit_emit8(0xC0 | (ext << 3) | (dst & 7));
+        jit_emit32((uint32_t)operand.value);
+    }
+    else
+        jit_emit_rr(opcode, operand.host, dst);
+}
+
+// dst *= operand
+static void jit_emit_imul(int dst, jit_operand operand) {
+    if (operand.is_constant) {
+        jit_emit_rex(0, dst, dst);
+        jit_emit8(0x69); // imul r32, r/m32, imm32
+        jit_emit8(0xC0 | ((dst & 7) << 3) | (dst & 7));
+        jit_emit32((uint32_t)operand.value);
+    }
+    else {
+        jit_emit_rex(0, dst, operand.host);
+        jit_emit8(0x0F);
+        jit_emit8(0xAF); // imul r32, r/m32
+        jit_emit8(0xC0 | ((dst & 7) << 3) | (operand.host & 7));
+    }
+}
+
+// Leave through 'fault_exit' with ecx = 'index' unless the address in edi is inside data memory
+static void jit_emit_address_guard(int index, const uint8_t *fault_exit) {
+    jit_emit8(0xB9);                                     // mov ecx, imm32
+    jit_emit32((uint32_t)index);
+    jit_emit8(0x81); jit_emit8(0xC0 | (7 << 3) | JIT_RDI); // cmp edi, imm32
+    jit_emit32(machine->data_memory_size);
+    jit_emit8(0x0F); jit_emit8(0x83);                    // jae rel32
+    jit_emit32((uint32_t)(fault_exit - (jit_emit_pointer + 4)));
+}
+
+// mov r32, [rdi + disp8] / mov [rdi + disp8], r32
+static void jit_emit_register_file(uint8_t opcode, int host, int simp_register) {
+    jit_emit_rex(0, host, JIT_RDI);
+    jit_emit8(opcode);
+    jit_emit8(0x40 | ((host & 7) << 3) | JIT_RDI);
+    jit_emit8((uint8_t)(4 * simp_register));
+}
+
+/*
+ * jit_protect_code_buffer:
+ * -------------------------
+ * The code buffer is never writable and executable at once: it is mapped
+ * read/write, jit_compile_block makes it read/write only while it emits a block,
+ * then read/execute again. If a hardened kernel (SELinux execmem, PaX) refuses
+ * the change, the buffer is dropped and the machine runs on the block engine.
+ * Returns false in that case.
+ */
+static bool jit_protect_code_buffer(int protection) {
+    if (mprotect(machine->jit_code_buffer, JIT_CODE_SIZE, protection) == 0)
+        return true;
+    perror("Warning: cannot change the JIT code buffer protection, using the block engine");
+    munmap(machine->jit_code_buffer, JIT_CODE_SIZE);
+    machine->jit_code_buffer = NULL;
+    machine->jit_unavailable = 1;
+    memset(machine->jit_blocks, 0, sizeof(machine->jit_blocks));
+    memset(machine->jit_block_length, 0, sizeof(machine->jit_block_length));
+    return false;
+}
+
+/*
+ * jit_compile_block:
+ * -------------------
+ * Compiles the straight-line block starting at 'address' into native code.
+ * The block is cut short if it would need more than JIT_MAX_MAPPED_REGS SIMP
+ * registers. Returns the number of compiled instructions (0 = not compiled).
+ */
+int jit_compile_block(uint32_t address) {
+    int length = machine->block_length[address];
+    int8_t host_of[NUM_CPU_REGS];
+    int mapped[NUM_CPU_REGS], mapped_count = 0;
+    int written[NUM_CPU_REGS] = { 0 };
+
+    memset(host_of, -1, sizeof(host_of));
+
+    // Assign host registers to $v0..$ra in order of first use
+    for (int i = 0; i < length; i++) {
+        const uint8_t *r = machine->decoded_memory[address + i].registers;
+        int needed = 0;
+        for (int j = 0; j < 4; j++)
+            if (r[j] >= 3 && host_of[r[j]] < 0)
+                needed++;
+        if (mapped_count + needed > JIT_MAX_MAPPED_REGS) {
+            length = i; // Out of host registers: stop the block here
+            break;
+        }
+        for (int j = 0; j < 4; j++) {
+            if (r[j] >= 3 && host_of[r[j]] < 0) {
+                host_of[r[j]] = (int8_t)jit_host_registers[mapped_count];
+                mapped[mapped_count++] = r[j];
+            }
+        }
+        if (machine->decoded_memory[address + i].opcode != 17) // Everything but sw writes rd
+            written[r[0]] = 1;
     }
-    else if (opcode == 20) { // OUT instruction
-        int io_register_index = cpu_registers[registers_used[1]] + cpu_registers[registers_used[2]];
-        fprintf(hw_register_trace_file, "%d WRITE %s %08x\n", io_registers[CLOCK_CYCLE],
-                io_register_names[io_register_index], io_registers[io_register_index]);
+
+    // Worst-case code size: prologue/epilogue plus a bounded amount per instruction
+    if (length < 2 || machine->jit_code_used + 256 + 64 * (size_t)length > JIT_CODE_SIZE)
+        return 0;
+    if (!jit_protect_code_buffer(PROT_READ | PROT_WRITE))
+        return 0;
+
+    jit_emit_pointer = machine->jit_code_buffer + machine->jit_code_used;
+    uint8_t *entry = jit_emit_pointer;
+
+    // Prologue: save callee-saved registers and the register file pointer
+    jit_emit8(0x53); jit_emit8(0x55);                    // push rbx, rbp
+    jit_emit8(0x41); jit_emit8(0x54);                    // push r12
+    jit_emit8(0x41); jit_emit8(0x55);                    // push r13
+    jit_emit8(0x41); jit_emit8(0x56);                    // push r14
+    jit_emit8(0x41); jit_emit8(0x57);                    // push r15
+    jit_emit8(0x57);                                     // push rdi
+    jit_emit8(0x49); jit_emit8(0x89); jit_emit8(0xD7);   // mov r15, rdx
+    for (int i = 0; i < mapped_count; i++)
+        jit_emit_register_file(0x8B, host_of[mapped[i]], mapped[i]);
+
+    jit_emit8(0xE9);                                     // jmp rel32 (to the body)
+    uint8_t *body_jump = jit_emit_pointer;
+    jit_emit32(0);
+
+    // Fault exit of the lw/sw guards: ecx = instructions run before the faulting one
+    uint8_t *fault_exit = jit_emit_pointer;
+    jit_emit8(0x89); jit_emit8(0xCE);                    // mov esi, ecx
+
+    // Epilogue (esi = instructions run): write back modified registers and the final
+    // $imm1/$imm2. It comes before the body, so the lw/sw guards jump back to it.
+    uint8_t *epilogue = jit_emit_pointer;
+    jit_emit8(0x5F); // pop rdi
+    for (int i = 0; i < mapped_count; i++)
+        if (written[mapped[i]])
+            jit_emit_register_file(0x89, host_of[mapped[i]], mapped[i]);
+
+    const decoded_instruction *last = &machine->decoded_memory[address + length - 1];
+    for (int simp_register = 1; simp_register <= 2; simp_register++) {
+        if (last->opcode != 17 && last->registers[0] == simp_register) {
+            // The last instruction overwrote $imm1/$imm2: store its result
+            jit_emit_rex(0, JIT_RCX, 15);
+            jit_emit8(0x8B); jit_emit8(0x80 | (JIT_RCX << 3) | 7); // mov ecx, [r15 + disp32]
+            jit_emit32(4 * (length - 1));
+            jit_emit_register_file(0x89, JIT_RCX, simp_register);
+        }
+        else {
+            jit_emit8(0xC7); jit_emit8(0x40 | JIT_RDI);          // mov dword [rdi + disp8], imm32
+            jit_emit8((uint8_t)(4 * simp_register));
+            jit_emit32((uint32_t)(simp_register == 1 ? last->imm1 : last->imm2));
+        }
+    }
+
+    jit_emit8(0x89); jit_emit8(0xF0);                    // mov eax, esi
+    jit_emit8(0x41); jit_emit8(0x5F);                    // pop r15
+    jit_emit8(0x41); jit_emit8(0x5E);                    // pop r14
+    jit_emit8(0x41); jit_emit8(0x5D);                    // pop r13
+    jit_emit8(0x41); jit_emit8(0x5C);                    // pop r12
+    jit_emit8(0x5D); jit_emit8(0x5B);                    // pop rbp, rbx
+    jit_emit8(0xC3);                                     // ret
+
+    uint32_t body_offset = (uint32_t)(jit_emit_pointer - (body_jump + 4));
+    memcpy(body_jump, &body_offset, 4);
+    for (int i = 0; i < length; i++) {
+        const decoded_instruction *instruction = &machine->decoded_memory[address + i];
+        const uint8_t *r = instruction->registers;
+        jit_operand rs = jit_get_operand(instruction, r[1], host_of);
+        jit_operand rt = jit_get_operand(instruction, r[2], host_of);
+        jit_operand rm = jit_get_operand(instruction, r[3], host_of);
+
+        // Compute the result in edi
+        jit_emit_load(JIT_RDI, rs);
+        switch (instruction->opcode) {
+        case 0: // ADD
+            jit_emit_alu(0x01, 0, JIT_RDI, rt);
+            jit_emit_alu(0x01, 0, JIT_RDI, rm);
+            break;
+        case 1: // SUB
+            jit_emit_alu(0x29, 5, JIT_RDI, rt);
+            jit_emit_alu(0x29, 5, JIT_RDI, rm);
+            break;
+        case 2: // MAC
+            jit_emit_imul(JIT_RDI, rt);
+            jit_emit_alu(0x01, 0, JIT_RDI, rm);
+            break;
+        case 3: // AND
+            jit_emit_alu(0x21, 4, JIT_RDI, rt);
+            jit_emit_alu(0x21, 4, JIT_RDI, rm);
+            break;
+        case 4: // OR
+            jit_emit_alu(0x09, 1, JIT_RDI, rt);
+            jit_emit_alu(0x09, 1, JIT_RDI, rm);
+            break;
+        case 5: // XOR
+            jit_emit_alu(0x31, 6, JIT_RDI, rt);
+            jit_emit_alu(0x31, 6, JIT_RDI, rm);
+            break;
+        case 6: // SLL
+        case 7: // SRA
+        case 8: // SRL
+            jit_emit_load(JIT_RCX, rt);
+            jit_emit8(0xD3); // shl/sar/shr r/m32, cl
+            jit_emit8(0xC0 | ((instruction->opcode == 6 ? 4 : instruction->opcode == 7 ? 7 : 5) << 3) | JIT_RDI);
+            break;
+        case 16: // LW: edi = memory[rs + rt] + rm
+            jit_emit_alu(0x01, 0, JIT_RDI, rt);
+            jit_emit_address_guard(i, fault_exit);
+            jit_emit8(0x8B); jit_emit8(0x3C); jit_emit8(0xBE); // mov edi, [rsi + rdi*4]
+            jit_emit_alu(0x01, 0, JIT_RDI, rm);
+            break;
+        case 17: // SW: memory[rs + rt] = rm + rd
+            jit_emit_alu(0x01, 0, JIT_RDI, rt);
+            jit_emit_address_guard(i, fault_exit);
+            jit_emit_load(JIT_RCX, rm);
+            jit_emit_alu(0x01, 0, JIT_RCX, jit_get_operand(instruction, r[0], host_of));
+            jit_emit8(0x89); jit_emit8(0x0C); jit_emit8(0xBE); // mov [rsi + rdi*4], ecx
+            break;
+        }
+
+        if (instruction->opcode != 17) {
+            // Write back rd ($zero / $imm1 / $imm2 are not kept in host registers)
+            if (r[0] >= 3)
+                jit_emit_rr(0x89, JIT_RDI, host_of[r[0]]);
+            // Record the result for trace replay: mov [r15 + disp32], edi
+            jit_emit8(0x41); jit_emit8(0x89); jit_emit8(0xBF);
+            jit_emit32(4 * i);
+        }
+    }
+
+    jit_emit8(0xBE);                                     // mov esi, length
+    jit_emit32((uint32_t)length);
+    jit_emit8(0xE9);                                     // jmp rel32 (to the epilogue)
+    jit_emit32((uint32_t)(epilogue - (jit_emit_pointer + 4)));
+
+    machine->jit_code_used = (size_t)(jit_emit_pointer - machine->jit_code_buffer);
+    if (!jit_protect_code_buffer(PROT_READ | PROT_EXEC))
+        return 0;
+    machine->jit_blocks[address] = (jit_function)entry;
+    machine->jit_block_length[address] = (uint16_t)length;
+    for (int i = 0; i < length; i++)
+        if (machine->decoded_memory[address + i].opcode == 16 || machine->decoded_memory[address + i].opcode == 17)
+            machine->jit_block_memory[address] = 1;
+    return length;
+}
+#endif
+
+/*
+ * replay_block_trace:
+ * --------------------
+ * Writes the trace lines of a block that ran as native code. Called before the
+ * cycles are advanced, so simulated_cycles is the cycle of its first instruction.
+ * Starting from the register file as it was before the block, it re-applies each
+ * instruction's recorded result, so every line shows exactly what single stepping
+ * would have logged.
+ */
+void replay_block_trace(uint32_t address, uint32_t length, uint32_t *registers_before) {
+    for (uint32_t i = 0; i < length; i++) {
+        const decoded_instruction *instruction = &machine->decoded_memory[address + i];
+        registers_before[1] = instruction->imm1;
+        registers_before[2] = instruction->imm2;
+        log_instruction_trace(machine->simulated_cycles + i, address + i, machine->instruction_memory[address + i], registers_before);
+        if (instruction->opcode != 17) // Everything but sw writes rd
+            registers_before[instruction->registers[0]] = machine->jit_results[i];
+        registers_before[0] = 0;
+    }
+}
+
+/*
+ * execute_jit_loop:
+ * ------------------
+ * Block engine with a native backend. Straight-line blocks that ran JIT_HOT_THRESHOLD
+ * times are compiled to x86-64; a compiled block is only entered when the whole block
+ * fits in block_cycle_budget, so native code always exits before an in/out/reti/halt,
+ * branch or any cycle where an interrupt could become due. Everything else runs on
+ * the interpreted block engine. Without x86-64 support this is the block engine.
+ */
+void execute_jit_loop() {
+#if SIM_JIT_SUPPORTED
+    // Mapped read/write on the first run, kept for later simp_run_cycles (see destroy_machine);
+    // blocks are made executable by jit_protect_code_buffer
+    if (!machine->jit_code_buffer && !machine->jit_unavailable) {
+        machine->jit_code_buffer = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (machine->jit_code_buffer == MAP_FAILED) {
+            perror("Warning: cannot map JIT code buffer, using the block engine");
+            machine->jit_code_buffer = NULL;
+            machine->jit_unavailable = 1;
+        }
+    }
+#endif
+
+    start_simulation();
+
+    // Continue running until CPU is halted AND disk is idle
+    while (!(machine->halt_flag == 1 && machine->io_registers[DISK_STATUS] == 0)) {
+        // IRQ2 events (event cycles only), then skip idle cycles up to the next event
+        if (begin_cycle())
+            break;
+        if (fast_forward_idle())
+            continue;
+
+        uint32_t budget = block_cycle_budget();
+        if (budget >= 2) {
+#if SIM_JIT_SUPPORTED
+            uint32_t address = machine->program_counter;
+            if (machine->jit_code_buffer && !machine->jit_blocks[address] && machine->jit_block_heat[address] < JIT_HOT_THRESHOLD
+                && ++machine->jit_block_heat[address] == JIT_HOT_THRESHOLD)
+                jit_compile_block(address);
+
+            uint32_t length = machine->jit_block_length[address];
+            // Native lw/sw cannot sync a running DMA (see sync_disk_transfer)
+            if (machine->jit_blocks[address] && length <= budget
+                && !(machine->jit_block_memory[address] && machine->io_registers[DISK_CMD] - 1u < 2u)) {
+                uint32_t registers_before[NUM_CPU_REGS];
+                memcpy(registers_before, machine->cpu_registers, sizeof(registers_before));
+
+                uint32_t executed = machine->jit_blocks[address](machine->cpu_registers, machine->data_memory, machine->jit_results);
+                machine->idle_loop_state = IDLE_WATCHING; // Native blocks are not recorded
+                replay_block_trace(address, executed, registers_before);
+
+                machine->program_counter = address + executed;
+                advance_block_cycles(executed);
+                // Native code stops before an lw/sw outside data memory: the interpreter
+                // runs the rest of the block and reports it
+                if (executed < length)
+                    execute_block(length - executed);
+                continue;
+            }
+#endif
+            execute_block(budget);
+            continue;
+        }
+
+        // Single step
+        const decoded_instruction *current_instruction = fetch_instruction();
+        if (!process_instruction(current_instruction, &machine->program_counter)) {
+            machine->program_counter++;
+        }
+        complete_cycle(current_instruction);
+    }
+}
+
+/*
+ * run_simulation:
+ * ----------------
+ * Runs the program on the machine's execution engine, until it halts with the disk
+ * idle or reaches stop_cycle. Lazy peripheral state is synced when it returns.
+ */
+void run_simulation() {
+    switch (machine->engine) {
+    case ENGINE_THREADED:
+        execute_threaded_loop();
+        break;
+    case ENGINE_BLOCK:
+        execute_block_loop();
+        break;
+    case ENGINE_JIT:
+        execute_jit_loop();
+        break;
+    default:
+        execute_simulation_loop();
+        break;
+    }
+
+    // Words a transfer moved after the last event (only if OUT ended it early)
+    sync_peripherals();
+}
+
+/*
+ * load_symbol_map:
+ * -----------------
+ * Reads the label map written by the assembler ("<label> <hex address>" per line,
+ * in address order) so --trace-pc can name code by its labels.
+ */
+bool load_symbol_map(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file)
+        return false;
+
+    char name[SYMBOL_NAME_LEN];
+    unsigned int address;
+    while (symbol_count < MEM_SIZE && fscanf(file, "%63s %x", name, &address) == 2) {
+        strcpy(symbol_names[symbol_count], name);
+        symbol_addresses[symbol_count] = address;
+        symbol_count++;
+    }
+
+    fclose(file);
+    return true;
+}
+
+/*
+ * resolve_trace_address:
+ * -----------------------
+ * Converts a --trace-pc bound (label, decimal or 0x-prefixed hex) into an address
+ * in [0, MEM_SIZE]. For a label, '*symbol' is set to its index in the symbol map.
+ */
+bool resolve_trace_address(const char *text, uint32_t *address, int *symbol) {
+    *symbol = -1;
+    for (int i = 0; i < symbol_count; i++) {
+        if (strcmp(symbol_names[i], text) == 0) {
+            *symbol = i;
+            *address = symbol_addresses[i];
+            return true;
+        }
+    }
+
+    char *end;
+    unsigned long value = strtoul(text, &end, 0);
+    if (*text == '\0' || *end != '\0' || value > MEM_SIZE)
+        return false;
+    *address = (uint32_t)value;
+    return true;
+}
+
+/*
+ * resolve_trace_pc_range:
+ * ------------------------
+ * Marks the PCs of one --trace-pc range in trace_pc_selected:
+ *   FROM-TO   addresses FROM up to (not including) TO
+ *   LABEL     the code from LABEL up to the next label
+ *   ADDRESS   that single instruction
+ */
+bool resolve_trace_pc_range(const char *spec) {
+    char from_text[SYMBOL_NAME_LEN], to_text[SYMBOL_NAME_LEN] = "";
+    const char *dash = strchr(spec, '-');
+    size_t from_length = dash ? (size_t)(dash - spec) : strlen(spec);
+    if (from_length >= SYMBOL_NAME_LEN || (dash && strlen(dash + 1) >= SYMBOL_NAME_LEN))
+        return false;
+    memcpy(from_text, spec, from_length);
+    from_text[from_length] = '\0';
+    if (dash)
+        strcpy(to_text, dash + 1);
+
+    uint32_t from, to;
+    int symbol;
+    if (!resolve_trace_address(from_text, &from, &symbol))
+        return false;
+    if (dash) {
+        int unused;
+        if (!resolve_trace_address(to_text, &to, &unused))
+            return false;
+    }
+    else if (symbol >= 0) {
+        // Up to the next label at a higher address (or the end of memory)
+        to = MEM_SIZE;
+        for (int i = symbol + 1; i < symbol_count; i++) {
+            if (symbol_addresses[i] > from) {
+                to = symbol_addresses[i];
+                break;
+            }
+        }
+    }
+    else
+        to = from + 1;
+
+    for (uint32_t pc = from; pc < to && pc < MEM_SIZE; pc++)
+        trace_pc_selected[pc] = 1;
+    return true;
+}
+
+/*
+ * parse_trace_cycles:
+ * --------------------
+ * Adds a --trace-cycles window "FROM-TO" (cycles FROM up to, not including, TO)
+ * or "FROM-" (from FROM to the end of the run).
+ */
+bool parse_trace_cycles(const char *spec) {
+    char *end;
+    if (trace_window_count == TRACE_MAX_RANGES)
+        return false;
+
+    uint64_t start = strtoull(spec, &end, 0);
+    if (end == spec || *end != '-')
+        return false;
+    spec = end + 1;
+    uint64_t stop = UINT64_MAX;
+    if (*spec != '\0') {
+        stop = strtoull(spec, &end, 0);
+        if (*end != '\0')
+            return false;
+    }
+
+    trace_window_start[trace_window_count] = start;
+    trace_window_end[trace_window_count] = stop;
+    trace_window_count++;
+    return true;
+}
+
+/*
+ * configure_trace_control:
+ * -------------------------
+ * Applies the --trace-* options once all of them (and --symbols) were read.
+ * Returns false if a range does not resolve.
+ */
+bool configure_trace_control() {
+    if (symbol_file_name && !load_symbol_map(symbol_file_name)) {
+        fprintf(stderr, "Error: Cannot read symbol map '%s'\n", symbol_file_name);
+        return false;
+    }
+
+    if (trace_pc_spec_count == 0)
+        memset(trace_pc_selected, 1, sizeof(trace_pc_selected));
+    for (int i = 0; i < trace_pc_spec_count; i++) {
+        if (!resolve_trace_pc_range(trace_pc_specs[i])) {
+            fprintf(stderr, "Error: Invalid --trace-pc range '%s'\n", trace_pc_specs[i]);
+            return false;
+        }
+    }
+
+    bool has_start_trigger = trace_start_irq != TRACE_NO_TRIGGER || trace_start_io_register != TRACE_NO_TRIGGER;
+    trace_control_active = trace_pc_spec_count || trace_window_count || has_start_trigger || trace_history_size;
+    return true;
+}
+
+/*
+ * configure_profile:
+ * -------------------
+ * Maps every PC to the last label at or before it, for the profiler's per-label
+ * totals and folded stacks (all -1 without --symbols).
+ */
+void configure_profile() {
+    int symbol = -1;
+    for (uint32_t pc = 0; pc < MEM_SIZE; pc++) {
+        while (symbol + 1 < symbol_count && symbol_addresses[symbol + 1] <= pc)
+            symbol++;
+        symbol_at_pc[pc] = symbol;
+    }
+}
+
+// One line of the flat profile report
+typedef struct {
+    int key;                    // PC, symbol index (-1 = no label) or opcode, by table
+    uint64_t cycles;            // Instructions executed plus cycles stalled
+    uint64_t executions;
+    uint64_t isr_executions;
+} profile_row;
+
+int compare_profile_rows(const void *a, const void *b) {
+    const profile_row *first = a, *second = b;
+    if (first->cycles != second->cycles)
+        return first->cycles < second->cycles ? 1 : -1;
+    return first->key - second->key;
+}
+
+/*
+ * write_profile_table:
+ * ---------------------
+ * Sorts 'rows' by cycles (busiest first) and writes the ones that ran, with
+ * their share of 'total' cycles. 'name' formats the last column of a row.
+ */
+void write_profile_table(FILE *file, const char *title, profile_row *rows, int count, uint64_t total,
+                         void (*name)(FILE *file, int key)) {
+    qsort(rows, (size_t)count, sizeof(profile_row), compare_profile_rows);
+    fprintf(file, "\n%s\n%14s %8s %14s %14s  %s\n", title, "cycles", "%", "instructions", "in interrupt", "name");
+    for (int i = 0; i < count && rows[i].cycles; i++) {
+        fprintf(file, "%14llu %7.2f%% %14llu %14llu  ", (unsigned long long)rows[i].cycles,
+                total ? 100.0 * (double)rows[i].cycles / (double)total : 0.0,
+                (unsigned long long)rows[i].executions, (unsigned long long)rows[i].isr_executions);
+        name(file, rows[i].key);
+        fputc('\n', file);
+    }
+}
+
+void write_label_name(FILE *file, int symbol) {
+    fputs(symbol >= 0 ? symbol_names[symbol] : "[no label]", file);
+}
+
+void write_opcode_name(FILE *file, int opcode) {
+    if (opcode < (int)(sizeof(opcode_names) / sizeof(opcode_names[0])))
+        fputs(opcode_names[opcode], file);
+    else if (opcode == 0x100)
+        fputs("[halted waiting for the disk]", file);
+    else
+        fprintf(file, "[opcode %02X]", opcode);
+}
+
+void write_address_name(FILE *file, int pc) {
+    const decoded_instruction *decoded = &machine->decoded_memory[pc];
+    fprintf(file, "%03X %012llX %-5s", pc, (unsigned long long)machine->instruction_memory[pc],
+            decoded->opcode < (int)(sizeof(opcode_names) / sizeof(opcode_names[0])) ? opcode_names[decoded->opcode] : "?");
+    int symbol = symbol_at_pc[pc];
+    if (symbol >= 0)
+        fprintf(file, " %s+%u", symbol_names[symbol], pc - symbol_addresses[symbol]);
+}
+
+/*
+ * write_profile_report:
+ * ----------------------
+ * --profile: the run's cycles split into instructions, halted cycles waiting for
+ * the disk and cycles in the interrupt handler, followed by the cycles per label,
+ * per opcode and per instruction address. Stalled cycles count for the HALT
+ * they stall on (and, in the opcode table, on a line of their own).
+ */
+bool write_profile_report(const char *filename) {
+    profile_state *profile = machine->profile;
+    FILE *file = fopen(filename, "w");
+    profile_row *rows = calloc(MEM_SIZE + 0x101, sizeof(profile_row));
+    if (!file || !rows) {
+        if (file)
+            fclose(file);
+        free(rows);
+        return false;
+    }
+
+    uint64_t executions = 0, stalls = 0, isr_executions = 0;
+    for (int pc = 0; pc < MEM_SIZE; pc++) {
+        executions += profile->executions[pc];
+        stalls += profile->stall_cycles[pc];
+        isr_executions += profile->isr_executions[pc];
+    }
+    uint64_t total = executions + stalls;
+    fprintf(file, "Profile of %llu cycles\n", (unsigned long long)total);
+    fprintf(file, "%14llu  instructions executed\n", (unsigned long long)executions);
+    fprintf(file, "%14llu  halted waiting for the disk\n", (unsigned long long)stalls);
+    fprintf(file, "%14llu  instructions in the interrupt handler\n", (unsigned long long)isr_executions);
+    if (profile->out_of_memory)
+        fprintf(file, "(out of memory: some call paths are merged into their callers)\n");
+
+    // Per label (index symbol + 1, so that [no label] is row 0)
+    memset(rows, 0, (MEM_SIZE + 1) * sizeof(profile_row));
+    for (int i = 0; i <= MEM_SIZE; i++)
+        rows[i].key = i - 1;
+    for (int pc = 0; pc < MEM_SIZE; pc++) {
+        profile_row *row = &rows[symbol_at_pc[pc] + 1];
+        row->cycles += profile->executions[pc] + profile->stall_cycles[pc];
+        row->executions += profile->executions[pc];
+        row->isr_executions += profile->isr_executions[pc];
+    }
+    write_profile_table(file, "Cycles by label:", rows, MEM_SIZE + 1, total, write_label_name);
+
+    // Per opcode (row 0x100 = stalled cycles)
+    memset(rows, 0, 0x101 * sizeof(profile_row));
+    for (int i = 0; i <= 0x100; i++)
+        rows[i].key = i;
+    for (int pc = 0; pc < MEM_SIZE; pc++) {
+        profile_row *row = &rows[machine->decoded_memory[pc].opcode];
+        row->cycles += profile->executions[pc];
+        row->executions += profile->executions[pc];
+        row->isr_executions += profile->isr_executions[pc];
+        rows[0x100].cycles += profile->stall_cycles[pc];
+    }
+    write_profile_table(file, "Cycles by opcode:", rows, 0x101, total, write_opcode_name);
+
+    // Per instruction address
+    for (int pc = 0; pc < MEM_SIZE; pc++) {
+        rows[pc].key = pc;
+        rows[pc].cycles = profile->executions[pc] + profile->stall_cycles[pc];
+        rows[pc].executions = profile->executions[pc];
+        rows[pc].isr_executions = profile->isr_executions[pc];
+    }
+    write_profile_table(file, "Cycles by address:", rows, MEM_SIZE, total, write_address_name);
+
+    free(rows);
+    return fclose(file) == 0;
+}
+
+/*
+ * write_profile_folded:
+ * ----------------------
+ * --profile-folded: one line per call path that used cycles, in the folded stack
+ * format of flamegraph.pl and compatible tools ("main;fn;loop 1234"). Frames are
+ * the functions entered by JAL ("[interrupt]" plus the handler for interrupts),
+ * named by their label or entry address, and the last frame is the label inside
+ * the function the cycles were spent under, if that is not the function's own.
+ */
+bool write_profile_folded(const char *filename) {
+    profile_state *profile = machine->profile;
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        return false;
+
+    int path[2 * PROFILE_MAX_DEPTH + 2];
+    for (int node = 0; node < profile->node_count; node++) {
+        if (!profile->nodes[node].cycles)
+            continue;
+        int length = 0;
+        for (int n = node; n >= 0 && length < (int)(sizeof(path) / sizeof(path[0])); n = profile->nodes[n].parent)
+            path[length++] = n;
+        while (length--) {
+            const profile_node *frame = &profile->nodes[path[length]];
+            if (frame->label >= 0)
+                fputs(symbol_names[frame->label], file);
+            else if (frame->label == PROFILE_INTERRUPT)
+                fputs("[interrupt]", file);
+            else
+                fprintf(file, "0x%03X", frame->address);
+            fputc(length ? ';' : ' ', file);
+        }
+        fprintf(file, "%llu\n", (unsigned long long)profile->nodes[node].cycles);
+    }
+    return fclose(file) == 0;
+}
+
+/*
+ * option_value:
+ * --------------
+ * Returns the text after 'name' if 'argument' starts with it, NULL otherwise.
+ */
+const char *option_value(const char *argument, const char *name) {
+    size_t length = strlen(name);
+    return strncmp(argument, name, length) == 0 ? argument + length : NULL;
+}
+
+/*
+ * parse_options:
+ * ---------------
+ * Removes the optional '--' switches from argv (they may appear anywhere) and
+ * applies them. Returns the number of remaining (positional) arguments,
+ * or -1 if an option is not recognized.
+ *   --engine=switch     Reference switch-based interpreter (default)
+ *   --engine=threaded   Computed-goto threaded interpreter
+ *   --engine=block      Basic-block engine with batched cycle accounting
+ *   --engine=jit        Block engine that compiles hot blocks to x86-64
+ *   --trace-format=text|binary|none  trace.txt as text (default), compact binary records
+ *                       (see write_binary_trace_record, decoded to text by tracedec) or empty
+ *   --batch=MANIFEST    Run the jobs listed in MANIFEST instead of one program
+ *   --jobs=N            Worker threads for --batch (default: one per online CPU)
+ *   --checkpoint-at=N   Save the machine state at the start of cycle N
+ *   --checkpoint-file=F File for --checkpoint-at (default checkpoint.bin)
+ *   --restore=FILE      Continue from a checkpoint instead of cycle 0
+ *   --data-memory=N     Words of data memory (default and minimum 4096)
+ *   --disk-sectors=N    Sectors of the disk (default 128)
+ *   --sector-words=N    Words per disk sector (default 128); a read/write takes 8 cycles per word
+ *   --disk-image=FILE   Use the binary image FILE as the disk (see map_disk_image)
+ *   --disk-export       With --disk-image, also write the disk to diskout.txt
+ *   --symbols=FILE      Label map written by the assembler (for --trace-pc and the profile)
+ *   --metrics=FILE      Write runtime metrics (opcode mix, branches, IRQ latency, disk,
+ *                       monitor, LEDs) as JSON to FILE at the end of the run
+ *   --metrics-prometheus=F  The same metrics as a Prometheus textfile
+ *   --metrics-interval=N    Also rewrite the metrics files every N cycles
+ *   --profile=FILE      Write a flat profile (cycles per label, opcode and address) to FILE
+ *   --profile-folded=F  Write the profile as folded call stacks (for flamegraph tools) to F
+ *   --trace-pc=RANGE    Only trace PCs in RANGE (FROM-TO, LABEL or ADDRESS; repeatable)
+ *   --trace-cycles=A-B  Only trace cycles A up to B ("A-" = to the end; repeatable)
+ *   --trace-on-irq=N    Start tracing when the CPU first enters the handler for IRQ N
+ *   --trace-on-write=R  Start tracing at the first OUT to I/O register R (name or index)
+ *   --trace-history=N   Keep the last N untraced instructions and write them out
+ *                       when the trace opens (see trace_filtered_instruction)
+ */
+int parse_options(int argc, char *argv[]) {
+    int positional = 1; // argv[0] is always kept
+    const char *value;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            argv[positional++] = argv[i]; // Keep file names in their original order
+            continue;
+        }
+
+        if (strcmp(argv[i], "--engine=switch") == 0)
+            simulation_engine = ENGINE_SWITCH;
+        else if (strcmp(argv[i], "--engine=threaded") == 0)
+            simulation_engine = ENGINE_THREADED;
+        else if (strcmp(argv[i], "--engine=block") == 0)
+            simulation_engine = ENGINE_BLOCK;
+        else if (strcmp(argv[i], "--engine=jit") == 0)
+            simulation_engine = ENGINE_JIT;
+        else if (strcmp(argv[i], "--trace-format=text") == 0)
+            trace_format = TRACE_FORMAT_TEXT;
+        else if (strcmp(argv[i], "--trace-format=binary") == 0)
+            trace_format = TRACE_FORMAT_BINARY;
+        else if (strcmp(argv[i], "--trace-format=none") == 0)
+            trace_format = TRACE_FORMAT_NONE;
+        else if ((value = option_value(argv[i], "--batch=")) != NULL && *value)
+            batch_file_name = value;
+        else if ((value = option_value(argv[i], "--jobs=")) != NULL && atoi(value) > 0)
+            batch_threads = atoi(value);
+        else if ((value = option_value(argv[i], "--checkpoint-at=")) != NULL && *value >= '0' && *value <= '9')
+            checkpoint_at_cycle = strtoull(value, NULL, 0);
+        else if ((value = option_value(argv[i], "--checkpoint-file=")) != NULL && *value)
+            checkpoint_file_name = value;
+        else if ((value = option_value(argv[i], "--restore=")) != NULL && *value)
+            restore_file_name = value;
+        else if ((value = option_value(argv[i], "--data-memory=")) != NULL && *value >= '1' && *value <= '9')
+            configured_data_memory_size = (uint32_t)strtoul(value, NULL, 0);
+        else if ((value = option_value(argv[i], "--disk-sectors=")) != NULL && *value >= '1' && *value <= '9')
+            configured_disk_sectors = (uint32_t)strtoul(value, NULL, 0);
+        else if ((value = option_value(argv[i], "--sector-words=")) != NULL && *value >= '1' && *value <= '9')
+            configured_sector_size = (uint32_t)strtoul(value, NULL, 0);
+        else if ((value = option_value(argv[i], "--disk-image=")) != NULL && *value)
+            disk_image_file_name = value;
+        else if (strcmp(argv[i], "--disk-export") == 0)
+            disk_text_export = 1;
+        else if ((value = option_value(argv[i], "--symbols=")) != NULL)
+            symbol_file_name = value;
+        else if ((value = option_value(argv[i], "--metrics=")) != NULL && *value)
+            metrics_file_name = value;
+        else if ((value = option_value(argv[i], "--metrics-prometheus=")) != NULL && *value)
+            metrics_prometheus_file_name = value;
+        else if ((value = option_value(argv[i], "--metrics-interval=")) != NULL && *value >= '1' && *value <= '9')
+            metrics_interval = strtoull(value, NULL, 0);
+        else if ((value = option_value(argv[i], "--profile=")) != NULL && *value)
+            profile_file_name = value;
+        else if ((value = option_value(argv[i], "--profile-folded=")) != NULL && *value)
+            profile_folded_file_name = value;
+        else if ((value = option_value(argv[i], "--trace-pc=")) != NULL && trace_pc_spec_count < TRACE_MAX_RANGES)
+            trace_pc_specs[trace_pc_spec_count++] = (char *)value;
+        else if ((value = option_value(argv[i], "--trace-cycles=")) != NULL && parse_trace_cycles(value))
+            ;
+        else if ((value = option_value(argv[i], "--trace-on-irq=")) != NULL && value[0] >= '0' && value[0] <= '2' && value[1] == '\0')
+            trace_start_irq = value[0] - '0';
+        else if ((value = option_value(argv[i], "--trace-on-write=")) != NULL) {
+            char *end;
+            trace_start_io_register = (int)strtol(value, &end, 0);
+            if (end == value || *end != '\0') {
+                trace_start_io_register = TRACE_NO_TRIGGER;
+                for (int r = 0; r < NUM_IO_REGS; r++)
+                    if (strcmp(value, io_register_names[r]) == 0 && strcmp(value, "reserved") != 0)
+                        trace_start_io_register = r;
+            }
+            if (trace_start_io_register < 0 || trace_start_io_register >= NUM_IO_REGS) {
+                fprintf(stderr, "Error: Unknown I/O register '%s'\n", value);
+                return -1;
+            }
+        }
+        else if ((value = option_value(argv[i], "--trace-history=")) != NULL && atoi(value) > 0)
+            trace_history_size = (uint32_t)atoi(value);
+        else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            return -1;
+        }
+    }
+
+    argv[positional] = NULL;
+    if (configured_data_memory_size < MEM_SIZE || configured_data_memory_size > MAX_DATA_MEMORY) {
+        fprintf(stderr, "Error: --data-memory must be %u to %u words\n", MEM_SIZE, MAX_DATA_MEMORY);
+        return -1;
+    }
+    if (configured_sector_size > MAX_SECTOR_SIZE
+        || (uint64_t)configured_disk_sectors * configured_sector_size > MAX_DISK_SIZE) {
+        fprintf(stderr, "Error: Disks hold at most %u words, in sectors of at most %u words\n", MAX_DISK_SIZE, MAX_SECTOR_SIZE);
+        return -1;
+    }
+    if (!configure_trace_control())
+        return -1;
+    configure_profile();
+    return positional;
+}
+
+/*
+ * run_job:
+ * ---------
+ * One complete simulation on the current 'machine': loads the inputs, runs the
+ * program and writes every output file. files[] is laid out like main's argv
+ * (files[1..14] are the 14 file names). Returns false if a step fails.
+ */
+bool run_job(char *files[]) {
+    // Load input files (instruction, data, disk, irq2)
+    if (!load_input_files(files)) {
+        fprintf(stderr, "Error loading input files. Exiting.\n");
+        return false;
+    }
+
+    // Continue from a checkpoint instead of the initial state
+    if (restore_file_name) {
+        restore_checkpoint(restore_file_name);
+        // Keep the --metrics-interval exports at the cycles of an uninterrupted run
+        if (machine->metrics_cycle != NO_EVENT)
+            machine->metrics_cycle = (machine->simulated_cycles / metrics_interval + 1) * metrics_interval;
+    }
+    start_irq2_reader();
+
+    // Open output files for writing
+    if (!open_output_files(files)) {
+        fprintf(stderr, "Error opening output files. Exiting.\n");
+        return false;
+    }
+
+    // Run the main simulation on the selected engine
+    run_simulation();
+    if (machine->checkpoint_cycle != NO_EVENT)
+        fprintf(stderr, "Warning: the run ended after %llu cycles, before --checkpoint-at\n",
+                (unsigned long long)machine->simulated_cycles);
+
+    // Write all final data to the respective output files
+    if (!write_output_files(files)) {
+        fprintf(stderr, "Error writing output files. Exiting.\n");
+        return false;
+    }
+
+    // Export the final metrics
+    if (!write_metrics_files(1)) {
+        fprintf(stderr, "Error writing the metrics files. Exiting.\n");
+        return false;
+    }
+
+    // Write the profile of the guest program
+    if (profile_file_name && !write_profile_report(profile_file_name)) {
+        fprintf(stderr, "Error writing profile '%s'. Exiting.\n", profile_file_name);
+        return false;
+    }
+    if (profile_folded_file_name && !write_profile_folded(profile_folded_file_name)) {
+        fprintf(stderr, "Error writing profile '%s'. Exiting.\n", profile_folded_file_name);
+        return false;
+    }
+
+    // Close all file pointers
+    cleanup_files();
+    return true;
+}
+
+// One job of a --batch manifest
+typedef struct {
+    char *files[15];                // Laid out like main's argv: files[1..14] are the file names
+    int line;                       // Manifest line (for error messages)
+    instruction_image *image;       // Shared image of files[1] (see load_batch_images)
+} batch_job;
+
+// Globals for batch mode
+char *batch_text = NULL;            // Manifest contents; files[] point into it
+batch_job *batch_jobs = NULL;
+int batch_job_count = 0;
+instruction_image *batch_images = NULL; // Image cache: one image per distinct imemin path
+
+/*
+ * read_batch_manifest:
+ * ---------------------
+ * Reads the --batch manifest: one job per line, given as the 14 file names main
+ * takes, in the same order, separated by spaces or tabs. Blank lines and lines
+ * starting with '#' are skipped. Returns false if the manifest cannot be read or
+ * a line does not hold exactly 14 names.
+ */
+bool read_batch_manifest(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror("Error opening batch manifest");
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    batch_text = malloc((size_t)size + 1);
+    if (!batch_text || fread(batch_text, 1, (size_t)size, file) != (size_t)size) {
+        perror("Error reading batch manifest");
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    batch_text[size] = '\0';
+
+    // At most one job per line
+    int lines = 1;
+    for (long i = 0; i < size; i++)
+        lines += batch_text[i] == '\n';
+    batch_jobs = calloc((size_t)lines, sizeof(batch_job));
+    if (!batch_jobs) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+
+    char *cursor = batch_text;
+    for (int line = 1; *cursor; line++) {
+        char *line_end = strchr(cursor, '\n');
+        if (line_end)
+            *line_end = '\0';
+
+        // Split the line into names in place
+        batch_job *job = &batch_jobs[batch_job_count];
+        int names = 0;
+        char *name = cursor + strspn(cursor, " \t\r");
+        while (*name && *name != '#') {
+            char *name_end = name + strcspn(name, " \t\r");
+            if (names < 14)
+                job->files[1 + names] = name;
+            names++;
+            if (*name_end == '\0')
+                break;
+            *name_end = '\0';
+            name = name_end + 1 + strspn(name_end + 1, " \t\r");
+        }
+
+        if (names != 0 && names != 14) {
+            fprintf(stderr, "Error: Batch manifest line %d has %d file names (expected 14)\n", line, names);
+            return false;
+        }
+        if (names == 14) {
+            job->line = line;
+            batch_job_count++;
+        }
+        cursor = line_end ? line_end + 1 : cursor + strlen(cursor);
     }
+    return true;
 }
 
 /*
- * check_interrupts:
- * ------------------
- * Returns 1 if any of IRQ0, IRQ1, or IRQ2 is enabled and pending.
- * Otherwise, returns 0.
+ * load_batch_images:
+ * -------------------
+ * Checks that every job's input files can be opened (so a bad job is reported
+ * before any job runs) and gives each job its instruction image, loading every
+ * distinct imemin path only once. Returns false if an input file is missing.
  */
-int check_interrupts() {
-    int irq_pending = 0;
-
-    // Check Timer Interrupt
-    if (io_registers[IRQ0_ENABLE] && io_registers[IRQ0_STATUS]) {
-        irq_pending = 1;
-    }
-    // Check Disk Interrupt
-    if (io_registers[IRQ1_ENABLE] && io_registers[IRQ1_STATUS]) {
-        irq_pending = 1;
-    }
-    // Check External Interrupt
-    if (io_registers[IRQ2_ENABLE] && io_registers[IRQ2_STATUS]) {
-        irq_pending = 1;
+bool load_batch_images() {
+    bool inputs_ok = true;
+    for (int i = 0; i < batch_job_count; i++) {
+        batch_job *job = &batch_jobs[i];
+        for (int f = 1; f <= 4; f++) {
+            FILE *file = fopen(job->files[f], "r");
+            if (!file) {
+                fprintf(stderr, "Error: Cannot open '%s' (batch manifest line %d)\n", job->files[f], job->line);
+                inputs_ok = false;
+                break;
+            }
+            fclose(file);
+        }
     }
+    if (!inputs_ok)
+        return false;
 
-    return irq_pending;
+    for (int i = 0; i < batch_job_count; i++) {
+        batch_job *job = &batch_jobs[i];
+        for (job->image = batch_images; job->image; job->image = job->image->next)
+            if (strcmp(job->image->path, job->files[1]) == 0)
+                break;
+        if (!job->image) {
+            job->image = load_instruction_image(job->files[1]);
+            job->image->next = batch_images;
+            batch_images = job->image;
+        }
+    }
+    return true;
 }
 
 /*
- * handle_peripherals:
- * --------------------
- * Wrapper function that updates all peripheral-related logic each cycle:
- *   - Disk, timer, LEDs/7-seg display, monitor, and HW register traces.
+ * run_batch_job:
+ * ---------------
+ * Runs one manifest job on a fresh machine of the calling thread.
  */
-void handle_peripherals(int opcode, int *registers_used) {
-    handle_disk_operations();
-    handle_timer_operations();
-    handle_led_and_display_operations(opcode, registers_used);
-    handle_monitor_operations();
-    log_hw_register_operations(opcode, registers_used);
+bool run_batch_job(batch_job *job) {
+    machine = create_machine();
+    if (!machine) {
+        fprintf(stderr, "Error: Out of memory (batch manifest line %d)\n", job->line);
+        return false;
+    }
+    machine->image = job->image;
+
+    bool succeeded = run_job(job->files);
+    if (!succeeded)
+        fprintf(stderr, "Error: Batch job on manifest line %d failed\n", job->line);
+
+    destroy_machine(machine);
+    machine = NULL;
+    return succeeded;
 }
 
+#if SIM_BATCH_THREADS
+// Work-stealing deque of one batch worker: the owner takes jobs from the bottom,
+// idle workers steal from the top
+typedef struct {
+    int *jobs;                      // Indexes into batch_jobs
+    int top;                        // Next job a thief takes
+    int bottom;                     // One past the next job the owner takes
+    int failures;                   // Jobs this worker ran that failed
+    pthread_mutex_t lock;
+} batch_deque;
+
+batch_deque *batch_deques = NULL;
+int batch_worker_count = 0;
+
 /*
- * check_and_handle_interrupts:
- * -----------------------------
- * If an interrupt is pending and we are not in an ISR, jump to the IRQ_HANDLER
- * and set isr_active_flag.
+ * batch_take_job:
+ * ----------------
+ * Returns the next job for 'worker': the newest one of its own deque, else the
+ * oldest one of another worker's deque. Returns -1 when every deque is empty
+ * (jobs never create new jobs, so the batch is then finished).
  */
-void check_and_handle_interrupts(uint32_t *pc) {
-    int interrupt_pending = (io_registers[IRQ0_ENABLE] && io_registers[IRQ0_STATUS]) ||
-                            (io_registers[IRQ1_ENABLE] && io_registers[IRQ1_STATUS]) ||
-                            (io_registers[IRQ2_ENABLE] && io_registers[IRQ2_STATUS]);
-
-    // If there's a pending interrupt and we're not already servicing one
-    if (interrupt_pending && !isr_active_flag) {
-        io_registers[IRQ_RETURN] = *pc;  // Save current PC
-        *pc = io_registers[IRQ_HANDLER]; // Jump to ISR
-        isr_active_flag = 1;             // Set ISR flag
+int batch_take_job(int worker) {
+    int job = -1;
+    for (int i = 0; i < batch_worker_count && job < 0; i++) {
+        batch_deque *deque = &batch_deques[(worker + i) % batch_worker_count];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->bottom > deque->top)
+            job = (i == 0) ? deque->jobs[--deque->bottom] : deque->jobs[deque->top++];
+        pthread_mutex_unlock(&deque->lock);
     }
+    return job;
 }
 
-/*
- * handle_reti:
- * -------------
- * RETI instruction logic: restore PC from IRQ_RETURN and clear ISR flag.
- */
-void handle_reti(uint32_t *pc) {
-    *pc = io_registers[IRQ_RETURN];
-    isr_active_flag = 0;
+void *batch_worker_main(void *argument) {
+    int worker = (int)(intptr_t)argument;
+    for (int job; (job = batch_take_job(worker)) >= 0;)
+        if (!run_batch_job(&batch_jobs[job]))
+            batch_deques[worker].failures++;
+    return NULL;
 }
+#endif
 
 /*
- * clear_serviced_interrupts:
- * ---------------------------
- * Clears the status bits of IRQ0, IRQ1, and IRQ2 if they're enabled and active.
+ * run_batch:
+ * -----------
+ * --batch mode: runs every job of the manifest in this process, on --jobs worker
+ * threads (default: one per online CPU). Each worker owns a deque holding an equal
+ * share of the jobs and steals from the others once its own share is done, so
+ * jobs of very different lengths still keep every worker busy. Jobs share their
+ * instruction images and nothing else. Returns false if any job failed.
  */
-void clear_serviced_interrupts() {
-    if (io_registers[IRQ0_STATUS] && io_registers[IRQ0_ENABLE]) {
-        io_registers[IRQ0_STATUS] = 0;
+bool run_batch(const char *manifest) {
+    if (restore_file_name || checkpoint_at_cycle != NO_EVENT) {
+        fprintf(stderr, "Error: --checkpoint-at and --restore cannot be used with --batch\n");
+        return false;
     }
-    if (io_registers[IRQ1_STATUS] && io_registers[IRQ1_ENABLE]) {
-        io_registers[IRQ1_STATUS] = 0;
+    if (profile_file_name || profile_folded_file_name || metrics_file_name || metrics_prometheus_file_name) {
+        fprintf(stderr, "Error: --profile, --profile-folded and --metrics* cannot be used with --batch\n");
+        return false;
     }
-    if (io_registers[IRQ2_STATUS] && io_registers[IRQ2_ENABLE]) {
-        io_registers[IRQ2_STATUS] = 0;
+    if (disk_image_file_name) {
+        fprintf(stderr, "Error: --disk-image cannot be used with --batch\n");
+        return false;
     }
-}
-
-/*
- * process_instruction:
- * ---------------------
- * Main ALU and control logic for each opcode. Modifies cpu_registers or PC as required.
- * Returns jump_flag=1 if the PC is changed by instruction itself, else 0.
- */
-int process_instruction(int opcode, int *registersUsed, uint32_t *pc, int32_t imm1, int32_t imm2) {
-    int jump_flag = 0; // 1 if we do a branch/jump
-
-    switch (opcode) {
-    case 0: // ADD
-        cpu_registers[registersUsed[0]] = cpu_registers[registersUsed[1]]
-                                          + cpu_registers[registersUsed[2]]
-                                          + cpu_registers[registersUsed[3]];
-        break;
+    if (!read_batch_manifest(manifest) || !load_batch_images())
+        return false;
 
-    case 1: // SUB
-        cpu_registers[registersUsed[0]] = cpu_registers[registersUsed[1]]
-                                          - cpu_registers[registersUsed[2]]
-                                          - cpu_registers[registersUsed[3]];
-        break;
+    // The workers already keep every core busy
+    background_output_writer = 0;
+    background_input_reader = 0;
+    int failures = 0;
 
-    case 2: // MAC
-        cpu_registers[registersUsed[0]] = (cpu_registers[registersUsed[1]]
-                                           * cpu_registers[registersUsed[2]])
-                                          + cpu_registers[registersUsed[3]];
-        break;
+#if SIM_BATCH_THREADS
+    int workers = batch_threads > 0 ? batch_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > batch_job_count)
+        workers = batch_job_count;
+    if (workers < 1)
+        workers = 1;
 
-    case 3: // AND
-        cpu_registers[registersUsed[0]] = cpu_registers[registersUsed[1]]
-                                          & cpu_registers[registersUsed[2]]
-                                          & cpu_registers[registersUsed[3]];
-        break;
+    // Contiguous equal shares of the jobs
+    int *job_order = malloc(((size_t)batch_job_count + 1) * sizeof(int));
+    batch_deques = calloc((size_t)workers, sizeof(batch_deque));
+    pthread_t *threads = calloc((size_t)workers, sizeof(pthread_t));
+    if (!job_order || !batch_deques || !threads) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return false;
+    }
+    for (int i = 0; i < batch_job_count; i++)
+        job_order[i] = i;
+    batch_worker_count = workers;
+    for (int w = 0; w < workers; w++) {
+        int first = (int)((int64_t)batch_job_count * w / workers);
+        int last = (int)((int64_t)batch_job_count * (w + 1) / workers);
+        batch_deques[w].jobs = job_order + first;
+        batch_deques[w].top = 0;
+        batch_deques[w].bottom = last - first;
+        pthread_mutex_init(&batch_deques[w].lock, NULL);
+    }
 
-    case 4: // OR
-        cpu_registers[registersUsed[0]] = cpu_registers[registersUsed[1]]
-                                          | cpu_registers[registersUsed[2]]
-                                          | cpu_registers[registersUsed[3]];
-        break;
+    // Worker 0 is the main thread
+    for (int w = 1; w < workers; w++) {
+        if (pthread_create(&threads[w], NULL, batch_worker_main, (void *)(intptr_t)w) != 0) {
+            perror("Error creating batch worker thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    batch_worker_main((void *)(intptr_t)0);
+    for (int w = 1; w < workers; w++)
+        pthread_join(threads[w], NULL);
 
-    case 5: // XOR
-        cpu_registers[registersUsed[0]] = cpu_registers[registersUsed[1]]
-                                          ^ cpu_registers[registersUsed[2]]
-                                          ^ cpu_registers[registersUsed[3]];
-        break;
+    for (int w = 0; w < workers; w++) {
+        failures += batch_deques[w].failures;
+        pthread_mutex_destroy(&batch_deques[w].lock);
+    }
+    free(threads);
+    free(batch_deques);
+    free(job_order);
+#else
+    for (int i = 0; i < batch_job_count; i++)
+        if (!run_batch_job(&batch_jobs[i]))
+            failures++;
+#endif
 
-    case 6: // SLL
-        cpu_registers[registersUsed[0]] = cpu_registers[registersUsed[1]]
-                                          << cpu_registers[registersUsed[2]];
-        break;
+    while (batch_images) {
+        instruction_image *next = batch_images->next;
+        free(batch_images);
+        batch_images = next;
+    }
+    free(batch_jobs);
+    free(batch_text);
 
-    case 7: // SRA
-        cpu_registers[registersUsed[0]] = (int32_t)cpu_registers[registersUsed[1]]
-                                          >> cpu_registers[registersUsed[2]];
-        break;
+    if (failures)
+        fprintf(stderr, "Error: %d of %d batch jobs failed\n", failures, batch_job_count);
+    return failures == 0;
+}
 
-    case 8: // SRL
-        cpu_registers[registersUsed[0]] = (uint32_t)cpu_registers[registersUsed[1]]
-                                          >> cpu_registers[registersUsed[2]];
-        break;
+/*
+ * Embedding interface (simp.h):
+ * ------------------------------
+ * Every simp_* function works on the machine it is given. Functions that call into
+ * the simulator point 'machine' at it for the duration of the call and then restore
+ * the previous value, so a callback of one machine may drive another machine.
+ */
 
-    case 9: // BEQ
-        if (cpu_registers[registersUsed[1]] == cpu_registers[registersUsed[2]]) {
-            *pc = cpu_registers[registersUsed[3]] & 0xFFF;
-            jump_flag = 1;
-        }
-        break;
+simp_machine *simp_create(int engine) {
+    machine_context *context = create_machine();
+    instruction_image *image = calloc(1, sizeof(instruction_image));
+    if (!context || !image) {
+        free(image);
+        if (context)
+            destroy_machine(context);
+        return NULL;
+    }
 
-    case 10: // BNE
-        if (cpu_registers[registersUsed[1]] != cpu_registers[registersUsed[2]]) {
-            *pc = cpu_registers[registersUsed[3]] & 0xFFF;
-            jump_flag = 1;
-        }
-        break;
+    machine_context *previous = machine;
+    machine = context;
+    machine->embedded = 1;
+    machine->engine = (engine >= SIMP_ENGINE_SWITCH && engine <= SIMP_ENGINE_JIT) ? engine : ENGINE_SWITCH;
+    machine->owns_image = 1;
+    predecode_image(image);
+    use_instruction_image(image);
+    machine = previous;
+    return context;
+}
 
-    case 11: // BLT
-        if ((int)cpu_registers[registersUsed[1]] < (int)cpu_registers[registersUsed[2]]) {
-            *pc = cpu_registers[registersUsed[3]] & 0xFFF;
-            jump_flag = 1;
-        }
-        break;
+void simp_destroy(simp_machine *m) {
+    if (m)
+        destroy_machine(m);
+}
 
-    case 12: // BGT
-        if ((int)cpu_registers[registersUsed[1]] > (int)cpu_registers[registersUsed[2]]) {
-            *pc = cpu_registers[registersUsed[3]] & 0xFFF;
-            jump_flag = 1;
-        }
-        break;
+int simp_load(simp_machine *m, int image, const char *text, size_t length) {
+    machine_context *previous = machine;
+    int result = 0;
 
-    case 13: // BLE
-        if ((int)cpu_registers[registersUsed[1]] <= (int)cpu_registers[registersUsed[2]]) {
-            *pc = cpu_registers[registersUsed[3]] & 0xFFF;
-            jump_flag = 1;
-        }
+    machine = m;
+    switch (image) {
+    case SIMP_IMAGE_INSTRUCTIONS:
+        memset(m->instruction_memory, 0, sizeof(m->image->words));
+        parse_memory(text, length, m->instruction_memory, MEM_SIZE, 12);
+        predecode_instruction_memory();
         break;
-
-    case 14: // BGE
-        if ((int)cpu_registers[registersUsed[1]] >= (int)cpu_registers[registersUsed[2]]) {
-            *pc = cpu_registers[registersUsed[3]] & 0xFFF;
-            jump_flag = 1;
-        }
+    case SIMP_IMAGE_DATA:
+        memset(m->data_memory, 0, (size_t)m->data_memory_size * sizeof(uint32_t));
+        parse_memory32(text, length, m->data_memory, m->data_memory_size);
         break;
-
-    case 15: // JAL
-        cpu_registers[registersUsed[0]] = *pc + 1; // Store return address
-        *pc = cpu_registers[registersUsed[3]] & 0xFFF;
-        jump_flag = 1;
+    case SIMP_IMAGE_DISK:
+        memset(m->disk_memory, 0, (size_t)m->disk_size * sizeof(uint32_t));
+        parse_memory32(text, length, m->disk_memory, m->disk_size);
         break;
-
-    case 16: // LW
-        cpu_registers[registersUsed[0]] = data_memory[cpu_registers[registersUsed[1]]
-                                          + cpu_registers[registersUsed[2]]]
-                                          + cpu_registers[registersUsed[3]];
+    default:
+        result = -1;
         break;
+    }
+    machine = previous;
+    return result;
+}
 
-    case 17: // SW
-        data_memory[cpu_registers[registersUsed[1]] + cpu_registers[registersUsed[2]]] =
-            cpu_registers[registersUsed[3]] + cpu_registers[registersUsed[0]];
-        break;
+void simp_load_instruction_words(simp_machine *m, const uint64_t *words, size_t count) {
+    machine_context *previous = machine;
 
-    case 18: // RETI
-        *pc = io_registers[IRQ_RETURN]; // Return from ISR
-        break;
+    machine = m;
+    memset(m->instruction_memory, 0, sizeof(m->image->words));
+    for (size_t i = 0; i < count && i < MEM_SIZE; i++)
+        m->instruction_memory[i] = words[i] & 0xFFFFFFFFFFFFULL; // 48 bits, as 12 hex digits of imemin.txt
+    predecode_instruction_memory();
+    machine = previous;
+}
 
-    case 19: // IN
-        if (cpu_registers[registersUsed[1]] + cpu_registers[registersUsed[2]] == MONITOR_CMD) {
-            // Reading from MONITOR_CMD always returns 0
-            cpu_registers[registersUsed[0]] = 0;
-        }
-        else {
-            cpu_registers[registersUsed[0]] =
-                io_registers[cpu_registers[registersUsed[1]] + cpu_registers[registersUsed[2]]];
-        }
-        break;
+int simp_load_data_words(simp_machine *m, int image, const uint32_t *words, size_t count) {
+    uint32_t *memory;
+    size_t size;
 
-    case 20: // OUT
-        io_registers[cpu_registers[registersUsed[1]] + cpu_registers[registersUsed[2]]] =
-            cpu_registers[registersUsed[3]];
+    switch (image) {
+    case SIMP_IMAGE_DATA:
+        memory = m->data_memory;
+        size = m->data_memory_size;
         break;
-
-    case 21: // HALT
-        halt_flag = 1;
+    case SIMP_IMAGE_DISK:
+        memory = m->disk_memory;
+        size = m->disk_size;
         break;
-
     default:
-        fprintf(stderr, "Error: Unknown opcode %d\n", opcode);
-        exit(EXIT_FAILURE);
+        return -1;
     }
+    if (count > size)
+        count = size;
+    memset(memory, 0, size * sizeof(uint32_t));
+    if (count)
+        memcpy(memory, words, count * sizeof(uint32_t));
+    return 0;
+}
 
-    // Make sure register $zero (index 0) is always 0
-    cpu_registers[0] = 0;
-    return jump_flag;
+void simp_set_callbacks(simp_machine *m, const simp_callbacks *callbacks) {
+    if (callbacks)
+        m->callbacks = *callbacks;
+    else
+        memset(&m->callbacks, 0, sizeof(m->callbacks));
 }
 
-/*
- * load_input_files:
- * ------------------
- * Loads instruction memory, data memory, disk memory, and opens irq2_file for reading.
- * argv[]: command-line arguments with file names.
- * Returns true if successful, false otherwise.
- */
-bool load_input_files(char *argv[]) {
-    irq2_file = fopen(argv[4], "r");
-    if (!irq2_file) {
-        perror("Error opening irq2in file");
-        return false;
-    }
+int simp_run_cycles(simp_machine *m, uint64_t cycles) {
+    if (m->error[0])
+        return SIMP_RUN_ERROR;
 
-    // Load instruction, data, and disk from specified input files
-    load_memory(argv[1], instruction_memory, MEM_SIZE, 12);
-    load_memory32(argv[2], data_memory, MEM_SIZE);
-    load_memory32(argv[3], disk_memory, DISK_SIZE);
+    machine_context *previous = machine;
+    machine = m;
+    machine->stop_cycle = (cycles < NO_EVENT - machine->simulated_cycles) ? machine->simulated_cycles + cycles : NO_EVENT;
+    run_simulation();
+    machine->stop_cycle = NO_EVENT;
+    machine = previous;
 
-    return true;
+    if (m->error[0])
+        return SIMP_RUN_ERROR;
+    return simp_halted(m) ? SIMP_RUN_HALTED : SIMP_RUN_LIMIT;
 }
 
-/*
- * open_output_files:
- * -------------------
- * Opens (for writing) all the required output files specified in argv[].
- * Returns true if all files could be opened, false otherwise.
- */
-bool open_output_files(char *argv[]) {
-    register_output_file = fopen(argv[6], "w");
-    trace_file = fopen(argv[7], "w");
-    hw_register_trace_file = fopen(argv[8], "w");
-    cycle_count_file = fopen(argv[9], "w");
-    led_output_file = fopen(argv[10], "w");
-    seven_segment_output_file = fopen(argv[11], "w");
-    disk_output_file = fopen(argv[12], "w");
-    monitor_output_file = fopen(argv[13], "w");
-    monitor_yuv_file = fopen(argv[14], "wb");
-
-    // Return whether all are non-NULL
-    return trace_file && hw_register_trace_file && cycle_count_file && led_output_file &&
-           seven_segment_output_file && disk_output_file && monitor_output_file && monitor_yuv_file;
+int simp_run_until_halt(simp_machine *m) {
+    return simp_run_cycles(m, UINT64_MAX);
 }
 
-/*
- * write_output_files:
- * --------------------
- * Writes final states (data memory, disk memory, CPU registers, cycle count, monitor data).
- * argv[]: command-line arguments for file names.
- * Returns true if writing is successful.
- */
-bool write_output_files(char *argv[]) {
-    // Save data memory
-    save_memory(argv[5], data_memory, MEM_SIZE);
-    // Save disk memory
-    save_memory(argv[12], disk_memory, DISK_SIZE);
-
-    // Write CPU register values (indices 3..15)
-    for (int i = 3; i < NUM_CPU_REGS; i++) {
-        fprintf(register_output_file, "%08X\n", cpu_registers[i]);
-    }
-
-    // Write cycle count to file
-    fprintf(cycle_count_file, "%d\n", io_registers[CLOCK_CYCLE]);
-
-    // Write monitor buffer in both text and YUV formats
-    write_monitor_data(monitor_output_file, monitor_yuv_file);
-
-    return true;
+void simp_raise_irq2(simp_machine *m) {
+    // Seen from the next cycle on, like an irq2in.txt event (the queue is rebuilt when the run resumes)
+    m->io_registers[IRQ2_STATUS] = 1;
 }
 
-/*
- * cleanup_files:
- * ---------------
- * Closes all file pointers used during the simulation.
- */
-void cleanup_files() {
-    fclose(trace_file);
-    fclose(hw_register_trace_file);
-    fclose(cycle_count_file);
-    fclose(led_output_file);
-    fclose(seven_segment_output_file);
-    fclose(disk_output_file);
-    fclose(monitor_output_file);
-    fclose(monitor_yuv_file);
-    fclose(irq2_file);
+uint64_t simp_cycles(const simp_machine *m) {
+    return m->simulated_cycles;
 }
 
-/*
- * get_instruction:
- * -----------------
- * Fetches instruction from instruction_memory at 'program_counter'.
- * If the disk is busy (DISK_STATUS == 1) and CPU is halted (halt_flag == 1),
- * it tries to re-fetch the same instruction. Otherwise, it just returns
- * the instruction at 'program_counter'.
- */
-uint64_t get_instruction()
-{
-    if(io_registers[DISK_STATUS] == 1 && halt_flag == 1) {
-        // Return an instruction but effectively stall by decrementing PC
-        uint64_t inst = instruction_memory[program_counter];
-        program_counter -= 1;
-        return instruction_memory[program_counter];
-    }
-    else {
-        return instruction_memory[program_counter];
-    }
+int simp_halted(const simp_machine *m) {
+    return m->halt_flag == 1 && m->io_registers[DISK_STATUS] == 0;
 }
 
-/*
- * execute_simulation_loop:
- * -------------------------
- * Main CPU execution loop. Continues until we see HALT + disk free.
- *  - Reads IRQ2 events at the right clock cycles
- *  - Fetches and decodes instructions
- *  - Logs trace
- *  - Executes instruction
- *  - Handles peripherals
- *  - Manages interrupts
- *  - Increments clock cycle, updates timer
- */
-void execute_simulation_loop() {
-    io_registers[TIMER_MAX] = 0xFFFFFFFF; // Initialize timer max
-    int interrupt_flag = 0;              // Tracks if an interrupt is triggered
-    char input_line[255];
+const char *simp_error(const simp_machine *m) {
+    return m->error[0] ? m->error : NULL;
+}
 
-    // Load next IRQ2 event into irq2_next_cycle
-    irq2_next_cycle = read_next_irq(fgets(input_line, sizeof(input_line), irq2_file));
+uint32_t simp_get_pc(const simp_machine *m) {
+    return m->program_counter;
+}
 
-    // Continue running until CPU is halted AND disk is idle
-    while (!(halt_flag == 1 && io_registers[DISK_STATUS] == 0)) {
-        // Check if it's time for an IRQ2 event
-        if (irq2_next_cycle == io_registers[CLOCK_CYCLE]) {
-            irq2_next_cycle = read_next_irq(fgets(input_line, sizeof(input_line), irq2_file));
-            io_registers[IRQ2_STATUS] = 1; // Trigger IRQ2 status
-        }
+void simp_set_pc(simp_machine *m, uint32_t pc) {
+    if (pc < MEM_SIZE)
+        m->program_counter = pc;
+}
 
-        // Fetch instruction from memory
-        uint64_t current_instruction = get_instruction();
+uint32_t simp_get_register(const simp_machine *m, int index) {
+    return (index >= 0 && index < NUM_CPU_REGS) ? m->cpu_registers[index] : 0;
+}
 
-        // Extract opcode (top 8 bits)
-        int opcode = current_instruction >> 40;
+void simp_set_register(simp_machine *m, int index, uint32_t value) {
+    if (index > 0 && index < NUM_CPU_REGS)
+        m->cpu_registers[index] = value;
+}
 
-        // Decode the rest of the 48-bit instruction
-        int operand_registers[4] = { 0 };
-        uint32_t immediate_value = decode_instruction(current_instruction, operand_registers);
-        // Split 24-bit immediate into two 12-bit parts
-        int32_t immediate1 = sign_extend((immediate_value & 0xFFF000) >> 12, 12);
-        int32_t immediate2 = sign_extend(immediate_value & 0xFFF, 12);
+uint32_t simp_get_io_register(const simp_machine *m, int index) {
+    return (index >= 0 && index < NUM_IO_REGS) ? m->io_registers[index] : 0;
+}
 
-        // Write immediate1 and immediate2 to $imm1 and $imm2 registers (indexes 1 and 2)
-        cpu_registers[1] = immediate1;
-        cpu_registers[2] = immediate2;
+void simp_set_io_register(simp_machine *m, int index, uint32_t value) {
+    if (index >= 0 && index < NUM_IO_REGS)
+        m->io_registers[index] = value;
+}
 
-        // Log instruction trace to file
-        log_instruction_trace(program_counter, current_instruction, cpu_registers);
+const char *simp_io_register_name(int index) {
+    return (index >= 0 && index < NUM_IO_REGS) ? io_register_names[index] : NULL;
+}
 
-        // Execute the current instruction, possibly modifying program_counter
-        if (!process_instruction(opcode, operand_registers, &program_counter, immediate1, immediate2)) {
-            program_counter++; // If no jump/branch occurred, move to next
-        }
+uint32_t simp_read_memory(const simp_machine *m, uint32_t address) {
+    return address < m->data_memory_size ? m->data_memory[address] : 0;
+}
 
-        // Update peripherals (disk, timer, displays, etc.)
-        handle_peripherals(opcode, operand_registers);
+void simp_write_memory(simp_machine *m, uint32_t address, uint32_t value) {
+    if (address < m->data_memory_size)
+        m->data_memory[address] = value;
+}
 
-        // Check for RETI (ends ISR) or pending interrupts
-        if (opcode == RETI_OP) {
-            isr_active_flag = 0;
-        }
-        if (!isr_active_flag) {
-            interrupt_flag = check_interrupts();
-            if (interrupt_flag) {
-                // Save return address as PC-1
-                io_registers[IRQ_RETURN] = program_counter - 1;
-                // Jump to ISR
-                program_counter = io_registers[IRQ_HANDLER];
-                isr_active_flag = 1;
-            }
-        }
+uint32_t simp_read_disk(const simp_machine *m, uint32_t address) {
+    return address < m->disk_size ? m->disk_memory[address] : 0;
+}
 
-        // Increment clock
-        increment_clock_cycle(io_registers);
-        // Update timer
-        update_timer(io_registers);
+void simp_write_disk(simp_machine *m, uint32_t address, uint32_t value) {
+    if (address < m->disk_size)
+        m->disk_memory[address] = value;
+}
 
-        // Reset monitor command after use
-        if (io_registers[MONITOR_CMD] == 1)
-            io_registers[MONITOR_CMD] = 0;
-    }
+uint8_t simp_read_monitor(const simp_machine *m, uint32_t pixel) {
+    return pixel < MONITOR_SIZE ? m->monitor_buffer[pixel] : 0;
 }
 
+#ifndef SIMP_LIBRARY
 /*
  * main:
  * ------
- * Entry point. Expects 15 arguments for file input/output.
+ * Entry point. Expects 15 arguments for file input/output, plus optional '--' switches
+ * (see parse_options), or only switches including --batch (see run_batch).
  *  1) imemin.txt
  *  2) dmemin.txt
  *  3) diskin.txt
@@ -853,38 +5415,54 @@ void execute_simulation_loop() {
  * 12) diskout.txt
  * 13) monitor.txt
  * 14) monitor.yuv
+ * The input files (1-4) may also be pipes or FIFOs, and one of them may be '-' (stdin);
+ * irq2in.txt is then read while the simulation runs (see irq2_feed_next).
  */
 int main(int argc, char *argv[]) {
-    // Check argument count
-    if (argc != 15) {
-        fprintf(stderr, "Usage: %s <imemin.txt> <dmemin.txt> <diskin.txt> <irq2in.txt> <dmemout.txt> "
+    // Strip the optional switches, then check argument count
+    argc = parse_options(argc, argv);
+    if (batch_file_name && argc == 1)
+        return run_batch(batch_file_name) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (argc != 15 || batch_file_name) {
+        fprintf(stderr, "Usage: %s [options] <imemin.txt> <dmemin.txt> <diskin.txt> <irq2in.txt> <dmemout.txt> "
                         "<regout.txt> <trace.txt> <hwregtrace.txt> <cycles.txt> <leds.txt> "
-                        "<display7seg.txt> <diskout.txt> <monitor.txt> <monitor.yuv>\n", argv[0]);
-        return EXIT_FAILURE;
-    }
-
-    // Load input files (instruction, data, disk, irq2)
-    if (!load_input_files(argv)) {
-        fprintf(stderr, "Error loading input files. Exiting.\n");
-        return EXIT_FAILURE;
-    }
-
-    // Open output files for writing
-    if (!open_output_files(argv)) {
-        fprintf(stderr, "Error opening output files. Exiting.\n");
+                        "<display7seg.txt> <diskout.txt> <monitor.txt> <monitor.yuv>\n"
+                        "       %s [options] --batch=MANIFEST\n"
+                        "Options:\n"
+                        "  --engine=switch|threaded|block|jit   Select the execution engine (default: switch)\n"
+                        "  --batch=MANIFEST                     Run every job (line of 14 file names) of MANIFEST\n"
+                        "  --jobs=N                             Worker threads for --batch (default: one per CPU)\n"
+                        "  --checkpoint-at=CYCLE                Save the machine state at the start of CYCLE\n"
+                        "  --checkpoint-file=FILE               Checkpoint file (default: " CHECKPOINT_DEFAULT_FILE ")\n"
+                        "  --restore=FILE                       Continue a run from a checkpoint\n"
+                        "  --data-memory=WORDS                  Data memory size (default: 4096)\n"
+                        "  --disk-sectors=N                     Disk size in sectors (default: 128)\n"
+                        "  --sector-words=WORDS                 Sector size (default: 128)\n"
+                        "  --disk-image=FILE                    Map the binary disk image FILE (created from diskin.txt)\n"
+                        "  --disk-export                        With --disk-image, also write diskout.txt\n"
+                        "  --trace-format=text|binary|none      Trace file format (binary: decode with tracedec)\n"
+                        "  --symbols=FILE                       Label map from the assembler (for --trace-pc and profiles)\n"
+                        "  --metrics=FILE                       Write runtime metrics as JSON to FILE at exit\n"
+                        "  --metrics-prometheus=FILE            Write the metrics as a Prometheus textfile\n"
+                        "  --metrics-interval=CYCLES            Also rewrite the metrics files every CYCLES cycles\n"
+                        "  --profile=FILE                       Write cycles per label, opcode and address to FILE\n"
+                        "  --profile-folded=FILE                Write folded call stacks (for flamegraph tools) to FILE\n"
+                        "  --trace-pc=FROM-TO|LABEL|ADDRESS     Only trace instructions in this PC range\n"
+                        "  --trace-cycles=FROM-[TO]             Only trace this window of clock cycles\n"
+                        "  --trace-on-irq=0|1|2                 Start tracing on the first interrupt of this IRQ\n"
+                        "  --trace-on-write=REGISTER            Start tracing on the first OUT to this I/O register\n"
+                        "  --trace-history=N                    Also trace the N instructions before the trace opens\n",
+                argv[0], argv[0]);
         return EXIT_FAILURE;
     }
 
-    // Run the main simulation
-    execute_simulation_loop();
-
-    // Write all final data to the respective output files
-    if (!write_output_files(argv)) {
-        fprintf(stderr, "Error writing output files. Exiting.\n");
+    machine = create_machine();
+    if (!machine) {
+        fprintf(stderr, "Error: Out of memory\n");
         return EXIT_FAILURE;
     }
-
-    // Close all file pointers
-    cleanup_files();
-    return EXIT_SUCCESS;
+    bool succeeded = run_job(argv);
+    destroy_machine(machine);
+    return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+#endif
@@ -0,0 +1,113 @@
+#ifndef SIMP_H
+#define SIMP_H
+
+#include <stddef.h>     // For size_t
+#include <stdint.h>     // For fixed-width integer types
+
+/*
+ * simp.h:
+ * --------
+ * Embedding interface of the SIMP simulator. Build sim.c with -DSIMP_LIBRARY (which
+ * leaves out its main) and link it into the host program:
+ *
+ *     gcc -O2 -DSIMP_LIBRARY -c sim.c -o simp.o
+ *
+ * A simp_machine is one simulated machine. It starts in the same power-on state
+ * as a command-line run, is loaded from memory buffers instead of files, runs a
+ * given number of cycles at a time and reports its outputs through callbacks. No
+ * function exits the process: errors are returned and described by simp_error.
+ *
+ * Every machine is independent, so different threads may run different machines
+ * at the same time. A machine must not be used by two threads at once, and a
+ * callback must not call back into the machine that invoked it (other machines
+ * are fine).
+ */
+
+typedef struct simp_machine simp_machine;
+
+// Execution engines (as --engine=switch|threaded|block|jit)
+#define SIMP_ENGINE_SWITCH 0
+#define SIMP_ENGINE_THREADED 1
+#define SIMP_ENGINE_BLOCK 2
+#define SIMP_ENGINE_JIT 3
+
+// Images accepted by simp_load (in the text format of the matching input file)
+#define SIMP_IMAGE_INSTRUCTIONS 0   // imemin.txt: one 12-digit hex word per line
+#define SIMP_IMAGE_DATA 1           // dmemin.txt: one 8-digit hex word per line
+#define SIMP_IMAGE_DISK 2           // diskin.txt: one 8-digit hex word per line
+
+// Results of simp_run_cycles / simp_run_until_halt
+#define SIMP_RUN_HALTED 0           // The program halted and the disk is idle
+#define SIMP_RUN_LIMIT 1            // The requested number of cycles ran
+#define SIMP_RUN_ERROR -1           // The run stopped on an error: an unknown opcode, an
+                                    // lw/sw outside data memory or an in/out to an I/O
+                                    // register index past the last one (see simp_error)
+
+// Output events. Each callback may be NULL; 'context' is passed to all of them.
+typedef struct {
+    void *context;
+
+    // One trace.txt line: the instruction at 'pc' and the 16 registers as traced
+    void (*trace)(void *context, uint32_t pc, uint64_t instruction, const uint32_t *registers);
+
+    // One hwregtrace.txt line: IN (is_write = 0) or OUT (is_write = 1) of an I/O register
+    void (*io_access)(void *context, uint32_t clock, int is_write, int io_register, uint32_t value);
+
+    // One leds.txt / display7seg.txt line: the new register value written at 'clock'
+    void (*leds)(void *context, uint32_t clock, uint32_t value);
+    void (*display7seg)(void *context, uint32_t clock, uint32_t value);
+} simp_callbacks;
+
+/*
+ * Lifetime and setup:
+ *   simp_create                  New machine in its power-on state (NULL if out of memory)
+ *   simp_destroy                 Frees a machine
+ *   simp_load                    Replaces an image with 'length' bytes of text; returns 0,
+ *                                or -1 for an unknown image
+ *   simp_load_instruction_words  Replaces the instruction image with 'count' encoded
+ *                                instructions (as assembled by simpasm_assemble, simpasm.h)
+ *   simp_load_data_words         Replaces the data or disk image with 'count' words; returns
+ *                                0, or -1 for another image
+ *   simp_set_callbacks           Sets the output callbacks (copied; NULL removes them all)
+ * Words past the end of an image are ignored and the rest of the image reads as 0.
+ */
+simp_machine *simp_create(int engine);
+void simp_destroy(simp_machine *m);
+int simp_load(simp_machine *m, int image, const char *text, size_t length);
+void simp_load_instruction_words(simp_machine *m, const uint64_t *words, size_t count);
+int simp_load_data_words(simp_machine *m, int image, const uint32_t *words, size_t count);
+void simp_set_callbacks(simp_machine *m, const simp_callbacks *callbacks);
+
+/*
+ * Running (each call continues where the previous one stopped):
+ *   simp_run_cycles      Runs at most 'cycles' cycles
+ *   simp_run_until_halt  Runs until HALT with the disk idle
+ *   simp_raise_irq2      Sets irq2status, as an irq2in.txt event at the current cycle would
+ */
+int simp_run_cycles(simp_machine *m, uint64_t cycles);
+int simp_run_until_halt(simp_machine *m);
+void simp_raise_irq2(simp_machine *m);
+
+/*
+ * State, read and written between runs. Out-of-range indexes and addresses read
+ * as 0 and ignore writes; $zero, $imm1 and $imm2 are overwritten by every
+ * instruction. simp_cycles counts cycles run, simp_halted is 1 once the program
+ * halted and the disk is idle, simp_error is NULL unless a run failed.
+ */
+uint64_t simp_cycles(const simp_machine *m);
+int simp_halted(const simp_machine *m);
+const char *simp_error(const simp_machine *m);
+uint32_t simp_get_pc(const simp_machine *m);
+void simp_set_pc(simp_machine *m, uint32_t pc);
+uint32_t simp_get_register(const simp_machine *m, int index);
+void simp_set_register(simp_machine *m, int index, uint32_t value);
+uint32_t simp_get_io_register(const simp_machine *m, int index);
+void simp_set_io_register(simp_machine *m, int index, uint32_t value);
+const char *simp_io_register_name(int index);
+uint32_t simp_read_memory(const simp_machine *m, uint32_t address);
+void simp_write_memory(simp_machine *m, uint32_t address, uint32_t value);
+uint32_t simp_read_disk(const simp_machine *m, uint32_t address);
+void simp_write_disk(simp_machine *m, uint32_t address, uint32_t value);
+uint8_t simp_read_monitor(const simp_machine *m, uint32_t pixel);
+
+#endif
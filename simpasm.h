@@ -0,0 +1,43 @@
+#ifndef SIMPASM_H
+#define SIMPASM_H
+
+#include <stddef.h>     // For size_t
+#include <stdint.h>     // For fixed-width integer types
+
+/*
+ * simpasm.h:
+ * -----------
+ * Library interface of the SIMP assembler. Build asm.c with -DSIMPASM_LIBRARY (which
+ * leaves out its main) and link it into the host program:
+ *
+ *     gcc -O2 -DSIMPASM_LIBRARY -c asm.c -o simpasm.o
+ *
+ * simpasm_assemble takes the source text from memory and produces the two images
+ * the command-line assembler writes to imemin.txt and dmemin.txt, as word arrays
+ * that simp_load_instruction_words and simp_load_data_words (simp.h) take as they
+ * are. No function exits the process: errors are returned in the program.
+ *
+ * The assembler keeps its tables in globals, so only one thread may assemble at a
+ * time (the assembled programs may then run on any number of machines).
+ */
+
+#define SIMPASM_ERROR_LEN 128
+
+// An assembled program
+typedef struct {
+    uint64_t *instructions;             // Encoded instructions in program order (imemin.txt)
+    size_t instruction_count;
+    uint32_t *data;                     // Data memory from address 0 up to the last .word (dmemin.txt)
+    size_t data_count;
+    char error[SIMPASM_ERROR_LEN];      // Why assembly failed ("" = it did not)
+} simpasm_program;
+
+/*
+ *   simpasm_assemble  Assembles 'length' bytes of source into 'program'; returns 0, or -1
+ *                     with the message (as asm prints it, without "Error: ") in program->error
+ *   simpasm_free      Frees the images of a program
+ */
+int simpasm_assemble(const char *source, size_t length, simpasm_program *program);
+void simpasm_free(simpasm_program *program);
+
+#endif
@@ -0,0 +1,475 @@
+// Disable secure warnings on Windows (allows use of functions like 'fopen' without warnings).
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>      // For file I/O (fopen, fprintf)
+#include <stdarg.h>     // For the variable arguments of emit
+#include <stdlib.h>     // For exit, strtol, strtoull
+#include <string.h>     // For strncmp, strchr
+#include <stdint.h>     // For fixed-width integer types
+
+/*
+ * simpgen:
+ * ---------
+ * Generates synthetic SIMP workloads: an assembly program for asm together with
+ * a matching irq2in.txt, diskin.txt and (optionally) dmemin.txt. The program is
+ * a nest of counted loops around a random straight-line body with a chosen
+ * instruction mix; it sweeps a working set of data memory, may issue disk
+ * commands at a fixed rate and takes IRQ2 interrupts at a chosen density. The
+ * same options and seed always give the same files.
+ *
+ * Register use in the generated code:
+ *   $a0 $a1 $a2 $t0 $t1 $t2   scratch values the body computes on
+ *   $s0 $s1 $s2 $gp           loop counters (outermost first)
+ *   $sp                       base of the current 64-word window of the working set
+ *   $ra                       window mask (working set - 64)
+ *   $v0                       interrupt handler only
+ */
+
+#define MEM_SIZE 4096           // Words of instruction and data memory (as in sim.c)
+#define SECTOR_WORDS 128        // Words per disk sector
+#define DISK_SECTORS_USED 64    // Sectors the generated disk commands address (0..63)
+#define WINDOW_WORDS 64         // Words reachable from $sp with a 0..63 offset
+#define MAX_LOOP_DEPTH 4
+#define MAX_IMMEDIATE 2047      // Largest positive 12-bit immediate
+#define PROGRAM_OVERHEAD 64     // Instruction words reserved for prologue, loops, disk code and halt
+
+// I/O register indexes used by the generated code
+#define IO_IRQ2_ENABLE 2
+#define IO_IRQ2_STATUS 5
+#define IO_IRQ_HANDLER 6
+#define IO_CLKS 8
+#define IO_LEDS 9
+#define IO_DISPLAY_7SEG 10
+#define IO_TIMER_CURRENT 12
+#define IO_DISK_CMD 14
+#define IO_DISK_SECTOR 15
+#define IO_DISK_BUFFER 16
+#define IO_DISK_STATUS 17
+#define IO_MONITOR_ADDR 20
+#define IO_MONITOR_DATA 21
+#define IO_MONITOR_CMD 22
+
+// Instruction classes of --mix
+#define CLASS_ALU 0
+#define CLASS_MAC 1
+#define CLASS_BRANCH 2
+#define CLASS_MEMORY 3
+#define CLASS_IO 4
+#define NUM_CLASSES 5
+
+const char *scratch_registers[] = { "$a0", "$a1", "$a2", "$t0", "$t1", "$t2" };
+const char *loop_registers[MAX_LOOP_DEPTH] = { "$s0", "$s1", "$s2", "$gp" };
+const char *alu_opcodes[] = { "add", "sub", "and", "or", "xor", "sll", "sra", "srl" };
+
+// Globals for the options
+uint64_t seed = 1;                      // --seed
+int body_length = 64;                   // --body: instructions per innermost iteration
+int mix[NUM_CLASSES] = { 50, 10, 15, 20, 5 }; // --mix: weights of alu, mac, branch, memory, io
+int loop_depth = 2;                     // --loops
+int loop_iterations = 100;              // --iterations: per loop level
+int working_set = 1024;                 // --working-set: words, power of two
+uint64_t irq_interval = 0;              // --irq-interval: mean cycles between IRQ2 events (0 = none)
+int handler_length = 8;                 // --handler: ALU instructions in the IRQ2 handler
+int disk_interval = 0;                  // --disk-interval: innermost iterations between disk commands (0 = none)
+
+// Generator state
+uint64_t random_state;
+FILE *program = NULL;
+int next_label = 0;                     // Number of the next SkipN label
+int emitted_instructions = 0;           // Instruction words written so far
+uint64_t data_random_state;             // Generator state the working-set values were drawn from
+
+/*
+ * next_random / random_below:
+ * ----------------------------
+ * xorshift64* generator seeded by --seed, so every run of the same options
+ * writes the same files.
+ */
+uint64_t next_random() {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+int random_below(int limit) {
+    return (int)(next_random() % (uint64_t)limit);
+}
+
+const char *random_scratch() {
+    return scratch_registers[random_below(6)];
+}
+
+/*
+ * emit:
+ * ------
+ * Writes one instruction line and counts it.
+ */
+void emit(const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    fputc('\t', program);
+    vfprintf(program, format, arguments);
+    fputc('\n', program);
+    va_end(arguments);
+    emitted_instructions++;
+}
+
+/*
+ * emit_body_instruction:
+ * -----------------------
+ * Writes one instruction of the given class. Returns the number of following
+ * instructions a branch skips (0 for everything else), so the caller can place
+ * its label.
+ */
+int emit_body_instruction(int instruction_class) {
+    switch (instruction_class) {
+    case CLASS_ALU: {
+        int opcode = random_below(8);
+        if (opcode >= 5) // Shifts by a constant 0..31 (a register amount could exceed 31)
+            emit("%s %s, %s, $imm1, $zero, %d, 0", alu_opcodes[opcode], random_scratch(), random_scratch(), random_below(32));
+        else if (random_below(2))
+            emit("%s %s, %s, %s, $zero, 0, 0", alu_opcodes[opcode], random_scratch(), random_scratch(), random_scratch());
+        else
+            emit("%s %s, %s, $imm1, $zero, %d, 0", alu_opcodes[opcode], random_scratch(), random_scratch(),
+                 random_below(2 * MAX_IMMEDIATE + 1) - MAX_IMMEDIATE);
+        return 0;
+    }
+    case CLASS_MAC:
+        emit("mac %s, %s, %s, %s, 0, 0", random_scratch(), random_scratch(), random_scratch(), random_scratch());
+        return 0;
+    case CLASS_BRANCH: {
+        // Forward branch over 1..3 instructions, taken depending on the data
+        const char *conditions[] = { "beq", "bne", "blt", "bgt", "ble", "bge" };
+        emit("%s $zero, %s, %s, $imm2, 0, Skip%d", conditions[random_below(6)], random_scratch(), random_scratch(), next_label);
+        return 1 + random_below(3);
+    }
+    case CLASS_MEMORY:
+        emit("%s %s, $sp, $imm1, $zero, %d, 0", random_below(2) ? "lw" : "sw", random_scratch(), random_below(WINDOW_WORDS));
+        return 0;
+    default:
+        switch (random_below(4)) {
+        case 0:
+            emit("out $zero, $imm1, $zero, %s, %d, 0", random_scratch(), IO_LEDS);
+            break;
+        case 1:
+            emit("out $zero, $imm1, $zero, %s, %d, 0", random_scratch(), IO_DISPLAY_7SEG);
+            break;
+        case 2:
+            emit("in %s, $imm1, $zero, $zero, %d, 0", random_scratch(), random_below(2) ? IO_CLKS : IO_TIMER_CURRENT);
+            break;
+        default: {
+            // One monitor pixel: address (masked to 0..0xFFFF by shifting out the upper
+            // half, as the 12-bit immediate cannot hold the mask), 8-bit luma, write command
+            const char *address = random_scratch(), *luma = random_scratch();
+            emit("sll %s, %s, $imm1, $zero, 16, 0", address, address);
+            emit("srl %s, %s, $imm1, $zero, 16, 0", address, address);
+            emit("out $zero, $imm1, $zero, %s, %d, 0", address, IO_MONITOR_ADDR);
+            emit("and %s, %s, $imm1, $zero, 255, 0", luma, luma);
+            emit("out $zero, $imm1, $zero, %s, %d, 0", luma, IO_MONITOR_DATA);
+            emit("out $zero, $imm1, $zero, $imm2, %d, 1", IO_MONITOR_CMD);
+            break;
+        }
+        }
+        return 0;
+    }
+}
+
+/*
+ * emit_body:
+ * -----------
+ * Writes the random straight-line body (with its forward branches) of the
+ * innermost loop, drawing each instruction class by the --mix weights.
+ */
+void emit_body() {
+    int total_weight = 0;
+    for (int i = 0; i < NUM_CLASSES; i++)
+        total_weight += mix[i];
+
+    int label_at[MEM_SIZE];     // Body index each pending label goes in front of
+    int label_number[MEM_SIZE];
+    int pending = 0;
+
+    int start = emitted_instructions;
+    while (emitted_instructions - start < body_length) {
+        int index = emitted_instructions - start;
+        for (int i = 0; i < pending;) {
+            if (label_at[i] <= index) {
+                fprintf(program, "Skip%d:\n", label_number[i]);
+                pending--;
+                label_at[i] = label_at[pending];
+                label_number[i] = label_number[pending];
+            }
+            else
+                i++;
+        }
+
+        int pick = random_below(total_weight), instruction_class = 0;
+        while (pick >= mix[instruction_class])
+            pick -= mix[instruction_class++];
+
+        int skipped = emit_body_instruction(instruction_class);
+        if (skipped) {
+            label_at[pending] = emitted_instructions - start + skipped;
+            label_number[pending++] = next_label++;
+        }
+    }
+
+    // Branches near the end land after the body
+    for (int i = 0; i < pending; i++)
+        fprintf(program, "Skip%d:\n", label_number[i]);
+}
+
+/*
+ * write_program:
+ * ---------------
+ * Writes the whole program: prologue (window mask, interrupt handler address,
+ * scratch values, working-set data), the loop nest with the body, the disk
+ * command block, HALT, and the IRQ2 handler.
+ */
+void write_program(const char *filename) {
+    program = fopen(filename, "w");
+    if (!program) {
+        perror("Error opening program file");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(program, "# Generated by simpgen --seed=%llu --body=%d --mix=%d,%d,%d,%d,%d --loops=%d --iterations=%d "
+                     "--working-set=%d --irq-interval=%llu --handler=%d --disk-interval=%d\n",
+            (unsigned long long)seed, body_length, mix[0], mix[1], mix[2], mix[3], mix[4], loop_depth, loop_iterations,
+            working_set, (unsigned long long)irq_interval, handler_length, disk_interval);
+
+    // $ra = working set - 64: keeps $sp on a window that lies inside the working set
+    emit("add $ra, $zero, $imm1, $zero, %d, 0", working_set / WINDOW_WORDS - 1);
+    emit("sll $ra, $ra, $imm1, $zero, 6, 0");
+    emit("add $sp, $zero, $zero, $zero, 0, 0");
+    if (irq_interval) {
+        emit("out $zero, $imm1, $zero, $imm2, %d, IrqHandler", IO_IRQ_HANDLER);
+        emit("out $zero, $imm1, $zero, $imm2, %d, 1", IO_IRQ2_ENABLE);
+    }
+    for (int i = 0; i < 6; i++)
+        emit("add %s, $zero, $imm1, $zero, %d, 0", scratch_registers[i], random_below(2 * MAX_IMMEDIATE + 1) - MAX_IMMEDIATE);
+
+    // Loop nest: each level counts its register down from --iterations
+    for (int level = 0; level < loop_depth; level++) {
+        emit("add %s, $zero, $imm1, $zero, %d, 0", loop_registers[level], loop_iterations);
+        fprintf(program, "Loop%d:\n", level);
+    }
+
+    emit_body();
+
+    // Next window of the working set
+    emit("add $sp, $sp, $imm1, $zero, %d, 0", WINDOW_WORDS);
+    emit("and $sp, $sp, $ra, $zero, 0, 0");
+
+    // Every --disk-interval iterations: read or write a sector at address 0 if the disk is idle
+    if (disk_interval) {
+        const char *counter = loop_registers[loop_depth - 1];
+        emit("and $t2, %s, $imm1, $zero, %d, 0", counter, disk_interval - 1);
+        emit("bne $zero, $t2, $zero, $imm2, 0, NoDisk");
+        emit("in $t2, $imm1, $zero, $zero, %d, 0", IO_DISK_STATUS);
+        emit("bne $zero, $t2, $zero, $imm2, 0, NoDisk");
+        emit("srl $t1, $sp, $imm1, $zero, 6, 0");
+        emit("and $t1, $t1, $imm1, $zero, %d, 0", DISK_SECTORS_USED - 1);
+        emit("out $zero, $imm1, $zero, $t1, %d, 0", IO_DISK_SECTOR);
+        emit("out $zero, $imm1, $zero, $zero, %d, 0", IO_DISK_BUFFER);
+        emit("and $t2, $t1, $imm1, $zero, 1, 0");
+        emit("add $t2, $t2, $imm1, $zero, 1, 0");
+        emit("out $zero, $imm1, $zero, $t2, %d, 0", IO_DISK_CMD);
+        fprintf(program, "NoDisk:\n");
+    }
+
+    for (int level = loop_depth - 1; level >= 0; level--) {
+        emit("sub %s, %s, $imm1, $zero, 1, 0", loop_registers[level], loop_registers[level]);
+        emit("bgt $zero, %s, $zero, $imm2, 0, Loop%d", loop_registers[level], level);
+    }
+    emit("halt $zero, $zero, $zero, $zero, 0, 0");
+
+    // IRQ2 handler: acknowledge, then work on the word at address 0 with $v0 only
+    if (irq_interval) {
+        fprintf(program, "IrqHandler:\n");
+        emit("out $zero, $imm1, $zero, $zero, %d, 0", IO_IRQ2_STATUS);
+        emit("lw $v0, $zero, $zero, $zero, 0, 0");
+        for (int i = 0; i < handler_length; i++)
+            emit("%s $v0, $v0, $imm1, $zero, %d, 0", alu_opcodes[random_below(5)], 1 + random_below(MAX_IMMEDIATE));
+        emit("sw $v0, $zero, $zero, $zero, 0, 0");
+        emit("reti $zero, $zero, $zero, $zero, 0, 0");
+    }
+
+    // Working-set contents (asm writes them to its dmemin.txt)
+    data_random_state = random_state;
+    for (int address = 0; address < working_set; address++)
+        fprintf(program, "\t.word %d %u\n", address, (uint32_t)next_random() | 1u);
+
+    fclose(program);
+    if (emitted_instructions > MEM_SIZE) {
+        fprintf(stderr, "Error: The program takes %d words, more than the %d of instruction memory\n",
+                emitted_instructions, MEM_SIZE);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * write_dmemin:
+ * --------------
+ * Writes dmemin.txt exactly as asm produces it from the program's .word lines
+ * (replays the generator from the state the values were drawn from).
+ */
+void write_dmemin(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        perror("Error opening dmemin file");
+        exit(EXIT_FAILURE);
+    }
+    random_state = data_random_state;
+    for (int address = 0; address < working_set; address++)
+        fprintf(file, "%08X\n", (uint32_t)next_random() | 1u);
+    fclose(file);
+}
+
+/*
+ * write_diskin:
+ * --------------
+ * Writes random contents for the sectors the disk commands address.
+ */
+void write_diskin(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        perror("Error opening diskin file");
+        exit(EXIT_FAILURE);
+    }
+    for (int word = 0; word < DISK_SECTORS_USED * SECTOR_WORDS; word++)
+        fprintf(file, "%08X\n", (uint32_t)next_random());
+    fclose(file);
+}
+
+/*
+ * estimated_cycles:
+ * ------------------
+ * Rough cycle count of the program (the loop nest times the innermost iteration),
+ * used to size irq2in.txt.
+ */
+uint64_t estimated_cycles() {
+    uint64_t iterations = 1;
+    for (int level = 0; level < loop_depth; level++)
+        iterations *= (uint64_t)loop_iterations;
+    return iterations * (uint64_t)(body_length + 6 + (disk_interval ? 4 : 0)) + PROGRAM_OVERHEAD;
+}
+
+/*
+ * write_irq2in:
+ * --------------
+ * Writes IRQ2 arrival cycles: one every --irq-interval cycles on average (each gap
+ * drawn between half and one and a half times the interval) up to the estimated
+ * end of the program. Empty without --irq-interval.
+ */
+void write_irq2in(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        perror("Error opening irq2in file");
+        exit(EXIT_FAILURE);
+    }
+    if (irq_interval) {
+        uint64_t end = estimated_cycles();
+        for (uint64_t cycle = irq_interval; cycle < end && cycle <= UINT32_MAX;
+             cycle += irq_interval / 2 + next_random() % (irq_interval + 1))
+            fprintf(file, "%llu\n", (unsigned long long)cycle);
+    }
+    fclose(file);
+}
+
+/*
+ * parse_mix:
+ * -----------
+ * Reads --mix=ALU,MAC,BRANCH,MEMORY,IO (non-negative weights, not all zero).
+ */
+int parse_mix(const char *text) {
+    int total = 0;
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        char *end;
+        long weight = strtol(text, &end, 10);
+        if (end == text || weight < 0 || weight > 1000000 || (i < NUM_CLASSES - 1 ? *end != ',' : *end != '\0'))
+            return 0;
+        mix[i] = (int)weight;
+        total += mix[i];
+        text = end + 1;
+    }
+    return total > 0;
+}
+
+/*
+ * main:
+ * ------
+ *  simpgen [options] <program.asm> <irq2in.txt> <diskin.txt> [dmemin.txt]
+ *   --seed=N             Random seed (default 1)
+ *   --body=N             Instructions in the innermost loop body (default 64)
+ *   --mix=A,M,B,L,I      Weights of ALU, mac, branch, lw/sw and in/out instructions (default 50,10,15,20,5)
+ *   --loops=D            Loop nesting depth, 1..4 (default 2)
+ *   --iterations=N       Iterations of every loop, 1..2047 (default 100)
+ *   --working-set=WORDS  Data words swept by lw/sw, a power of two 64..4096 (default 1024)
+ *   --irq-interval=N     Mean cycles between IRQ2 events (default 0 = no interrupts)
+ *   --handler=N          ALU instructions in the IRQ2 handler (default 8)
+ *   --disk-interval=N    Innermost iterations between disk commands, a power of two (default 0 = none)
+ */
+int main(int argc, char *argv[]) {
+    const char *files[4] = { NULL };
+    int file_count = 0, valid = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *argument = argv[i];
+        const char *value = strchr(argument, '=');
+        long number = value ? strtol(value + 1, NULL, 0) : 0;
+        if (strncmp(argument, "--seed=", 7) == 0)
+            seed = strtoull(value + 1, NULL, 0);
+        else if (strncmp(argument, "--body=", 7) == 0 && number > 0 && number <= MEM_SIZE)
+            body_length = (int)number;
+        else if (strncmp(argument, "--mix=", 6) == 0 && parse_mix(value + 1))
+            ;
+        else if (strncmp(argument, "--loops=", 8) == 0 && number >= 1 && number <= MAX_LOOP_DEPTH)
+            loop_depth = (int)number;
+        else if (strncmp(argument, "--iterations=", 13) == 0 && number >= 1 && number <= MAX_IMMEDIATE)
+            loop_iterations = (int)number;
+        else if (strncmp(argument, "--working-set=", 14) == 0 && number >= WINDOW_WORDS && number <= MEM_SIZE
+                 && (number & (number - 1)) == 0)
+            working_set = (int)number;
+        else if (strncmp(argument, "--irq-interval=", 15) == 0 && number >= 0)
+            irq_interval = (uint64_t)number;
+        else if (strncmp(argument, "--handler=", 10) == 0 && number >= 0 && number <= 256)
+            handler_length = (int)number;
+        else if (strncmp(argument, "--disk-interval=", 16) == 0 && number >= 0 && number <= MAX_IMMEDIATE + 1
+                 && (number & (number - 1)) == 0)
+            disk_interval = (int)number;
+        else if (strncmp(argument, "--", 2) != 0 && file_count < 4)
+            files[file_count++] = argument;
+        else {
+            fprintf(stderr, "Error: Invalid option '%s'\n", argument);
+            valid = 0;
+        }
+    }
+
+    if (!valid || file_count < 3) {
+        fprintf(stderr, "Usage: %s [options] <program.asm> <irq2in.txt> <diskin.txt> [dmemin.txt]\n"
+                        "  --seed=N             Random seed (default 1)\n"
+                        "  --body=N             Instructions in the innermost loop body (default 64)\n"
+                        "  --mix=A,M,B,L,I      Weights of ALU, mac, branch, lw/sw, in/out (default 50,10,15,20,5)\n"
+                        "  --loops=D            Loop nesting depth, 1..4 (default 2)\n"
+                        "  --iterations=N       Iterations of every loop, 1..2047 (default 100)\n"
+                        "  --working-set=WORDS  Data words swept by lw/sw, power of two 64..4096 (default 1024)\n"
+                        "  --irq-interval=N     Mean cycles between IRQ2 events (default 0 = none)\n"
+                        "  --handler=N          ALU instructions in the IRQ2 handler (default 8)\n"
+                        "  --disk-interval=N    Innermost iterations between disk commands, power of two (default 0 = none)\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    random_state = seed * 0x9E3779B97F4A7C15ULL + 1; // Never 0
+    write_program(files[0]);
+    write_irq2in(files[1]);
+    write_diskin(files[2]);
+    if (files[3])
+        write_dmemin(files[3]);
+
+    printf("%s: %d instruction words, about %llu cycles\n", files[0], emitted_instructions,
+           (unsigned long long)estimated_cycles());
+    return EXIT_SUCCESS;
+}
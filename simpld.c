@@ -0,0 +1,471 @@
+// Disable secure warnings on Windows (allows use of functions like 'fopen' without warnings).
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>      // For file I/O (fopen, fread, fprintf)
+#include <stdlib.h>     // For exit, realloc, strtol, strtoull
+#include <string.h>     // For strcmp, strchr, strncmp
+#include <stdint.h>     // For fixed-width integer types
+#include <stdbool.h>    // For bool
+
+/*
+ * simpld:
+ * --------
+ * Links the object files written by 'asm -c' into the imemin.txt and dmemin.txt
+ * that asm writes for a single source. A program split into modules (say a main
+ * program and its interrupt handler) is built as:
+ *
+ *     ./asm -c --cache=.simpcache main.asm main.obj
+ *     ./asm -c --cache=.simpcache isr.asm isr.obj
+ *     ./simpld --symbols=symbols.txt imemin.txt dmemin.txt main.obj isr.obj
+ *
+ * With --cache, a module is only assembled again when its source changed. The
+ * code of the modules is placed one after the other in argument order, so the
+ * first module holds the program entry at address 0. Every label immediate is
+ * then patched with the final address of its label: the module's own label of
+ * that name if it has one, else the '.global' label of that name. Data keeps its
+ * '.word' addresses; two modules setting the same word is an error. Linking the
+ * object of a single source gives exactly the files asm writes for that source.
+ * In the --symbols map, a local label whose name another module also uses is
+ * qualified with its module (see write_symbol).
+ */
+
+#define OBJECT_FORMAT "SIMPOBJ 1"   // First line of an object file (must match asm.c)
+#define ADDRESS_MASK 0xFFF          // Width of an immediate field
+
+// A label, at its final address
+typedef struct {
+    char *name;
+    uint32_t address;
+    uint32_t module;                // Index of the defining object file
+    bool global;                    // Exported by '.global'
+} symbol;
+
+// An immediate field to patch with the final address of a label
+typedef struct {
+    uint32_t instruction;           // Final address of the instruction
+    int shift;                      // 12 for imm1, 0 for imm2
+    char *name;
+    uint32_t module;                // Index of the object file that uses the label
+} relocation;
+
+// Globals
+char **module_files = NULL;         // Object files, in link order
+uint32_t module_count = 0;
+uint64_t *code = NULL;              // Linked instruction memory
+uint32_t code_size = 0;
+uint32_t code_capacity = 0;
+uint32_t *data = NULL;              // Linked data memory
+uint32_t data_size = 0;             // dmemin.txt lines (the largest size any module needs)
+uint32_t data_capacity = 0;
+symbol *symbols = NULL;
+uint32_t symbol_count = 0;
+uint32_t symbol_capacity = 0;
+uint32_t *symbol_table = NULL;      // Open-addressing hash of symbols by name (index + 1, 0 = empty)
+uint32_t symbol_table_size = 0;
+relocation *relocations = NULL;
+uint32_t relocation_count = 0;
+uint32_t relocation_capacity = 0;
+
+/*
+ * grow:
+ * ------
+ * Makes room for 'count' elements of 'size' bytes in the array at '*array',
+ * doubling its capacity as needed.
+ */
+void grow(void *array, uint32_t *capacity, uint32_t count, size_t size) {
+    if (count <= *capacity)
+        return;
+    uint32_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < count)
+        new_capacity *= 2;
+    void *grown = realloc(*(void **)array, (size_t)new_capacity * size);
+    if (!grown) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    *(void **)array = grown;
+    *capacity = new_capacity;
+}
+
+/*
+ * invalid_object:
+ * ----------------
+ * Reports a malformed object file and exits.
+ */
+void invalid_object(const char *filename) {
+    fprintf(stderr, "Error: Invalid object file '%s'\n", filename);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * read_file:
+ * -----------
+ * Reads a whole file into memory, NUL-terminated.
+ */
+char *read_file(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    char *text = NULL;
+    uint32_t capacity = 0, size = 0;
+    size_t got;
+    do {
+        grow(&text, &capacity, size + 65536, 1);
+        got = fread(text + size, 1, capacity - size - 1, file);
+        size += (uint32_t)got;
+    } while (got > 0);
+    fclose(file);
+    text[size] = '\0';
+    return text;
+}
+
+/*
+ * next_line:
+ * -----------
+ * Returns the next line of an object file without its line break, and moves
+ * '*cursor' past it.
+ */
+char *next_line(char **cursor, const char *filename) {
+    char *line = *cursor;
+    if (*line == '\0')
+        invalid_object(filename);
+    char *end = strchr(line, '\n');
+    if (end) {
+        *cursor = end + 1;
+        if (end > line && end[-1] == '\r')
+            end--;
+        *end = '\0';
+    }
+    else
+        *cursor = line + strlen(line);
+    return line;
+}
+
+/*
+ * read_number:
+ * -------------
+ * Reads a non-negative decimal number at '*text' and moves '*text' past it and
+ * the space that follows it, if any.
+ */
+uint32_t read_number(char **text, const char *filename) {
+    char *end;
+    long number = strtol(*text, &end, 10);
+    if (end == *text || number < 0 || (*end != ' ' && *end != '\0'))
+        invalid_object(filename);
+    *text = *end ? end + 1 : end;
+    return (uint32_t)number;
+}
+
+/*
+ * read_header:
+ * -------------
+ * Reads a section header line "<keyword> <number>..." and returns the text after
+ * the keyword.
+ */
+char *read_header(char **cursor, const char *keyword, const char *filename) {
+    char *line = next_line(cursor, filename);
+    size_t length = strlen(keyword);
+    if (strncmp(line, keyword, length) != 0 || line[length] != ' ')
+        invalid_object(filename);
+    return line + length + 1;
+}
+
+/*
+ * read_word:
+ * -----------
+ * Returns the space-terminated word at '*text' and moves '*text' past it. What
+ * follows the word (the rest of the line) is a label name.
+ */
+char *read_word(char **text, const char *filename) {
+    char *word = *text;
+    char *space = strchr(word, ' ');
+    if (!space)
+        invalid_object(filename);
+    *space = '\0';
+    *text = space + 1;
+    return word;
+}
+
+/*
+ * load_module:
+ * -------------
+ * Reads an object file (see write_object in asm.c): appends its code after the
+ * modules read so far and merges its data, labels and relocations.
+ */
+void load_module(uint32_t module) {
+    const char *filename = module_files[module];
+    char *text = read_file(filename);
+    char *cursor = text;
+
+    if (strcmp(next_line(&cursor, filename), OBJECT_FORMAT) != 0) {
+        fprintf(stderr, "Error: '%s' is not a SIMP object file\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    // Code
+    uint32_t base = code_size;
+    char *fields = read_header(&cursor, "code", filename);
+    uint32_t count = read_number(&fields, filename);
+    grow(&code, &code_capacity, base + count, sizeof(uint64_t));
+    for (uint32_t i = 0; i < count; i++) {
+        char *line = next_line(&cursor, filename), *end;
+        code[code_size++] = strtoull(line, &end, 16);
+        if (end == line || *end != '\0')
+            invalid_object(filename);
+    }
+
+    // Data, at its '.word' addresses
+    fields = read_header(&cursor, "data", filename);
+    uint32_t size = read_number(&fields, filename);
+    count = read_number(&fields, filename);
+    if (size > data_size) {
+        grow(&data, &data_capacity, size, sizeof(uint32_t));
+        memset(data + data_size, 0, (size_t)(size - data_size) * sizeof(uint32_t));
+        data_size = size;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        char *line = next_line(&cursor, filename), *end;
+        uint32_t address = read_number(&line, filename);
+        uint32_t value = (uint32_t)strtoul(line, &end, 16);
+        if (address >= size || end == line || *end != '\0')
+            invalid_object(filename);
+        if (data[address] != 0) {
+            fprintf(stderr, "Error: Memory address %u already defined (in '%s')\n", address, filename);
+            exit(EXIT_FAILURE);
+        }
+        data[address] = value;
+    }
+
+    // Labels, moved to the module's base address
+    fields = read_header(&cursor, "labels", filename);
+    count = read_number(&fields, filename);
+    grow(&symbols, &symbol_capacity, symbol_count + count, sizeof(symbol));
+    for (uint32_t i = 0; i < count; i++) {
+        char *line = next_line(&cursor, filename);
+        symbol *label = &symbols[symbol_count++];
+        label->address = base + read_number(&line, filename);
+        char *kind = read_word(&line, filename);
+        label->global = strcmp(kind, "global") == 0;
+        if (!label->global && strcmp(kind, "local") != 0)
+            invalid_object(filename);
+        label->name = line;
+        label->module = module;
+    }
+
+    // Relocations
+    fields = read_header(&cursor, "relocations", filename);
+    count = read_number(&fields, filename);
+    grow(&relocations, &relocation_capacity, relocation_count + count, sizeof(relocation));
+    for (uint32_t i = 0; i < count; i++) {
+        char *line = next_line(&cursor, filename);
+        relocation *reference = &relocations[relocation_count++];
+        reference->instruction = base + read_number(&line, filename);
+        char *field = read_word(&line, filename);
+        if (strcmp(field, "imm1") == 0)
+            reference->shift = 12;
+        else if (strcmp(field, "imm2") == 0)
+            reference->shift = 0;
+        else
+            invalid_object(filename);
+        if (reference->instruction >= code_size)
+            invalid_object(filename);
+        reference->name = line;
+        reference->module = module;
+    }
+
+    // The label names point into the text, so it stays allocated
+}
+
+/*
+ * hash_name:
+ * -----------
+ * 32-bit FNV-1a hash of a label name.
+ */
+uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * find_symbol:
+ * -------------
+ * Returns the label 'name' as seen from 'module': the module's own label of that
+ * name if it has one, else the global label of that name, else NULL.
+ */
+symbol *find_symbol(const char *name, uint32_t module) {
+    symbol *global = NULL;
+    uint32_t mask = symbol_table_size - 1;
+    for (uint32_t slot = hash_name(name) & mask; symbol_table[slot]; slot = (slot + 1) & mask) {
+        symbol *label = &symbols[symbol_table[slot] - 1];
+        if (strcmp(label->name, name) != 0)
+            continue;
+        if (label->module == module)
+            return label;
+        if (label->global)
+            global = label;
+    }
+    return global;
+}
+
+/*
+ * build_symbol_table:
+ * --------------------
+ * Hashes all labels by name, and checks that no global label is defined twice.
+ */
+void build_symbol_table() {
+    symbol_table_size = 16;
+    while (symbol_table_size < symbol_count * 2)
+        symbol_table_size *= 2;
+    symbol_table = calloc(symbol_table_size, sizeof(uint32_t));
+    if (!symbol_table) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t mask = symbol_table_size - 1;
+    for (uint32_t i = 0; i < symbol_count; i++) {
+        uint32_t slot = hash_name(symbols[i].name) & mask;
+        for (; symbol_table[slot]; slot = (slot + 1) & mask) {
+            symbol *other = &symbols[symbol_table[slot] - 1];
+            if (symbols[i].global && other->global && strcmp(other->name, symbols[i].name) == 0) {
+                fprintf(stderr, "Error: Global label '%s' defined in both '%s' and '%s'\n",
+                        symbols[i].name, module_files[other->module], module_files[symbols[i].module]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        symbol_table[slot] = i + 1;
+    }
+}
+
+/*
+ * resolve_relocations:
+ * ---------------------
+ * Patches every label immediate with the final address of its label.
+ */
+void resolve_relocations() {
+    for (uint32_t i = 0; i < relocation_count; i++) {
+        relocation *reference = &relocations[i];
+        symbol *label = find_symbol(reference->name, reference->module);
+        if (!label) {
+            fprintf(stderr, "Error: Undefined label '%s' (in '%s')\n",
+                    reference->name, module_files[reference->module]);
+            exit(EXIT_FAILURE);
+        }
+        code[reference->instruction] |= (uint64_t)(label->address & ADDRESS_MASK) << reference->shift;
+    }
+}
+
+/*
+ * name_is_shared:
+ * ----------------
+ * Returns 1 if another label of the link has the same name as 'label'.
+ */
+int name_is_shared(const symbol *label) {
+    uint32_t mask = symbol_table_size - 1;
+    for (uint32_t slot = hash_name(label->name) & mask; symbol_table[slot]; slot = (slot + 1) & mask) {
+        const symbol *other = &symbols[symbol_table[slot] - 1];
+        if (other != label && strcmp(other->name, label->name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * write_symbol:
+ * --------------
+ * Writes one line of the symbol map. A local label whose name is also used by
+ * another module is written as "<module>:<name>" (the object file name without
+ * its directory and extension), so sim --symbols never mixes up two of them.
+ */
+void write_symbol(FILE *file, const symbol *label) {
+    if (label->global || !name_is_shared(label)) {
+        fprintf(file, "%s %03X\n", label->name, label->address);
+        return;
+    }
+    const char *module = module_files[label->module];
+    const char *base = module;
+    for (const char *c = module; *c; c++)
+        if (*c == '/' || *c == '\\')
+            base = c + 1;
+    const char *extension = strrchr(base, '.');
+    int length = extension && extension != base ? (int)(extension - base) : (int)strlen(base);
+    fprintf(file, "%.*s:%s %03X\n", length, base, label->name, label->address);
+}
+
+/*
+ * open_output:
+ * -------------
+ * Opens an output file for writing, or exits.
+ */
+FILE *open_output(const char *filename) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    return file;
+}
+
+/*
+ * write_outputs:
+ * ---------------
+ * Writes the linked instruction and data memories in the format asm writes them,
+ * and the symbol map if one was requested.
+ */
+void write_outputs(const char *instruction_file, const char *data_file, const char *symbol_file) {
+    FILE *file = open_output(instruction_file);
+    for (uint32_t i = 0; i < code_size; i++)
+        fprintf(file, "%012llX\n", (unsigned long long)code[i]);
+    fclose(file);
+
+    // Like asm, a program without data still gets a one-word data memory
+    file = open_output(data_file);
+    for (uint32_t i = 0; i < (data_size ? data_size : 1); i++)
+        fprintf(file, "%08X\n", i < data_size ? data[i] : 0);
+    fclose(file);
+
+    if (symbol_file) {
+        file = open_output(symbol_file);
+        for (uint32_t i = 0; i < symbol_count; i++)
+            write_symbol(file, &symbols[i]);
+        fclose(file);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *symbol_file = NULL;
+    char *files[2];
+    int file_count = 0;
+
+    module_files = malloc((size_t)argc * sizeof(char *));
+    if (!module_files) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--symbols=", 10) == 0)
+            symbol_file = argv[i] + 10;
+        else if (file_count < 2)
+            files[file_count++] = argv[i];
+        else
+            module_files[module_count++] = argv[i];
+    }
+    if (module_count == 0) {
+        fprintf(stderr, "Usage: %s [--symbols=FILE] <imemin.txt> <dmemin.txt> <object>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < module_count; i++)
+        load_module(i);
+    build_symbol_table();
+    resolve_relocations();
+    write_outputs(files[0], files[1], symbol_file);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,428 @@
+// Assemble-and-run driver for SIMP programs (POSIX hosts: uses dirent, mkdir and pthreads).
+#define _GNU_SOURCE
+
+#include <stdio.h>          // For file I/O (fopen, fread, fprintf)
+#include <stdlib.h>         // For exit, malloc, qsort, strtoull
+#include <string.h>         // For strcmp, strncmp, strrchr
+#include <stdint.h>         // For fixed-width integer types
+#include <time.h>           // For clock_gettime
+#include <dirent.h>         // For opendir, readdir
+#include <pthread.h>        // For the worker threads
+#include <unistd.h>         // For sysconf
+#include <sys/stat.h>       // For stat, mkdir
+#include "simp.h"           // Simulator library (sim.c built with -DSIMP_LIBRARY)
+#include "simpasm.h"        // Assembler library (asm.c built with -DSIMPASM_LIBRARY)
+
+/*
+ * simprun:
+ * ---------
+ * Assembles SIMP programs in memory and runs them on the simulator library, with
+ * no imemin.txt / dmemin.txt round trip and no process per program:
+ *
+ *     gcc -O2 -DSIMP_LIBRARY -DSIMPASM_LIBRARY -o simprun simprun.c asm.c sim.c -lpthread
+ *     ./simprun --engine=block --output=results variants/ extra.asm
+ *
+ * Every argument is a .asm file or a directory, all of whose .asm files run (in
+ * name order). The programs are assembled one after the other and then run on
+ * --jobs threads, each on its own machine. One tab-separated line per program goes
+ * to stdout, in argument order: source, result ("halted", "limit" or the error),
+ * cycles and host seconds of the run. With --output=DIR, every program also gets a
+ * directory DIR/<name> with the dmemout.txt, regout.txt, cycles.txt and diskout.txt
+ * that sim would write. simprun exits with a failure if any program failed to
+ * assemble or run.
+ *
+ * Everything here is static, clear of the global names of sim.c and asm.c.
+ */
+
+#define SIMPRUN_PATH_LEN 1024
+#define DATA_MEMORY_WORDS 4096          // Data memory of a simp machine (sim's default --data-memory)
+#define DISK_WORDS (128 * 128)          // Disk of a simp machine (default sectors * words per sector)
+#define IO_CLOCK_CYCLE 8                // I/O register written to cycles.txt (clks)
+#define NUM_CPU_REGS 16
+
+// One program (a line of the report)
+typedef struct {
+    char source[SIMPRUN_PATH_LEN];      // .asm file
+    simpasm_program program;            // Assembled images (empty if assembly failed)
+    int assembled;                      // 1 = assembly succeeded
+    int result;                         // SIMP_RUN_* of the run
+    char error[SIMPASM_ERROR_LEN + 32]; // Why assembly or the run failed
+    uint64_t cycles;                    // Cycles run
+    double seconds;                     // Host wall-clock time of the run
+} simprun_job;
+
+// Globals for the options
+static int engine = SIMP_ENGINE_SWITCH;         // --engine
+static int thread_count = 0;                    // --jobs (0 = one per online CPU)
+static uint64_t max_cycles = 0;                 // --max-cycles (0 = until HALT)
+static const char *output_directory = NULL;     // --output
+static char *disk_text = NULL;                  // --diskin: disk image (diskin.txt format)
+static size_t disk_text_length = 0;
+static uint32_t *irq2_cycles = NULL;            // --irq2in: IRQ2 event cycles
+static size_t irq2_count = 0;
+
+static simprun_job *jobs = NULL;
+static int job_count = 0;
+static int job_capacity = 0;
+static int next_job = 0;                        // Next job for a worker to take
+static pthread_mutex_t next_job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * fail:
+ * ------
+ * Prints an error and exits.
+ */
+static void fail(const char *message, const char *detail) {
+    fprintf(stderr, "Error: %s%s%s\n", message, detail ? " " : "", detail ? detail : "");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * read_file:
+ * -----------
+ * Reads a whole file into memory (NUL-terminated) and stores its length in '*length'.
+ */
+static char *read_file(const char *filename, size_t *length) {
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        fail("Cannot open", filename);
+
+    size_t capacity = 65536, size = 0, got;
+    char *text = malloc(capacity);
+    while (text && (got = fread(text + size, 1, capacity - size - 1, file)) > 0) {
+        size += got;
+        if (size == capacity - 1) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    if (!text)
+        fail("Out of memory", NULL);
+    fclose(file);
+    text[size] = '\0';
+    *length = size;
+    return text;
+}
+
+/*
+ * add_job:
+ * ---------
+ * Appends a program to run.
+ */
+static void add_job(const char *source) {
+    if (job_count == job_capacity) {
+        job_capacity = job_capacity ? job_capacity * 2 : 64;
+        jobs = realloc(jobs, (size_t)job_capacity * sizeof(simprun_job));
+        if (!jobs)
+            fail("Out of memory", NULL);
+    }
+    if (strlen(source) >= SIMPRUN_PATH_LEN)
+        fail("Path too long:", source);
+    memset(&jobs[job_count], 0, sizeof(simprun_job));
+    strcpy(jobs[job_count].source, source);
+    job_count++;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * add_directory:
+ * ---------------
+ * Adds every .asm file of a directory, in name order.
+ */
+static void add_directory(const char *directory) {
+    DIR *dir = opendir(directory);
+    if (!dir)
+        fail("Cannot open directory", directory);
+
+    char **names = NULL;
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length <= 4 || strcmp(entry->d_name + length - 4, ".asm") != 0)
+            continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            names = realloc(names, (size_t)capacity * sizeof(char *));
+        }
+        if (!names || !(names[count] = strdup(entry->d_name)))
+            fail("Out of memory", NULL);
+        count++;
+    }
+    closedir(dir);
+
+    qsort(names, (size_t)count, sizeof(char *), compare_names);
+    char path[SIMPRUN_PATH_LEN];
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", directory, names[i]);
+        add_job(path);
+        free(names[i]);
+    }
+    free(names);
+}
+
+/*
+ * read_irq2_schedule:
+ * --------------------
+ * Reads an irq2in.txt file: one event cycle per line, in increasing order.
+ */
+static void read_irq2_schedule(const char *filename) {
+    size_t length;
+    char *text = read_file(filename, &length);
+    size_t capacity = 0;
+
+    for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+        if (irq2_count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            irq2_cycles = realloc(irq2_cycles, capacity * sizeof(uint32_t));
+            if (!irq2_cycles)
+                fail("Out of memory", NULL);
+        }
+        irq2_cycles[irq2_count++] = (uint32_t)atoi(line); // As sim's read_next_irq
+    }
+    free(text);
+}
+
+/*
+ * save_memory:
+ * -------------
+ * Writes 'size' words read by 'read' to 'filename' as sim does (up to the highest
+ * nonzero word; nothing if that is word 0).
+ */
+static void save_memory(const char *filename, simp_machine *m, uint32_t (*read)(const simp_machine *, uint32_t), uint32_t size) {
+    FILE *file = fopen(filename, "w");
+    if (!file)
+        fail("Cannot open", filename);
+    uint32_t max = 0;
+    for (uint32_t i = 0; i < size; i++)
+        if (read(m, i) != 0)
+            max = i;
+    if (max != 0)
+        for (uint32_t i = 0; i <= max; i++)
+            fprintf(file, "%08X\n", read(m, i));
+    fclose(file);
+}
+
+/*
+ * write_outputs:
+ * ---------------
+ * Writes the final state of a program's machine to DIR/<name>/, where <name> is
+ * the source file name without its directory and extension.
+ */
+static void write_outputs(const simprun_job *job, simp_machine *m) {
+    const char *name = strrchr(job->source, '/');
+    name = name ? name + 1 : job->source;
+    size_t length = strlen(name);
+    if (length > 4 && strcmp(name + length - 4, ".asm") == 0)
+        length -= 4;
+
+    char directory[SIMPRUN_PATH_LEN], path[SIMPRUN_PATH_LEN + 32];
+    snprintf(directory, sizeof(directory), "%s/%.*s", output_directory, (int)length, name);
+    mkdir(directory, 0777);
+
+    snprintf(path, sizeof(path), "%s/dmemout.txt", directory);
+    save_memory(path, m, simp_read_memory, DATA_MEMORY_WORDS);
+    snprintf(path, sizeof(path), "%s/diskout.txt", directory);
+    save_memory(path, m, simp_read_disk, DISK_WORDS);
+
+    snprintf(path, sizeof(path), "%s/regout.txt", directory);
+    FILE *file = fopen(path, "w");
+    if (!file)
+        fail("Cannot open", path);
+    for (int i = 3; i < NUM_CPU_REGS; i++)
+        fprintf(file, "%08X\n", simp_get_register(m, i));
+    fclose(file);
+
+    snprintf(path, sizeof(path), "%s/cycles.txt", directory);
+    file = fopen(path, "w");
+    if (!file)
+        fail("Cannot open", path);
+    fprintf(file, "%d\n", (int)simp_get_io_register(m, IO_CLOCK_CYCLE));
+    fclose(file);
+}
+
+/*
+ * run_cycles:
+ * ------------
+ * Runs 'm' until HALT, but no further than cycle 'limit' (0 = no limit).
+ */
+static int run_cycles(simp_machine *m, uint64_t limit) {
+    if (!limit)
+        return simp_run_until_halt(m);
+    return simp_cycles(m) < limit ? simp_run_cycles(m, limit - simp_cycles(m)) : SIMP_RUN_LIMIT;
+}
+
+/*
+ * run_job:
+ * ---------
+ * Runs an assembled program on a new machine. IRQ2 events are raised at the start
+ * of their cycle, as sim does with irq2in.txt.
+ */
+static void run_job(simprun_job *job) {
+    simp_machine *m = simp_create(engine);
+    if (!m) {
+        job->result = SIMP_RUN_ERROR;
+        strcpy(job->error, "Out of memory");
+        return;
+    }
+    simp_load_instruction_words(m, job->program.instructions, job->program.instruction_count);
+    simp_load_data_words(m, SIMP_IMAGE_DATA, job->program.data, job->program.data_count);
+    if (disk_text)
+        simp_load(m, SIMP_IMAGE_DISK, disk_text, disk_text_length);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int result = SIMP_RUN_LIMIT;
+    for (size_t i = 0; i < irq2_count && result == SIMP_RUN_LIMIT; i++) {
+        // sim waits for each event in turn, so one that is already past (or beyond
+        // --max-cycles) holds back the rest
+        if (irq2_cycles[i] < simp_cycles(m) || (max_cycles && irq2_cycles[i] >= max_cycles))
+            break;
+        result = run_cycles(m, irq2_cycles[i]);
+        if (result == SIMP_RUN_LIMIT)
+            simp_raise_irq2(m);
+    }
+    if (result == SIMP_RUN_LIMIT)
+        result = run_cycles(m, max_cycles);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    job->result = result;
+    job->cycles = simp_cycles(m);
+    if (result == SIMP_RUN_ERROR)
+        snprintf(job->error, sizeof(job->error), "%s", simp_error(m));
+    if (output_directory)
+        write_outputs(job, m);
+    simp_destroy(m);
+}
+
+/*
+ * worker_main:
+ * -------------
+ * Takes programs off the job list until none are left.
+ */
+static void *worker_main(void *argument) {
+    (void)argument;
+    for (;;) {
+        pthread_mutex_lock(&next_job_lock);
+        int index = next_job++;
+        pthread_mutex_unlock(&next_job_lock);
+        if (index >= job_count)
+            return NULL;
+        if (jobs[index].assembled)
+            run_job(&jobs[index]);
+    }
+}
+
+/*
+ * parse_options:
+ * ---------------
+ * Handles the '--' switches and adds every other argument as a source or directory.
+ */
+static void parse_options(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--engine=", 9) == 0) {
+            const char *names[] = { "switch", "threaded", "block", "jit" };
+            engine = -1;
+            for (int e = 0; e < 4; e++)
+                if (strcmp(arg + 9, names[e]) == 0)
+                    engine = e;  // SIMP_ENGINE_* in the same order
+            if (engine < 0)
+                fail("Unknown engine", arg + 9);
+        }
+        else if (strncmp(arg, "--jobs=", 7) == 0) {
+            thread_count = atoi(arg + 7);
+            if (thread_count < 1)
+                fail("Invalid --jobs", arg + 7);
+        }
+        else if (strncmp(arg, "--max-cycles=", 13) == 0)
+            max_cycles = strtoull(arg + 13, NULL, 0);
+        else if (strncmp(arg, "--output=", 9) == 0)
+            output_directory = arg + 9;
+        else if (strncmp(arg, "--diskin=", 9) == 0)
+            disk_text = read_file(arg + 9, &disk_text_length);
+        else if (strncmp(arg, "--irq2in=", 9) == 0)
+            read_irq2_schedule(arg + 9);
+        else if (strncmp(arg, "--", 2) == 0)
+            fail("Unknown option", arg);
+        else {
+            struct stat info;
+            if (stat(arg, &info) == 0 && S_ISDIR(info.st_mode))
+                add_directory(arg);
+            else
+                add_job(arg);
+        }
+    }
+}
+
+/*
+ * main:
+ * ------
+ * Assembles every program, runs them and prints the report.
+ */
+int main(int argc, char *argv[]) {
+    parse_options(argc, argv);
+    if (job_count == 0) {
+        fprintf(stderr, "Usage: %s [options] <source.asm | directory>...\n"
+                        "Options:\n"
+                        "  --engine=switch|threaded|block|jit   Execution engine (default: switch)\n"
+                        "  --jobs=N                             Programs run at once (default: one per CPU)\n"
+                        "  --max-cycles=N                       Stop each program after N cycles (default: at HALT)\n"
+                        "  --diskin=FILE                        Initial disk of every program (diskin.txt format)\n"
+                        "  --irq2in=FILE                        IRQ2 events of every program (irq2in.txt format)\n"
+                        "  --output=DIR                         Write each program's final state to DIR/<name>/\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (output_directory)
+        mkdir(output_directory, 0777);
+
+    // The assembler is single-threaded: assemble everything first
+    for (int i = 0; i < job_count; i++) {
+        size_t length;
+        char *source = read_file(jobs[i].source, &length);
+        jobs[i].assembled = simpasm_assemble(source, length, &jobs[i].program) == 0;
+        if (!jobs[i].assembled)
+            snprintf(jobs[i].error, sizeof(jobs[i].error), "assembly: %s", jobs[i].program.error);
+        free(source);
+    }
+
+    int workers = thread_count ? thread_count : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > job_count)
+        workers = job_count;
+    if (workers < 1)
+        workers = 1;
+    pthread_t *threads = calloc((size_t)workers, sizeof(pthread_t));
+    if (!threads)
+        fail("Out of memory", NULL);
+    for (int w = 1; w < workers; w++)
+        if (pthread_create(&threads[w], NULL, worker_main, NULL) != 0)
+            fail("Cannot start worker thread", NULL);
+    worker_main(NULL);  // The main thread is worker 0
+    for (int w = 1; w < workers; w++)
+        pthread_join(threads[w], NULL);
+    free(threads);
+
+    int failures = 0;
+    for (int i = 0; i < job_count; i++) {
+        const simprun_job *job = &jobs[i];
+        if (!job->assembled || job->result == SIMP_RUN_ERROR) {
+            printf("%s\terror: %s\t%llu\t%.6f\n", job->source, job->error, (unsigned long long)job->cycles, job->seconds);
+            failures++;
+        }
+        else
+            printf("%s\t%s\t%llu\t%.6f\n", job->source, job->result == SIMP_RUN_HALTED ? "halted" : "limit",
+                   (unsigned long long)job->cycles, job->seconds);
+        simpasm_free(&jobs[i].program);
+    }
+    free(jobs);
+
+    if (failures)
+        fprintf(stderr, "Error: %d of %d programs failed\n", failures, job_count);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+// Disable secure warnings on Windows (allows use of functions like 'fopen' without warnings).
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>      // For file I/O (fopen, fread, fprintf)
+#include <stdlib.h>     // For exit, malloc
+#include <string.h>     // For memcmp, memcpy
+#include <stdint.h>     // For fixed-width integer types
+
+// Binary trace format (must match sim.c, see write_binary_trace_record)
+#define TRACE_BINARY_MAGIC "SIMPTRC1"   // First 8 bytes of a binary trace
+#define TRACE_BINARY_VERSION 1
+#define TRACE_RECORD_KEYFRAME 0xFF      // Record tag: PC and all 16 registers follow
+#define TRACE_RECORD_NEXT_PC 0x80       // Delta tag flag: PC = previous PC + 1 (else a 32-bit PC follows)
+#define NUM_CPU_REGS 16                 // Number of CPU registers
+
+// Globals
+uint64_t *instruction_memory = NULL;    // Instruction memory image from the trace header
+uint32_t instruction_words = 0;         // Words in instruction_memory (the rest read as 0)
+FILE *trace_in = NULL;                  // Binary trace being decoded
+FILE *trace_out = NULL;                 // Text trace being written
+
+/*
+ * read_bytes / read_u32:
+ * -----------------------
+ * Read from the binary trace. read_bytes returns 0 at a clean end of file (before
+ * the first byte of a record) and exits on a truncated record.
+ */
+int read_bytes(void *buffer, size_t count, int record_start) {
+    size_t got = fread(buffer, 1, count, trace_in);
+    if (got == count)
+        return 1;
+    if (got == 0 && record_start)
+        return 0;
+    fprintf(stderr, "Error: Truncated binary trace\n");
+    exit(EXIT_FAILURE);
+}
+
+uint32_t read_u32() {
+    uint8_t bytes[4];
+    read_bytes(bytes, 4, 0);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/*
+ * sign_extend:
+ * -------------
+ * Sign-extends a 'bits'-bit value (the 12-bit immediates, as in sim.c).
+ */
+int32_t sign_extend(int32_t value, int bits) {
+    int32_t mask = 1 << (bits - 1);
+    return (value ^ mask) - mask;
+}
+
+/*
+ * read_header:
+ * -------------
+ * Checks the magic and version and loads the instruction memory image.
+ */
+void read_header() {
+    char magic[8];
+    if (!read_bytes(magic, 8, 1) || memcmp(magic, TRACE_BINARY_MAGIC, 8) != 0) {
+        fprintf(stderr, "Error: Not a binary SIMP trace\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t version = read_u32();
+    if (version != TRACE_BINARY_VERSION) {
+        fprintf(stderr, "Error: Unsupported binary trace version %u\n", version);
+        exit(EXIT_FAILURE);
+    }
+    read_u32(); // Keyframe interval (informational)
+
+    instruction_words = read_u32();
+    instruction_memory = malloc((instruction_words ? instruction_words : 1) * sizeof(uint64_t));
+    if (!instruction_memory) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < instruction_words; i++) {
+        uint64_t low = read_u32();
+        instruction_memory[i] = low | ((uint64_t)read_u32() << 32);
+    }
+}
+
+/*
+ * decode_trace:
+ * --------------
+ * Replays every record and writes the trace line it stands for, in exactly the
+ * text format of sim.c ("%03X %012llX " followed by the 16 registers as "%08x").
+ */
+void decode_trace() {
+    uint32_t registers[NUM_CPU_REGS] = { 0 };
+    uint32_t pc = 0;
+    int have_keyframe = 0;
+    uint8_t tag;
+
+    while (read_bytes(&tag, 1, 1)) {
+        if (tag == TRACE_RECORD_KEYFRAME) {
+            pc = read_u32();
+            for (int i = 0; i < NUM_CPU_REGS; i++)
+                registers[i] = read_u32();
+            have_keyframe = 1;
+        }
+        else {
+            if (!have_keyframe) {
+                fprintf(stderr, "Error: Binary trace does not start with a keyframe\n");
+                exit(EXIT_FAILURE);
+            }
+            pc = (tag & TRACE_RECORD_NEXT_PC) ? pc + 1 : read_u32();
+
+            // $imm1 and $imm2 are predicted from the instruction itself
+            uint64_t word = pc < instruction_words ? instruction_memory[pc] : 0;
+            registers[1] = sign_extend((int32_t)((word >> 12) & 0xFFF), 12);
+            registers[2] = sign_extend((int32_t)(word & 0xFFF), 12);
+
+            // Then the registers that differ from the prediction
+            for (int changed = tag & 0x1F; changed; changed--) {
+                uint8_t index;
+                read_bytes(&index, 1, 0);
+                if (index >= NUM_CPU_REGS) {
+                    fprintf(stderr, "Error: Corrupt binary trace record\n");
+                    exit(EXIT_FAILURE);
+                }
+                registers[index] = read_u32();
+            }
+        }
+
+        uint64_t instruction = pc < instruction_words ? instruction_memory[pc] : 0;
+        fprintf(trace_out, "%03X %012llX ", pc, (unsigned long long)instruction);
+        for (int i = 0; i < NUM_CPU_REGS; i++)
+            fprintf(trace_out, (i != NUM_CPU_REGS - 1) ? "%08x " : "%08x\n", registers[i]);
+    }
+}
+
+/*
+ * main:
+ * ------
+ * Converts a trace written with 'sim --trace-format=binary' back to trace.txt.
+ *  1) binary trace (input)
+ *  2) trace.txt (output)
+ */
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <binary trace> <trace.txt>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    trace_in = fopen(argv[1], "rb");
+    if (!trace_in) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    trace_out = fopen(argv[2], "w");
+    if (!trace_out) {
+        fprintf(stderr, "Error: Cannot open '%s'\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    read_header();
+    decode_trace();
+
+    fclose(trace_in);
+    fclose(trace_out);
+    free(instruction_memory);
+    return EXIT_SUCCESS;
+}